@@ -414,14 +414,77 @@ void BME280::readPressure
       return;
    }
    uint32_t rawPressure = (data[0] << 12) | (data[1] << 4) | (data[2] >> 4);
-//   uint32_t rawTemp = (data[3] << 12) | (data[4] << 4) | (data[5] >> 4);
+   uint32_t rawTemp = (data[3] << 12) | (data[4] << 4) | (data[5] >> 4);
 //   uint32_t rawHumidity = (data[6] << 8) | data[7];
-//   temp = CalculateTemperature(rawTemp, t_fine, tempUnit);
+   CalculateTemperature(rawTemp, t_fine); // MV: t_fine is needed by the pressure compensation
    pressure = CalculatePressure(rawPressure, t_fine, (PresUnit) 0);
 //   humidity = CalculateHumidity(rawHumidity, t_fine);
 }
 
 
+/****************************************************************/
+// MV: non blocking read: trigger
+bool BME280::startMeasurement()
+{
+   uint8_t ctrlHum, ctrlMeas, config;
+
+   if (m_settings.mode != Mode_Forced)
+   {
+      return true;
+   }
+
+   CalculateRegisters(ctrlHum, ctrlMeas, config);
+   return WriteRegister(CTRL_MEAS_ADDR, ctrlMeas);
+}
+
+
+/****************************************************************/
+// MV: non blocking read: poll
+bool BME280::isMeasuring
+(
+   bool& measuring
+)
+{
+   uint8_t buffer[2]; // status, ctrl_meas
+
+   if (!ReadRegister(STATUS_ADDR, buffer, sizeof(buffer)))
+   {
+      return false;
+   }
+
+   measuring = (buffer[0] & STATUS_MEASURING) != 0;
+   // a forced conversion is only over when the chip is back to sleep mode
+   if (m_settings.mode == Mode_Forced && (buffer[1] & CTRL_MEAS_MODE_MASK) != Mode_Sleep)
+   {
+      measuring = true;
+   }
+   return true;
+}
+
+
+/****************************************************************/
+// MV: non blocking read: fetch pressure and temperature only
+bool BME280::readPressureData
+(
+   float& pressure
+)
+{
+   uint8_t buffer[PRESS_TEMP_DATA_LENGTH];
+   int32_t t_fine;
+
+   if (!ReadRegister(PRESS_ADDR, buffer, PRESS_TEMP_DATA_LENGTH))
+   {
+      return false;
+   }
+
+   uint32_t rawPressure = ((uint32_t)buffer[0] << 12) | ((uint32_t)buffer[1] << 4) | (buffer[2] >> 4);
+   uint32_t rawTemp     = ((uint32_t)buffer[3] << 12) | ((uint32_t)buffer[4] << 4) | (buffer[5] >> 4);
+   CalculateTemperature(rawTemp, t_fine);
+   pressure = CalculatePressure(rawPressure, t_fine, PresUnit_Pa);
+   return true;
+}
+
+
 /****************************************************************/
 uint8_t BME280::chipID
 (
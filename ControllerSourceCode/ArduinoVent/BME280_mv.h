@@ -180,6 +180,30 @@ struct Settings {
       float&    pressure);
 
 
+/*****************************************************************/
+/* MV: NON BLOCKING FUNCTIONS                                    */
+/*****************************************************************/
+
+   /////////////////////////////////////////////////////////////////
+   /// MV: Start a conversion. In forced mode only ctrl_meas is
+   /// written, in normal mode the sensor is free running and
+   /// nothing goes to the bus.
+   bool startMeasurement();
+
+   /////////////////////////////////////////////////////////////////
+   /// MV: Poll status and ctrl_meas. measuring stays true until the
+   /// result registers hold a complete conversion. Returns false on
+   /// bus error.
+   bool isMeasuring(
+      bool&     measuring);
+
+   /////////////////////////////////////////////////////////////////
+   /// MV: Burst read only the pressure and temperature registers and
+   /// return the compensated pressure in Pa. Returns false on bus error.
+   bool readPressureData(
+      float&    pressure);
+
+
 /*****************************************************************/
 /* ACCESSOR FUNCTIONS                                            */
 /*****************************************************************/
@@ -228,6 +252,7 @@ private:
 /*****************************************************************/
 
    static const uint8_t CTRL_HUM_ADDR   = 0xF2;
+   static const uint8_t STATUS_ADDR     = 0xF3;
    static const uint8_t CTRL_MEAS_ADDR  = 0xF4;
    static const uint8_t CONFIG_ADDR     = 0xF5;
    static const uint8_t PRESS_ADDR      = 0xF7;
@@ -245,6 +270,10 @@ private:
    static const uint8_t HUM_DIG_ADDR2_LENGTH    = 7;
    static const uint8_t DIG_LENGTH              = 32;
    static const uint8_t SENSOR_DATA_LENGTH      = 8;
+   static const uint8_t PRESS_TEMP_DATA_LENGTH  = 6;
+
+   static const uint8_t STATUS_MEASURING        = 0x08;
+   static const uint8_t CTRL_MEAS_MODE_MASK     = 0x03;
 
 /*****************************************************************/
 /* VARIABLES                                                     */
@@ -24,6 +24,8 @@
 #include "log.h"
 #include "hal.h"
 #include "languages.h"
+#include "blackbox.h"
+#include <string.h>
 
 #define MAX_SOUND_DEFAULT                   3
 #define MAX_SOUND_ALARM_LOW_PRESSURE        MAX_SOUND_DEFAULT
@@ -34,214 +36,174 @@
 
 // #define SIM_HIGH_PRESSURE
 
-typedef enum : uint8_t {
-    ST_ALARM_OFF,
-    ST_ALARM_ON,
-} state_t;
+typedef struct alarm_def_st {
+    const char *  message;          // PROGMEM
+    alarm_prio_t  prio;
+    int8_t        max_sound;        // num max to be sounded. if -1 always will have sound alarm
+} alarm_def_t;
 
-typedef void (*muteFunc_t)(void);
-typedef void (*goOffFunc_t)(void);
-
-
-typedef struct alarm_st {
-    state_t     state;
-    uint8_t     cnt_sound;         // num of times being sounded before become visual only
-    int8_t      max_sound;         // num max to be sounded. if -1 always will have sound alarm
-    const char *  message;
-    goOffFunc_t goOffAction;
-    muteFunc_t  muteAction;
-} alarm_t;
+static_assert(ALARM_IDX_END <= 16, "one bit per alarm in the uint16_t bitmaps");
+static_assert((int) HAL_TONE_OFF == (int) ALARM_PRIO_NUM, "hal_tone_t follows alarm_prio_t");
 
 static Alarm * alarm;
+static uint8_t cnt_sound[ALARM_IDX_END];   // num of times muted, visual only once it reaches max_sound
 
-inline bool isMuted (alarm_t * a) {
-    if (a->max_sound == -1)
-        return false;
-    if (a->cnt_sound >= a->max_sound)
-        return true;
-    return false;
-}
 void alarmResetAll()
 {
     alarm->internalAlarmResetAll();
 }
 
-void muteHighPressureAlarm()
-{
+// messages stay in flash: receivers copy them out with alarmGetMessage()
+static const char msgHighPressure[] PROGMEM = STR_ALARM_HIGH_PRESSURE;
+static const char msgLowPressure[] PROGMEM = STR_ALARM_LOW_PRESSURE;
+static const char msgUnderSpeed[] PROGMEM = STR_ALARM_UNDER_SPEED;
+static const char msgFastCalibToStart[] PROGMEM = STR_ALARM_FAST_CALIB_TO_START;
+static const char msgFastCalibDone[] PROGMEM = STR_ALARM_FAST_CALIB_DONE;
+static const char msgBadPressSensor[] PROGMEM = STR_ALARM_BAD_PRESS_SENSOR;
+static const char msgHighTidal[] PROGMEM = STR_ALARM_HIGH_TIDAL;
+static const char msgLowTidal[] PROGMEM = STR_ALARM_LOW_TIDAL;
+static const char msgValveCalibToStart[] PROGMEM = STR_ALARM_VALVE_CALIB_TO_START;
+static const char msgValveCalibDone[] PROGMEM = STR_ALARM_VALVE_CALIB_DONE;
+static const char msgValveCalibFail[] PROGMEM = STR_ALARM_VALVE_CALIB_FAIL;
+static const char msgMotorEoc[] PROGMEM = STR_ALARM_MOTOR_EOC;
+static const char msgApnea[] PROGMEM = STR_ALARM_APNEA;
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1)
+static const char msgHighLeak[] PROGMEM = STR_ALARM_HIGH_LEAK;
+#endif
 
-}
+// definitions stay in flash too. Note: one entry per ALARM_IDX_xxx, same order
+static const alarm_def_t alarms[] PROGMEM = {
+    { msgHighPressure,      ALARM_PRIO_HIGH,    MAX_SOUND_ALARM_HIGH_PRESSURE },
+    { msgLowPressure,       ALARM_PRIO_HIGH,    MAX_SOUND_ALARM_LOW_PRESSURE },
+    { msgUnderSpeed,        ALARM_PRIO_HIGH,    MAX_SOUND_ALARM_UNDER_SPEED },
+    { msgFastCalibToStart,  ALARM_PRIO_LOW,     MAX_SOUND_DEFAULT },
+    { msgFastCalibDone,     ALARM_PRIO_LOW,     MAX_SOUND_DEFAULT },
+    { msgBadPressSensor,    ALARM_PRIO_HIGH,    MAX_SOUND_DEFAULT },
+    { msgHighTidal,         ALARM_PRIO_MEDIUM,  MAX_SOUND_ALARM_HIGH_TIDAL },
+    { msgLowTidal,          ALARM_PRIO_MEDIUM,  MAX_SOUND_ALARM_LOW_TIDAL },
+    { msgValveCalibToStart, ALARM_PRIO_LOW,     MAX_SOUND_DEFAULT },
+    { msgValveCalibDone,    ALARM_PRIO_LOW,     MAX_SOUND_DEFAULT },
+    { msgValveCalibFail,    ALARM_PRIO_MEDIUM,  MAX_SOUND_DEFAULT },
+    { msgMotorEoc,          ALARM_PRIO_HIGH,    MAX_SOUND_DEFAULT },
+    { msgApnea,             ALARM_PRIO_HIGH,    MAX_SOUND_DEFAULT },
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1)
+    { msgHighLeak,          ALARM_PRIO_MEDIUM,  MAX_SOUND_DEFAULT },
+#endif
+};
 
-void muteLowPressureAlarm()
-{
+static_assert(sizeof(alarms) / sizeof(alarms[0]) == ALARM_IDX_END, "one alarms[] entry per ALARM_IDX_xxx");
 
+static void loadDef(uint8_t idx, alarm_def_t * d)
+{
+#ifndef VENTSIM
+    memcpy_P(d, &alarms[idx], sizeof(*d));
+#else
+    memcpy(d, &alarms[idx], sizeof(*d));
+#endif
 }
 
-void muteHighTidalAlarm()
+void alarmGetMessage(uint16_t idx, char * dst)
 {
-
+    alarm_def_t d;
+    if (idx >= ALARM_IDX_END) {
+        *dst = 0;
+        return;
+    }
+    loadDef(idx, &d);
+#ifndef VENTSIM
+    strcpy_P(dst, d.message);
+#else
+    strcpy(dst, d.message);
+#endif
 }
 
-void muteLowTidalAlarm()
+alarm_prio_t alarmGetPriority(uint16_t idx)
 {
-
+    alarm_def_t d;
+    if (idx >= ALARM_IDX_END) return ALARM_PRIO_LOW;
+    loadDef(idx, &d);
+    return d.prio;
 }
 
-static alarm_t alarms[] = {
-  {
-        ST_ALARM_OFF,
-        0,
-        MAX_SOUND_ALARM_HIGH_PRESSURE,
-        STR_ALARM_HIGH_PRESSURE,
-        0,
-        muteHighPressureAlarm
-  },
-
-  {
-        ST_ALARM_OFF,
-        0,
-        MAX_SOUND_ALARM_LOW_PRESSURE,
-        STR_ALARM_LOW_PRESSURE,
-        0,
-        muteLowPressureAlarm
-  },
-
-  {
-        ST_ALARM_OFF,
-        0,
-        MAX_SOUND_ALARM_UNDER_SPEED,
-        STR_ALARM_UNDER_SPEED,
-        0,
-        0
-  },
-
-    {
-          ST_ALARM_OFF,
-          0,
-          MAX_SOUND_DEFAULT,
-          STR_ALARM_FAST_CALIB_TO_START,
-          0,
-          0
-    },
-
-    {
-          ST_ALARM_OFF,
-          0,
-          MAX_SOUND_DEFAULT,
-          STR_ALARM_FAST_CALIB_DONE,
-          0,
-          0
-    },
-  
-    {
-          ST_ALARM_OFF,
-          0,
-          MAX_SOUND_DEFAULT,
-          STR_ALARM_BAD_PRESS_SENSOR,
-          0,
-          0
-    },
-  {
-        ST_ALARM_OFF,
-        0,
-        MAX_SOUND_ALARM_HIGH_TIDAL,
-        STR_ALARM_HIGH_TIDAL,
-        0,
-        muteHighTidalAlarm
-  },
-
-  {
-        ST_ALARM_OFF,
-        0,
-        MAX_SOUND_ALARM_LOW_TIDAL,
-        STR_ALARM_LOW_TIDAL,
-        0,
-        muteLowTidalAlarm
-  },
+void Alarm::updateTone()
+{
+    uint8_t p;
+    // highest priority that still sounds, ALARM_PRIO_NUM (HAL_TONE_OFF) if none
+    for (p=0; p<ALARM_PRIO_NUM && audible[p] == 0; p++);
+    if (p != tone) {
+        tone = p;
+        halAlarmTone((hal_tone_t) p);
+    }
+}
 
-};
-#define NUM_ALARMS  sizeof(alarms) / sizeof(alarm_t)
+void Alarm::showHighest()
+{
+    uint8_t p;
+    int8_t idx;
+
+    for (p=0; p<ALARM_PRIO_NUM && active[p] == 0; p++);
+    if (p == ALARM_PRIO_NUM) return; // none: the display was cleared by whoever turned the last one off
+    if (activeAlarmIdx >= 0 && activePrio <= p)
+        return; // the one shown stays until muted, unless a higher priority one comes
+
+    idx = (int8_t) (__builtin_ffs(active[p]) - 1);
+    activeAlarmIdx = idx;
+    activePrio = p;
+    CEvent::post(EVT_ALARM_DISPLAY_ON, (int) idx); // handle: the alarm index
+}
 
-void Alarm::beepOnOff(bool on)
+void Alarm::raise(uint8_t idx)
 {
-    if (on) {
-        if (beepIsOn == false) {
-            beepIsOn = true;
-            halBeepAlarmOnOff(true);
-        }
-    }
-    else {
-        if (beepIsOn == true) {
-            beepIsOn = false;
-            halBeepAlarmOnOff(false);
-        }
-    }
+    alarm_def_t d;
+    uint16_t bit = (uint16_t) 1 << idx;
+
+    loadDef(idx, &d);
+    if ((active[d.prio] & bit) == 0)
+        bboxRecord(BBOX_ALARM_ON, idx);
+    active[d.prio] |= bit;
+    if (d.max_sound == -1 || cnt_sound[idx] < d.max_sound)
+        audible[d.prio] |= bit;
+    showHighest();
+    updateTone();
 }
 
 void Alarm::internalAlarmResetAll()
 {
     LOG("Alarms reset");
-    uint8_t i;
-    alarm_t * a = alarms;
+    bboxRecord(BBOX_ALARM_OFF, BBOX_ALL);
+    memset(active, 0, sizeof(active));
+    memset(audible, 0, sizeof(audible));
+    memset(cnt_sound, 0, sizeof(cnt_sound));
     activeAlarmIdx = -1;
-    for (i=0; i< NUM_ALARMS; i++) {
-        a->cnt_sound = 0;
-        a->state = ST_ALARM_OFF;
-        a++;
-    }
-    beepOnOff(false);
+    updateTone();
     CEvent::post(EVT_ALARM_DISPLAY_OFF,0);
 }
 
-void Alarm::setNextAlarmIfAny(bool fromMute)
-{
-    uint8_t i;
-    alarm_t * a;
-
-    if (activeAlarmIdx >= 0) {
-        // tolerates as there is already an alarm. mute will take care of calling this func once again
-        return;
-    }
-
-    for (i=0; i< NUM_ALARMS; i++) {
-        a = &alarms[i];
-
-        if (a->state == ST_ALARM_ON){
-            activeAlarmIdx = i;
-            if (a->goOffAction) { // call an action if a callback was defined
-                a->goOffAction();
-            }
-            CEvent::post(EVT_ALARM_DISPLAY_ON, (char *) a->message);
-            if (isMuted(a) == false) {
-                if (fromMute)
-                  beepOnOff(true);
-            }
-            return;
-        }
-    }
-}
-
 void Alarm::muteAlarmIfOn()
 {
+    alarm_def_t d;
+    uint8_t idx;
+    uint16_t bit;
+
     LOG("Mute alarm");
     if (activeAlarmIdx < 0)
         return;
 
-    beepOnOff(false);
-
-    alarm_t * a = &alarms[activeAlarmIdx];
-
-    if (a->muteAction) { // call an action if a callback was defined
-        a->muteAction();
-    }
-    a->state = ST_ALARM_OFF;
-    if ((a->max_sound != -1) && (a->cnt_sound < a->max_sound)) {
-        a->cnt_sound++;
-        //LOGV("Max sound set to %d", a->cnt_sound);
+    idx = (uint8_t) activeAlarmIdx;
+    bit = (uint16_t) 1 << idx;
+    loadDef(idx, &d);
+    active[d.prio] &= ~bit;
+    audible[d.prio] &= ~bit;
+    if ((d.max_sound != -1) && (cnt_sound[idx] < d.max_sound)) {
+        cnt_sound[idx]++;
+        //LOGV("Max sound set to %d", cnt_sound[idx]);
     }
 
+    bboxRecord(BBOX_ALARM_OFF, idx);
     activeAlarmIdx = -1;
     CEvent::post(EVT_ALARM_DISPLAY_OFF, 0);
-    setNextAlarmIfAny(true);
+    showHighest();
+    updateTone();
 }
 
 
@@ -255,17 +217,8 @@ void alarmLoop()
 
 }
 
-static void processAlarmEvent(alarm_t * a)
-{
-  a->state = ST_ALARM_ON;
-  if (isMuted(a) == false) {
-      alarm->beepOnOff(true);
-  }
-  alarm->setNextAlarmIfAny(false);
-}
 
-
-Alarm::Alarm ()
+Alarm::Alarm () : CEvent(EVT_MASK(EVT_ALARM) | EVT_MASK(EVT_KEY_PRESS))
 {
 
 }
@@ -277,9 +230,6 @@ void Alarm::Loop()
 
 propagate_t Alarm::onEvent(event_t * event)
 {
-    alarm_t * a;
-    int i;
-
     switch (event->type) {
 
       case EVT_ALARM:
@@ -288,8 +238,7 @@ propagate_t Alarm::onEvent(event_t * event)
             LOG("Alarm with bad parameter");
             return PROPAGATE;
         }
-        a = &alarms[event->param.iParam];
-        processAlarmEvent(a);
+        raise((uint8_t) event->param.iParam);
         break;
 
       case EVT_KEY_PRESS:
@@ -20,12 +20,14 @@
  *
  **************************************************************
 */
+#include "config.h"
 #include "event.h"
 
 
 void alarmInit();
 void alarmLoop();
 void alarmResetAll();
+void alarmGetMessage(uint16_t idx, char * dst);   // text of an alarm handle, dst holds 17 chars
 
 // Note: this enum must follow the exact sequence and reference for the "alarms" array in alarm.cpp
 enum {
@@ -37,11 +39,33 @@ enum {
     ALARM_IDX_BAD_PRESS_SENSOR,
     ALARM_IDX_HIGH_TIDAL_VOLUME,
     ALARM_IDX_LOW_TIDAL_VOLUME,
+    ALARM_IDX_VALVE_CALIB_TO_START,
+    ALARM_IDX_VALVE_CALIB_DONE,
+    ALARM_IDX_VALVE_CALIB_FAIL,
+    ALARM_IDX_MOTOR_EOC,
+    ALARM_IDX_APNEA,
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1)
+    ALARM_IDX_HIGH_LEAK,        // the leak estimate needs the expired flow (leak.h)
+#endif
     // Add here new alarm as well as an entry in "alarms" array in alarm.cpp
 
     ALARM_IDX_END   // must be the very last
 };
 
+// IEC 60601-1-8 priorities, highest first (same order as hal_tone_t)
+typedef enum : uint8_t {
+    ALARM_PRIO_HIGH,
+    ALARM_PRIO_MEDIUM,
+    ALARM_PRIO_LOW,
+
+    ALARM_PRIO_NUM
+} alarm_prio_t;
+
+alarm_prio_t alarmGetPriority(uint16_t idx);
+
+// Raised alarms sit in one bitmap per priority. The display shows the first of the
+// highest priority (find first set) and keeps it until muted, unless a higher
+// priority one comes. The sound is the burst of the highest priority still sounding.
 class Alarm : CEvent {
 
 public:
@@ -51,19 +75,23 @@ public:
     void Loop();
     virtual propagate_t onEvent(event_t * event);
 
-    void setNextAlarmIfAny(bool fromMute);
+    void raise(uint8_t idx);
     void internalAlarmResetAll();
-    void beepOnOff(bool on);
 
 private:
 
     //void beep();
 
     void muteAlarmIfOn();
+    void showHighest();
+    void updateTone();
 
     //--- variables
-    bool beepIsOn = false;
-    int8_t activeAlarmIdx = -1;
+    uint16_t active[ALARM_PRIO_NUM] = {};   // bit per alarm index: raised and not muted
+    uint16_t audible[ALARM_PRIO_NUM] = {};  // the active ones that still sound
+    uint8_t tone = ALARM_PRIO_NUM;          // priority of the burst playing, ALARM_PRIO_NUM if silent
+    int8_t activeAlarmIdx = -1;             // on the display
+    uint8_t activePrio = ALARM_PRIO_NUM;
 
 
 };
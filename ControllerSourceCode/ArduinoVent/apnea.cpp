@@ -0,0 +1,113 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "apnea.h"
+#include "config.h"
+#include "log.h"
+#include "properties.h"
+#include "sched.h"
+
+#define MINUTE_MILLI    60000UL
+
+static bool     running;
+static bool     active;
+static uint32_t interval;       // ms, 0 = monitor off
+static uint32_t backupPeriod;   // ms
+static uint8_t  backupBpm;
+static bool     patientOnly;    // a trigger is enabled: only patient breaths count
+static uint32_t tmLast;         // last breath that restarts the interval
+static uint32_t tmBreath;       // last breath start of any kind
+static uint16_t count;
+
+// settings are taken here, at the breath start, never from the loop
+static void loadSettings()
+{
+  interval = (uint32_t) propGetApneaTime() * 1000UL;
+  backupBpm = (uint8_t) propGetBackupBpm();
+  if (backupBpm == 0) backupBpm = 1;
+  backupPeriod = MINUTE_MILLI / backupBpm;
+  patientOnly = propGetTrigPressure() != 0 || propGetTrigFlow() != 0;
+}
+
+void apneaStart()
+{
+  loadSettings();
+  tmLast = schedNow();
+  tmBreath = tmLast;
+  active = false;
+  running = true;
+}
+
+void apneaBreath(bool patient)
+{
+  uint32_t now = schedNow();
+
+  if (!running) apneaStart();
+  loadSettings();
+  tmBreath = now;
+  if (patient || !patientOnly) {
+    tmLast = now;
+    if (active) {
+      active = false;
+      LOG("Apnea: breathing again, backup off");
+    }
+  }
+}
+
+bool apneaLoop()
+{
+  if (!running || active || interval == 0) return false;
+  if (schedNow() - tmLast < interval) return false;
+
+  active = true;
+  if (count < 0xffff) count++;
+  LOGV("Apnea: %lus, backup %d BPM", (unsigned long) (interval / 1000), backupBpm);
+  return true;
+}
+
+bool apneaBackupDue()
+{
+  return active && schedNow() - tmBreath >= backupPeriod;
+}
+
+void apneaStop()
+{
+  running = false;
+  active = false;
+}
+
+bool apneaIsActive()
+{
+  return active;
+}
+
+int apneaGetBpm(int setBpm)
+{
+  if (active && backupBpm > setBpm) return backupBpm;
+  return setBpm;
+}
+
+uint16_t apneaGetCount()
+{
+  return count;
+}
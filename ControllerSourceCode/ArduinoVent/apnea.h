@@ -0,0 +1,56 @@
+#ifndef APNEA_H
+#define APNEA_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file apnea.h
+ * @brief Apnea monitor and backup rate.
+ *
+ * The breather stamps every breath start here (apneaBreath()), patient
+ * triggered or machine timed, so the monitor itself is one subtraction per
+ * loop pass: settings are read at the breath start, not polled.
+ *
+ * With a trigger enabled the patient is expected to breathe: only patient
+ * triggered breaths restart the apnea interval, the timed breaths at the set
+ * rate do not. With no trigger every breath restarts it and the monitor only
+ * guards against breaths not being started at all.
+ *
+ * When the interval passes without such a breath, apneaLoop() reports it once
+ * and the backup rate is in force (apneaGetBpm()) until a breath that counts
+ * starts: with a trigger, the patient's own. The breather ends the running pause as soon as a backup period
+ * has elapsed since the last breath start, so the backup breaths begin within
+ * one breath period.
+ */
+
+#include <stdint.h>
+
+void     apneaStart();                  // ventilation begins: the interval counts from here
+void     apneaBreath(bool patient);     // every breath start, patient = triggered by an effort
+bool     apneaLoop();                   // every breather pass while ventilating: true once when apnea is declared
+bool     apneaBackupDue();              // backup rate in force and a backup period since the last breath start
+void     apneaStop();                   // ventilation stopped
+
+bool     apneaIsActive();               // backup rate in force
+int      apneaGetBpm(int setBpm);       // rate the next breath is timed on
+uint16_t apneaGetCount();               // apneas declared since boot
+
+#endif // APNEA_H
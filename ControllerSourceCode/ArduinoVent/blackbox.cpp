@@ -0,0 +1,180 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "blackbox.h"
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "log.h"
+#include "sched.h"
+
+#ifndef VENTSIM
+  #include <util/atomic.h>
+  #define BBOX_ATOMIC     ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  #define BBOX_NOINIT     __attribute__ ((section (".noinit")))  // kept across a watchdog reset
+  #define BBOX_WDT_RESET  (1 << WDRF)
+  #define BBOX_NOW()      millis()        // reads the counter with interrupts masked: safe in an ISR
+  #define BBOX_TXT(s)     PSTR(s)         // dump formats stay in flash
+  #define BBOX_SPRINTF    sprintf_P
+#else
+  #define BBOX_ATOMIC
+  #define BBOX_NOINIT
+  #define BBOX_WDT_RESET  0x08    // WDRF
+  #define BBOX_NOW()      schedNow()      // no interrupts on the host
+  #define BBOX_TXT(s)     s
+  #define BBOX_SPRINTF    sprintf
+#endif
+
+#define BBOX_MAGIC      0xB0C5
+#define BBOX_MASK       (BLACKBOX_SIZE - 1)
+
+#if (BLACKBOX_SIZE & BBOX_MASK) || (BLACKBOX_SIZE > 128)
+  #error "BLACKBOX_SIZE must be a power of 2 up to 128"
+#endif
+
+// also the layout of the snapshot: the header, then the entries by slot
+typedef struct bbox_hdr_st {
+    uint16_t     magic;     // BBOX_MAGIC once bboxInit() ran: tells a ring that survived from garbage
+    uint8_t      head;      // next slot
+    uint8_t      wrapped;   // 1 once every slot holds an entry
+    uint16_t     hi;        // bits 16..31 of the last time recorded
+    uint8_t      lastValves;
+} bbox_hdr_t;
+
+static bbox_hdr_t   hdr BBOX_NOINIT;
+static bbox_entry_t entries[BLACKBOX_SIZE] BBOX_NOINIT;
+
+static bool isValid(const bbox_hdr_t * h)
+{
+    return h->magic == BBOX_MAGIC && h->head <= BBOX_MASK && h->wrapped <= 1;
+}
+
+// interrupts masked by the caller
+static void put(uint16_t tm, uint8_t type, uint8_t arg)
+{
+    bbox_entry_t * e = &entries[hdr.head & BBOX_MASK]; // in bounds even before bboxInit()
+    e->tm = tm;
+    e->type = type;
+    e->arg = arg;
+    hdr.head = (hdr.head + 1) & BBOX_MASK;
+    if (hdr.head == 0) hdr.wrapped = 1;
+}
+
+static void saveSnapshot()
+{
+    bbox_hdr_t h = hdr;
+    // a save cut short by a reset must not look valid: the header goes last
+    h.magic = 0;
+    halSaveBlackBox(0, (const uint8_t *) &h, sizeof(h));
+    halSaveBlackBox(sizeof(h), (const uint8_t *) entries, sizeof(entries));
+    halSaveBlackBox(0, (const uint8_t *) &hdr, sizeof(hdr));
+}
+
+void bboxInit(uint8_t resetFlags)
+{
+    if ((resetFlags & BBOX_WDT_RESET) && isValid(&hdr)) {
+        saveSnapshot();
+        LOG("black box: watchdog snapshot saved");
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = BBOX_MAGIC;
+    hdr.lastValves = 0xff;
+    bboxRecord(BBOX_BOOT, resetFlags);
+}
+
+void bboxRecord(uint8_t type, uint8_t arg)
+{
+    uint32_t now = BBOX_NOW(); // callers include ISRs: not the scheduler time, a main loop variable
+    BBOX_ATOMIC {
+        // the slot 0 one makes sure that any dump holds the high part of the time
+        if ((uint16_t) (now >> 16) != hdr.hi || hdr.head == 0) {
+            hdr.hi = (uint16_t) (now >> 16);
+            put(hdr.hi, BBOX_TIME, 0);
+        }
+        put((uint16_t) now, type, arg);
+    }
+}
+
+void bboxValves(uint8_t state)
+{
+    if (state == hdr.lastValves) return;
+    hdr.lastValves = state;
+    bboxRecord(BBOX_VALVES, state);
+}
+
+uint8_t bboxRead(bbox_entry_t * dst, uint8_t max)
+{
+    uint8_t i, n;
+    BBOX_ATOMIC {
+        n = hdr.wrapped ? BLACKBOX_SIZE : hdr.head;
+        if (n > max) n = max;
+        for (i=0; i<n; i++) {
+            // oldest first: from the head when the ring is full
+            dst[i] = entries[hdr.wrapped ? (hdr.head + i) & BBOX_MASK : i];
+        }
+    }
+    return n;
+}
+
+// entry by entry, no copy of the ring: entries recorded while the (slow) debug port
+// prints may replace the oldest ones of a live dump
+void bboxDump(bool snapshot)
+{
+    bbox_hdr_t h;
+    bbox_entry_t e;
+    char line[32];
+    uint8_t i, n, slot;
+
+    if (snapshot) {
+        if (!halRestoreBlackBox(0, (uint8_t *) &h, sizeof(h)) || !isValid(&h)) {
+            BBOX_SPRINTF(line, BBOX_TXT("BBOX wdt 0 0\nBBOX end\n"));
+            halWriteSerial(line);
+            return;
+        }
+    }
+    else {
+        BBOX_ATOMIC {
+            h = hdr;
+        }
+    }
+
+    n = h.wrapped ? BLACKBOX_SIZE : h.head;
+    if (snapshot) BBOX_SPRINTF(line, BBOX_TXT("BBOX wdt %u 0\n"), n);
+    else          BBOX_SPRINTF(line, BBOX_TXT("BBOX ram %u %lx\n"), n, (unsigned long) schedNow());
+    halWriteSerial(line);
+    for (i=0; i<n; i++) {
+        slot = h.wrapped ? (h.head + i) & BBOX_MASK : i;
+        if (snapshot) {
+            halRestoreBlackBox(sizeof(h) + slot * sizeof(e), (uint8_t *) &e, sizeof(e));
+        }
+        else {
+            BBOX_ATOMIC {
+                e = entries[slot];
+            }
+        }
+        BBOX_SPRINTF(line, BBOX_TXT("BB %04x %02x %02x\n"), e.tm, e.type, e.arg);
+        halWriteSerial(line);
+    }
+    BBOX_SPRINTF(line, BBOX_TXT("BBOX end\n"));
+    halWriteSerial(line);
+}
@@ -0,0 +1,79 @@
+#ifndef BLACKBOX_H
+#define BLACKBOX_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file blackbox.h
+ * @brief Black box: timestamped binary record of what the controller did.
+ *
+ * A fixed RAM ring keeps the last BLACKBOX_SIZE entries of 4 bytes: every
+ * posted event, every breather state change, every valve change and the
+ * alarms going on and off, each with the scheduler time in milliseconds.
+ * Recording is a few stores with interrupts masked, so it is cheap enough
+ * for the valve commands and the ISRs.
+ *
+ * On the AVR the ring is not initialized by the C runtime (.noinit), so it
+ * survives a watchdog reset: bboxInit() finds it at boot and copies it to its
+ * own EEPROM area before starting a new one. That snapshot stays there until
+ * the next watchdog reset, a firmware upload does not erase it.
+ *
+ * bboxDump() writes a ring, live or the snapshot, as text on the debug port
+ * (with SERIAL_COMMANDS send 'b' or 'w'), so it can be captured along with
+ * the logs. VentHost -D turns a capture into a timeline:
+ *
+ *   BBOX <ram|wdt> <entries> <time of the dump, hex ms>
+ *   BB <tm> <type> <arg>        one per entry, oldest first, hex
+ *   BBOX end
+ *
+ * Only the low 16 bits of the time are kept per entry. A BBOX_TIME entry
+ * carries the high 16 bits: one is recorded whenever they change and at
+ * every wrap of the ring, so any dump holds at least one.
+ */
+
+#include "config.h"
+#include <stdint.h>
+
+//---- bbox_entry_t.type
+#define BBOX_TIME           0x00    // tm: bits 16..31 of the time of the entries that follow
+#define BBOX_BOOT           0x01    // arg: MCU reset flags
+#define BBOX_STATE          0x02    // arg: B_STATE_t entered
+#define BBOX_VALVES         0x03    // arg: halGetValveState() after the command
+#define BBOX_ALARM_ON       0x04    // arg: alarm index
+#define BBOX_ALARM_OFF      0x05    // arg: alarm index muted, BBOX_ALL for a reset of all
+#define BBOX_EVENT          0x10    // + EVENT_TYPE, posted from the main loop. arg: low byte of the payload
+#define BBOX_EVENT_ISR      0x20    // + EVENT_TYPE, posted from an interrupt handler
+
+#define BBOX_ALL            0xff
+
+typedef struct __attribute__ ((packed)) bbox_entry_st {
+    uint16_t tm;                // milliseconds, low 16 bits (BBOX_TIME: high 16 bits)
+    uint8_t  type;              // BBOX_xxx
+    uint8_t  arg;
+} bbox_entry_t;
+
+void    bboxInit(uint8_t resetFlags);       // halInit(), once the watchdog is held off
+void    bboxRecord(uint8_t type, uint8_t arg); // main loop and interrupt handlers
+void    bboxValves(uint8_t state);          // records the valve state if it changed
+void    bboxDump(bool snapshot);            // text on the debug port: the live ring or the watchdog snapshot
+uint8_t bboxRead(bbox_entry_t * dst, uint8_t max); // live ring, oldest first: number of entries copied
+
+#endif // BLACKBOX_H
@@ -35,14 +35,33 @@
 
 #define TM_LOG 2000
 #define TM_INIT_RETRY 200
-#define TM_READ_MIN_PERIOD  50 // max rate to query BMP is 50ms (read takes about 2 ms)... 
-                               // we will create a state machine to read in multiple calls and no blocks whatsoever.
+#define TM_CONVERSION       5   // ms, OSR x1 pressure + temperature takes 5.5 ms typ. 6.4 ms max. Poll after that
+#define TM_CONVERSION_MAX   50  // ms, give up on a conversion and trigger a new one
+
+//---- read state machine, one short I2C transaction per call:
+//     IDLE -> (trigger) -> CONVERTING -> (status says done) -> READ -> IDLE
+#define ST_INIT_NOT_FOUND   4
+#define ST_IDLE             10
+#define ST_CONVERTING       11
+#define ST_READ             12
 
 
 #ifdef SHOW_PREESURE_LOGS
   static uint64_t logTimer;
 #endif
 
+#ifdef BMP280_NORMAL_MODE
+static BMx280I2C::Settings settings(
+   BME280::OSR_X1,
+   BME280::OSR_X1,
+   BME280::OSR_X2,
+   BME280::Mode_Normal,
+   BME280::StandbyTime_500us,
+   BMP280_IIR_FILTER,
+   BME280::SpiEnable_False,
+   I2C_ADDRESS
+);
+#else
 static BMx280I2C::Settings settings(
    BME280::OSR_X1,
    BME280::OSR_X1,
@@ -53,13 +72,18 @@ static BMx280I2C::Settings settings(
    BME280::SpiEnable_False,
    I2C_ADDRESS // I2C address. I2C specific -- this is for the Adafruit with other lines not connected
 );
+#endif
 
 static uint64_t tm;
+static uint64_t tm_sample;
 static uint8_t state; // 0~3 starting... 4 is error... >=10 is OK
+static bool needReference;
 
 static float fPressurePa;
 static float fReferencePa;
 static float gaugeCmH2O;
+static uint16_t sampleSeq;
+static uint32_t sampleTime;
 
 #ifdef SHOW_PREESURE_LOGS
     char buf[24];
@@ -68,40 +92,88 @@ static float gaugeCmH2O;
 static BMx280I2C ssenseBMx280(settings);
 
 static void checkInit() {
-  if (state >= 4) return; // error or OK
+  if (state >= ST_INIT_NOT_FOUND) return; // error or OK
   
   if ( halCheckTimerExpired(tm, TM_INIT_RETRY) ) {
     if (ssenseBMx280.begin()) {
       LOGV("Model 0x%x", ssenseBMx280.chipModel() );
 
-      // prerform a first read for reference
-      ssenseBMx280.readPressure(fPressurePa); // TODO: protect this method in the library
-      bmp280SetReference();
-      
-      tm = halStartTimerRef();
-      state = 10; // init is completed
+      // the first sample read by the state machine becomes the reference
+      needReference = true;
+      tm_sample = halStartTimerRef();
+      state = ST_IDLE; // init is completed
       return;
     }
     state++;
-    if (state == 4) {
+    if (state == ST_INIT_NOT_FOUND) {
       CEvent::post(EVT_ALARM, ALARM_IDX_BAD_PRESS_SENSOR);
     }
     tm = halStartTimerRef();
   }
 }
 
-float bpm280GetPressure() {
-  
-  checkInit();
-  if (state < 4) return BMP_ST__INITIALIZING; // error or OK 
-  if (state == 4) return BMP_ST__NOT_FOUND; // error or OK
+static void newSample()
+{
+  if (needReference) {
+    needReference = false;
+    bmp280SetReference();
+  }
+  gaugeCmH2O = (fPressurePa - fReferencePa) * 0.0101972;
+  sampleTime = (uint32_t) halStartTimerRef();
+  sampleSeq++;
+}
 
-  if ( halCheckTimerExpired(tm, TM_READ_MIN_PERIOD) ) {
-    tm = halStartTimerRef();
-    ssenseBMx280.readPressure(fPressurePa);
-    gaugeCmH2O = (fPressurePa - fReferencePa) * 0.0101972;
+void bmp280Loop()
+{
+  bool measuring;
+
+  checkInit();
 
+  switch (state) {
+    case ST_IDLE:
+      if ( ! halCheckTimerExpired(tm_sample, BMP280_READ_PERIOD - 1) ) break;
+      tm_sample = halStartTimerRef();
+#ifdef BMP280_NORMAL_MODE
+      // free running: the result registers always hold the latest filtered conversion
+      if (ssenseBMx280.readPressureData(fPressurePa)) {
+        newSample();
+      }
+#else
+      if (ssenseBMx280.startMeasurement()) {
+        tm = tm_sample;
+        state = ST_CONVERTING;
+      }
+#endif
+      break;
+
+    case ST_CONVERTING:
+      if ( ! halCheckTimerExpired(tm, TM_CONVERSION) ) break;
+      if (halCheckTimerExpired(tm, TM_CONVERSION_MAX)) {
+        LOG("BMP280 conversion timeout");
+        state = ST_IDLE;
+        break;
+      }
+      if (ssenseBMx280.isMeasuring(measuring) == false || measuring) break;
+      // done: the burst read goes in the next call to keep each call short
+      state = ST_READ;
+      break;
+
+    case ST_READ:
+      if (ssenseBMx280.readPressureData(fPressurePa)) {
+        newSample();
+      }
+      state = ST_IDLE;
+      break;
+
+    default:
+      break;
   }
+}
+
+float bpm280GetPressure() {
+  
+  if (state < ST_INIT_NOT_FOUND) return BMP_ST__INITIALIZING; // error or OK
+  if (state == ST_INIT_NOT_FOUND) return BMP_ST__NOT_FOUND; // error or OK
 
 #ifdef SHOW_PREESURE_LOGS
   if (halCheckTimerExpired(logTimer, TM_LOG)) {
@@ -138,9 +210,20 @@ float getCmH2OGauge()
   return gaugeCmH2O;
 }
 
+uint16_t bmp280GetSampleSeq()
+{
+  return sampleSeq;
+}
+
+uint32_t bmp280GetSampleTime()
+{
+  return sampleTime;
+}
+
 void bpm280Init()
 {
   Wire.begin();
+  Wire.setClock(BMP280_I2C_CLOCK); // Wire.begin() puts the bus back to 100 KHz
 
   tm = halStartTimerRef(); 
   checkInit();
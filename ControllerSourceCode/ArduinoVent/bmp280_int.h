@@ -53,10 +53,22 @@
  */
 void  bpm280Init();
                                                    
+/**
+ * @brief Run the read state machine. Must be called on every main loop pass.
+ *
+ * Each call does at most one short I2C transaction: trigger a conversion, poll the status
+ * register or burst read the pressure and temperature registers. It never waits for the sensor.
+ * A new sample is produced every BMP280_READ_PERIOD milliseconds (config.h).
+ *
+ * @param None
+ * @return None
+ */
+void  bmp280Loop();
+
 /**
  * @brief return the absolute pressure in Pa.
  *
- * regardless how fast this function is called its return value only changes every 50milliseconds.
+ * No bus access, it returns the last sample read by bmp280Loop().
  *
  * @param None
  * @return The absolute pressure value in Pa (Pascals)
@@ -86,4 +98,23 @@ void  bmp280SetReference();
 
 float getCmH2OGauge();
 
+/**
+ * @brief Sequence number of the sample returned by getCmH2OGauge().
+ *
+ * Increments once per completed conversion, so a caller polling it sees every
+ * sample exactly once (pressure.h fast path).
+ *
+ * @param None
+ * @return The conversion counter (wraps)
+ */
+uint16_t bmp280GetSampleSeq();
+
+/**
+ * @brief Time the current sample was read, in milliseconds (halStartTimerRef() time base).
+ *
+ * @param None
+ * @return The sample time stamp
+ */
+uint32_t bmp280GetSampleTime();
+
 #endif // BMP280_INT_H
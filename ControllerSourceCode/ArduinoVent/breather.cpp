@@ -31,6 +31,15 @@
 #include "event.h"
 #include "alarm.h"
 #include "serialWriter.h"
+#include "peep.h"
+#include "pcv.h"
+#include "trigger.h"
+#include "hplimit.h"
+#include "valvecal.h"
+#include "metrics.h"
+#include "apnea.h"
+#include "leak.h"
+#include "blackbox.h"
 
 #define MINUTE_MILLI 60000
 #define TM_WAIT_TO_OUT 200 //200 milliseconds
@@ -40,9 +49,11 @@
 #define TM_DATA_LOG_DELAY 500 // 500 milliseconds
 
 static int curr_pause;
+static int curr_mode;
 static int curr_rate;
 static int curr_in_milli;
 static int curr_out_milli;
+static int curr_wait_milli;
 static int curr_total_cycle_milli;
 static int curr_progress;
 static uint64_t tm_start;
@@ -53,13 +64,20 @@ static int16_t highTidalVolume;
 static int16_t lowTidalVolume;
 static int16_t tidalVolume;
 static int8_t desiredPeep;
-static float peakInspiratoryPressure;
+static int16_t volumeTarget;
+static int16_t volumeOvershoot;
+static int8_t trigPressure;
+static int8_t trigFlow;
 
 static bool fast_calib;
+static bool valve_calib;
+static bool patient_cycle; // the breath being started was triggered by an effort
+static int16_t latInClose;
 
 static const int rate[4] = {1,2,3,4} ;
 
 static B_STATE_t b_state = B_ST_STOPPED;
+static B_STATE_t bbox_state = B_ST_STOPPED; // last one recorded in the black box
 
 void breatherRequestFastCalibration()
 {
@@ -72,6 +90,15 @@ void breatherRequestFastCalibration()
 
 }
 
+void breatherRequestValveCalibration()
+{
+    if (propGetVent() || b_state != B_ST_STOPPED) {
+        LOG("Ignore Valve Calib.");
+        return;
+    }
+    valve_calib = true;
+}
+
 int breatherGetPropress()
 {
     return curr_progress;
@@ -79,26 +106,61 @@ int breatherGetPropress()
 
 void breatherStartCycle()
 {
-    curr_total_cycle_milli = MINUTE_MILLI / propGetBpm();
+    apneaBreath(patient_cycle);
+    patient_cycle = false;
+    if (apneaIsActive())
+        CEvent::post(EVT_ALARM, ALARM_IDX_APNEA); // every backup breath, a mute does not hide the apnea
+    curr_total_cycle_milli = MINUTE_MILLI / apneaGetBpm(propGetBpm());
     curr_pause = propGetPause();
     curr_rate = propGetDutyCycle();
+    curr_mode = propGetMode();
     int in_out_t = curr_total_cycle_milli - (curr_rate + TM_WAIT_TO_OUT);
     curr_in_milli = (in_out_t/2) / rate[curr_rate];
     curr_out_milli = in_out_t - curr_in_milli;
+    // valve commands lead the valves by their calibrated latencies, so the
+    // phases are timed on the airway: inlet flow lasts curr_in_milli, the
+    // hold between inlet closed and exhale open lasts TM_WAIT_TO_OUT
+    int latInOpen = propGetInOpenLatency();
+    int latOutOpen = propGetOutOpenLatency();
+    latInClose = propGetInCloseLatency();
+    curr_in_milli += latInOpen - latInClose;
+    curr_wait_milli = TM_WAIT_TO_OUT + latInClose - latOutOpen;
+    if (curr_wait_milli < 0) curr_wait_milli = 0;
+    curr_out_milli += latOutOpen - latInOpen;
+    // the inspiratory hold lengthens the plateau (metrics.h) at the expense of the expiration
+    int hold = propGetInspHold();
+    curr_wait_milli += hold;
+    curr_out_milli -= hold;
+    if (curr_out_milli < 0) curr_out_milli = 0;
+    if (curr_in_milli <= 0) curr_in_milli = 1;
     curr_progress = 0;
     tm_start = halStartTimerRef();
     tm_serialLog = halStartTimerRef();
     b_state = B_ST_IN;
+    triggerDisarm();
+    peepEndBreath();
+    metStartBreath(peepGetEep());
+    leakStartBreath(); // before pressVolumeStart(): takes the expired volume
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1)
+    if (leakGetPercent() > LEAK_ALARM_PERCENT)
+        CEvent::post(EVT_ALARM, ALARM_IDX_HIGH_LEAK);
+#endif
     halValveOutClose();
-    halValveInOpen();
+    if (curr_mode == PROP_MODE_PC)
+        pcvStart(propGetInspPressure(), propGetRiseTime()); // inlet valve under pressure control
+    else
+        halValveInOpen();
     fast_calib = false;
-    startTidalVolumeCalculation();
+    pressVolumeStart();
+    volumeTarget = propGetVolumeTarget();
+    trigPressure = propGetTrigPressure();
+    trigFlow = propGetTrigFlow();
     highPressure = propGetHighPressure();
     lowPressure = propGetLowPressure();
     highTidalVolume = propGetHighTidal();
     lowTidalVolume = propGetLowTidal();
     desiredPeep = propGetDesiredPeep();
-    peakInspiratoryPressure = 0;
+    hplStart(highPressure);
 
 #if 0
   LOG("Ventilation ON:");
@@ -110,38 +172,24 @@ void breatherStartCycle()
 
 }
 
-static void UpdateValveBasedOnPeep()
-{
-    float currentPressure = pressGetVal(PRESSURE);
-    int currentPercentageAbovePeep = ((currentPressure - (float)desiredPeep)/desiredPeep) * 100;
-    //Serial.println(currentPercentageAbovePeep);
-
-    //This is because of not haveing a solidnoid fast and reliable enough
-    //TODO: Try out with a proper exhale valve that is reliable with a manual PEEP valve calibrated to min PEEP.
-    if (currentPercentageAbovePeep > 40)
-    { 
-        halValveOutOpen(); // drop the pressure
-    }else if(currentPercentageAbovePeep < 30)
-    { 
-        halValveOutClose(); //don't drop thepressure
-    }       
-}
-
 static void CheckAndRespondToHighPressure(float currentPressure)
 {
-    if (currentPressure > peakInspiratoryPressure) {
-      peakInspiratoryPressure = currentPressure;
-    }
-
-    if (peakInspiratoryPressure > highPressure) {
+    // trips ahead of the limit when the pressure slope says it will be crossed
+    if (hplLoop(currentPressure)) {
         CEvent::post(EVT_ALARM, ALARM_IDX_HIGH_PRESSURE);
         halValveOutOpen(); // drop the pressure
+        pcvStop();
         halValveInClose();
     } else {
         halValveOutClose();
     }     
 }
 
+int breatherGetVolumeOvershoot()
+{
+    return volumeOvershoot;
+}
+
 B_STATE_t breatherGetState()
 {
     return b_state;
@@ -149,7 +197,16 @@ B_STATE_t breatherGetState()
 
 static void fsmStopped()
 {
+  if (valve_calib && propGetVent() == 0) {
+      // needs a test lung on the patient port, never runs on a patient
+      valve_calib = false;
+      b_state = B_ST_VALVE_CALIB;
+      CEvent::post(EVT_ALARM, ALARM_IDX_VALVE_CALIB_TO_START);
+      valveCalStart();
+      return;
+  }
   if (propGetVent() ) {
+      valve_calib = false; // a request does not outlive the ventilation starting
       //breatherStartCycle();
       // lets do a fast calibration 
       fast_calib = false;
@@ -164,15 +221,23 @@ static void fsmIn()
     float pressure = getCmH2OGauge();
 
     uint64_t m = halStartTimerRef();
-    if (tm_start + curr_in_milli < m) {
+    uint64_t tm_end = tm_start + curr_in_milli;
+    // what flows while the inlet valve closes counts too
+    bool volumeReached = curr_mode == PROP_MODE_VC &&
+        pressGetVolume() + pressGetVal(FLOW) * latInClose / 60.0f >= volumeTarget;
+    if (tm_end < m || volumeReached) {
+        // volume reached early: the expiration gets what is left so the rate holds
+        if (tm_end >= m) curr_out_milli += (int) (tm_end - m);
         // in valve off
+        pcvStop();
         halValveInClose();
         tm_start = halStartTimerRef();
         b_state = B_ST_WAIT_TO_OUT;
-        endTidalVolumeCalculation();
-        tidalVolume = pressGetTidalVolume();
+        metEndInspiration(curr_wait_milli);
+        leakEndInspiration();
     }
     else {
+        pcvLoop();
         curr_progress = ((m - tm_start) * 100)/ curr_in_milli;
         //curr_progress = 100 - (100 * tm_start + curr_in_milli) / m;
 
@@ -192,22 +257,63 @@ static void fsmIn()
 
 static void fsmWaitToOut()
 {
-    if (halCheckTimerExpired(tm_start, TM_WAIT_TO_OUT)) {
+    if (halCheckTimerExpired(tm_start, curr_wait_milli)) {
         // switch valves
         tm_start = halStartTimerRef();
         b_state = B_ST_OUT;
+        leakStartExpiration(); // the flow now counts as expired, pressGetVolume() holds the inspired
+        tidalVolume = (int16_t) leakGetTidalVolume();
+        metStartExpiration(hplGetTrip() == HPL_NONE); // a trip opened the exhale valve: no plateau
+        hplEndBreath();
+        if (curr_mode == PROP_MODE_VC) {
+            // what flowed after the inlet valve was told to close is in too
+            volumeOvershoot = (int16_t) (pressGetVolume() - volumeTarget);
+        }
+        peepStart(desiredPeep); // exhale valve under PEEP control until the next inspiration
+        triggerArm(desiredPeep, trigPressure, trigFlow); // through the pause: the set rate is the backup
         //LOG("Wait to out");
     }
 }
 
+static void checkTidalVolume()
+{
+    //------ check for high tidal volume between 3-25 cmH2O
+    if (tidalVolume < lowTidalVolume) {
+        CEvent::post(EVT_ALARM, ALARM_IDX_LOW_TIDAL_VOLUME);
+    }
+
+    if (tidalVolume > highTidalVolume) {
+        CEvent::post(EVT_ALARM, ALARM_IDX_HIGH_TIDAL_VOLUME);
+    }
+}
+
+// an effort seen during expiration or pause starts the next breath now
+static void startAssistedCycle()
+{
+    peepStop(); // no EEP feedback: the effort pulled the reading below what the valve held
+    patient_cycle = true;
+    breatherStartCycle();
+    triggerValveOpened();
+}
+
 static void fsmOut()
 {
     uint64_t m = halStartTimerRef();
+    if (fast_calib == false && triggerLoop()) {
+        checkTidalVolume(); // still due for the breath just ended
+        startAssistedCycle();
+        return;
+    }
     if (tm_start + curr_out_milli < m) {
 
         //if we have fast calibration request then we keep the valve open
         if (fast_calib) {
             fast_calib = false;
+            triggerDisarm();
+            peepStop();
+            metStop();
+            leakStop();
+            halValveOutOpen();
             tm_start = halStartTimerRef();
             b_state = B_ST_FAST_CALIB;
             return;
@@ -216,21 +322,11 @@ static void fsmOut()
         // switch valves
         tm_start = halStartTimerRef();
         b_state = B_ST_PAUSE;
-
-        //------ check for high tidal volume between 3-25 cmH2O
-        if (tidalVolume < lowTidalVolume) {
-            CEvent::post(EVT_ALARM, ALARM_IDX_LOW_TIDAL_VOLUME);
-        }
-
-        if (tidalVolume > highTidalVolume) {
-            CEvent::post(EVT_ALARM, ALARM_IDX_HIGH_TIDAL_VOLUME);
-        }
+        checkTidalVolume();
     }
     else {
         curr_progress = 100 - ((m - tm_start) * 100)/ curr_out_milli;
         if (curr_progress >  100) curr_progress = 100;
-        
-        UpdateValveBasedOnPeep();
     }
 }
 
@@ -262,6 +358,21 @@ static void fsmInitialFastCalib()
 }
 
 
+static void fsmValveCalib()
+{
+    if (propGetVent()) {
+        valveCalAbort(); // ventilation wins
+        b_state = B_ST_STOPPED;
+        return;
+    }
+    if (valveCalLoop()) return;
+    b_state = B_ST_STOPPED; // valves as in stopped: inlet closed, exhale open
+    if (valveCalGetStatus() == VCAL_DONE)
+        CEvent::post(EVT_ALARM, ALARM_IDX_VALVE_CALIB_DONE);
+    else
+        CEvent::post(EVT_ALARM, ALARM_IDX_VALVE_CALIB_FAIL);
+}
+
 static void fsmStopping()
 {
     if (halCheckTimerExpired(tm_start, TM_STOPPING)) {
@@ -275,9 +386,11 @@ static void fsmStopping()
 
 static void fsmPause()
 {
-    UpdateValveBasedOnPeep();
-
-    if (halCheckTimerExpired(tm_start, curr_pause)) {
+    if (triggerLoop()) {
+        startAssistedCycle();
+        return;
+    }
+    if (halCheckTimerExpired(tm_start, curr_pause) || apneaBackupDue()) {
         breatherStartCycle();
     }
 }
@@ -290,15 +403,26 @@ void breatherLoop()
         tm_serialLog = halStartTimerRef();
     }
 
-    if (b_state != B_ST_STOPPED && b_state != B_ST_STOPPING && propGetVent() == 0) {
+    if (b_state != B_ST_STOPPED && b_state != B_ST_STOPPING && b_state != B_ST_VALVE_CALIB && propGetVent() == 0) {
         // force stop
         tm_start = halStartTimerRef();
         b_state = B_ST_STOPPING;
         curr_progress = 0;
+        pcvStop();
         halValveInClose();
-        UpdateValveBasedOnPeep();
+        triggerDisarm();
+        peepStop();
+        metStop();
+        leakStop();
+        apneaStop();
+        halValveOutOpen(); // drop the pressure
     }
 
+    metLoop();
+    leakLoop();
+    if (apneaLoop()) // runs from the first breath to the stop
+        CEvent::post(EVT_ALARM, ALARM_IDX_APNEA);
+
     if (b_state == B_ST_STOPPED)
         fsmStopped();
     else if (b_state == B_ST_IN)
@@ -315,9 +439,16 @@ void breatherLoop()
         fsmPause();
     else if (b_state == B_ST_STOPPING)
         fsmStopping();
+    else if (b_state == B_ST_VALVE_CALIB)
+        fsmValveCalib();
     else {
         LOG("breatherLoop: unexpected state");
     }
+
+    if (b_state != bbox_state) {
+        bbox_state = b_state;
+        bboxRecord(BBOX_STATE, (uint8_t) b_state);
+    }
 }
 //---------------------------------------------------------
 #endif //#ifndef STEPPER_MOTOR_STEP_PIN
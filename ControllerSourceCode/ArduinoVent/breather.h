@@ -29,6 +29,7 @@ typedef enum {
     B_ST_FAST_CALIB,
     B_ST_PAUSE,
     B_ST_STOPPING,
+    B_ST_VALVE_CALIB,   // ventilation off, valve latency calibration (valvecal.h)
 } B_STATE_t;
 
 void breatherLoop();
@@ -36,6 +37,8 @@ void breatherStartCycle();
 B_STATE_t breatherGetState();
 int breatherGetPropress();
 void breatherRequestFastCalibration();
+void breatherRequestValveCalibration(); // only with ventilation off and a test lung on the patient port
+int breatherGetVolumeOvershoot(); // mL, delivered - target of the last volume control breath
 
 
 #endif // BREATHER_H
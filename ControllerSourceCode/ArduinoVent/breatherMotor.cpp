@@ -30,6 +30,9 @@
 #include "event.h"
 #include "alarm.h"
 #include "motor.h"
+#include "metrics.h"
+#include "leak.h"
+#include "blackbox.h"
 
 #define MINUTE_MILLI 60000
 #define TM_WAIT_TO_OUT 200 //200 milliseconds
@@ -47,12 +50,14 @@ static int curr_progress;
 static uint64_t tm_start;
 static int16_t highPressure;
 static int16_t lowPressure;
+static int16_t volumeTarget;
 
 static bool fast_calib;
 
 static const int rate[4] = {1,2,3,4} ;
 
 static B_STATE_t b_state = B_ST_STOPPED;
+static B_STATE_t bbox_state = B_ST_STOPPED; // last one recorded in the black box
 
 void breatherRequestFastCalibration()
 {
@@ -70,6 +75,16 @@ int breatherGetPropress()
     return curr_progress;
 }
 
+int breatherGetVolumeOvershoot()
+{
+    return 0; // the squeezer has no volume control mode
+}
+
+void breatherRequestValveCalibration()
+{
+    LOG("Ignore Valve Calib."); // the squeezer has no valves to calibrate
+}
+
 void breatherStartCycle()
 {
     curr_total_cycle_milli = MINUTE_MILLI / propGetBpm();
@@ -81,11 +96,15 @@ void breatherStartCycle()
     curr_progress = 0;
     tm_start = halStartTimerRef();
     b_state = B_ST_IN;
+    metStartBreath(pressGetVal(PRESSURE)); // end of the pause, exhale valve still closed
+    leakStartBreath();
     halValveOutClose();
     halValveInOpen();
     fast_calib = false;
     highPressure = propGetHighPressure();
     lowPressure = propGetLowPressure();
+    volumeTarget = propGetVolumeTarget();
+    pressVolumeStart();
 
   motorStartInspiration(curr_in_milli);
   
@@ -107,7 +126,7 @@ B_STATE_t breatherGetState()
 
 static void fsmStopped()
 {
-  if (propGetVent() ) {
+  if (propGetVent() && motorIsReady()) { // not before homing is done
       breatherStartCycle();
   }
 }
@@ -121,18 +140,20 @@ static void fsmIn()
     halValveInClose();
     tm_start = halStartTimerRef();
     b_state = B_ST_WAIT_TO_OUT;    
+    metEndInspiration(TM_WAIT_TO_OUT);
+    leakEndInspiration();
   }
   
   //--------- we check for low pressure at 50% or grater
   // low pressure hardcode to 3 InchH2O -> 90 int
   if (curr_progress < 50) {
-      if (getCmH2OGauge(PRESSURE) < lowPressure) {
+      if (pressGetVal(PRESSURE) < lowPressure) {
         CEvent::post(EVT_ALARM, ALARM_IDX_LOW_PRESSURE);
       }
   }
   
   //------ check for high pressure hardcode to 35 InchH2O -> 531 int
-  if (getCmH2OGauge(PRESSURE) > highPressure) {
+  if (pressGetVal(PRESSURE) > highPressure) {
     CEvent::post(EVT_ALARM, ALARM_IDX_HIGH_PRESSURE);
   }
 
@@ -144,7 +165,11 @@ static void fsmWaitToOut()
         // switch valves
         tm_start = halStartTimerRef();
         b_state = B_ST_OUT;
+        leakStartExpiration();
+        metStartExpiration(true);
         halValveOutOpen();
+        // what the bag gave, after the wait, sets the next stroke
+        motorAdaptStroke(pressGetVolume(), volumeTarget);
         motorStartExhalation(curr_out_milli);
     }
 }
@@ -159,6 +184,8 @@ static void fsmOut()
         //if we have fast calibration request then we keep the valve open
         if (fast_calib) {
             fast_calib = false;
+            metStop();
+            leakStop();
             tm_start = halStartTimerRef();
             b_state = B_ST_FAST_CALIB;
             return;
@@ -171,7 +198,6 @@ static void fsmOut()
 
 static void fsmFastCalib()
 {
-    uint64_t m = halStartTimerRef();
     if (halCheckTimerExpired(tm_start, TM_FAST_CALIBRATION)) {
         // switch valves
         tm_start = halStartTimerRef();
@@ -209,8 +235,13 @@ void breatherLoop()
         curr_progress = 0;
         halValveInClose();
         halValveOutOpen();
+        metStop();
+        leakStop();
     }
 
+    metLoop();
+    leakLoop();
+
     if (b_state == B_ST_STOPPED)
         fsmStopped();
     else if (b_state == B_ST_IN)
@@ -228,6 +259,11 @@ void breatherLoop()
     else {
         LOG("breatherLoop: unexpected state");
     }
+
+    if (b_state != bbox_state) {
+        bbox_state = b_state;
+        bboxRecord(BBOX_STATE, (uint8_t) b_state);
+    }
 }
 
 //---------------------------------------------------------
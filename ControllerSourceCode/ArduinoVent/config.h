@@ -44,6 +44,8 @@
  */
 
 #define DEBUG_SERIAL_LOGS // MUST be commented out for production. Also a hack is needed to decrease buffers in HardwareSerial.h
+#define SERIAL_COMMANDS   // one letter commands read from the Serial port (hal.cpp), with or without the logs:
+                          // 'b'/'w' black box dump, 'p'/'r' LOOP_PROFILE report/reset, 't' SENSOR_TRACE start/stop
 
 #ifndef VENTSIM
   #define WATCHDOG_ENABLE  // to disable watchdog comment out this line
@@ -57,6 +59,15 @@ enum {A0, A1, A2, A3, A4, A5, A6, A7};
   #define FLOW_RELATION_SLOPE          26.315
   #define FLOW_RELATION_INTERCEPT      685.67
 #endif
+
+// The car MAF reads the inlet flow only, one way: nothing of the expired
+// volume. The lung model of VentSim/VentHost has a bidirectional, patient side
+// sensor. The leak estimate (leak.h) needs the expired volume.
+#ifdef VENTSIM
+  #define FLOW_SENSOR_BIDIRECTIONAL    1
+#else
+  #define FLOW_SENSOR_BIDIRECTIONAL    0
+#endif
 /*************************************************
  * 
  *         B O A R D   S E L E C T I O N
@@ -73,8 +84,29 @@ enum {A0, A1, A2, A3, A4, A5, A6, A7};
 #define       KEYS_JOYSTICK   1
 #define       KEYS_BUTTONS    0
 
-#define       TX_PIN          18
-#define       RX_PIN          19
+// Telemetry port (serialWriter.cpp). On the Mega it is USART1: TX1 = D18, RX1 = D19.
+// Boards without a second UART (Nano, Uno) send the frames on the Serial port instead,
+// which then cannot carry the logs: TELEMETRY_ENABLE turns DEBUG_SERIAL_LOGS off there.
+// Comment TELEMETRY_ENABLE out to get the logs back (no frames are sent then).
+#define       TELEMETRY_ENABLE
+#define       TELEMETRY_BAUD  9600
+#define       TELEMETRY_TX_RING_SIZE  64   // bytes, power of 2. Two 19 byte frames (status, metrics)
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+  #define     TELEMETRY_UART1              // a port of its own
+#elif defined(TELEMETRY_ENABLE) && defined(DEBUG_SERIAL_LOGS) && !defined(VENTSIM)
+  #warning "Single UART: telemetry takes the Serial port, DEBUG_SERIAL_LOGS is off"
+  #undef DEBUG_SERIAL_LOGS
+#endif
+
+// Black box (blackbox.h): last events, states, valve changes and alarms, kept over a watchdog reset.
+// 4 bytes per entry, power of 2 up to 128. With SERIAL_COMMANDS send 'b' to dump it, 'w' for the
+// snapshot of the last watchdog reset; VentHost -D decodes a capture.
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__)
+  #define     BLACKBOX_SIZE           8    // 2 KB of RAM: a bigger ring leaves no room for the stack
+#else
+  #define     BLACKBOX_SIZE           64
+#endif
 
 
 
@@ -312,6 +344,15 @@ enum {A0, A1, A2, A3, A4, A5, A6, A7};
 
 #define TM_SAVE_TIMEOUT 30000 // save props to EEPROM is UI is "quiet" for longer than 30 seconds
 
+//------- BMP280 acquisition (bmp280_int.cpp). Reads never block: see bmp280Loop()
+#define BMP280_READ_PERIOD      10      // ms between pressure samples (conversion takes up to 6.4 ms)
+#define BMP280_I2C_CLOCK        400000L // I2C bus speed, shared with the I2C LCD
+//#define BMP280_NORMAL_MODE            // free running conversions filtered by the sensor's IIR filter
+                                        // instead of one triggered (forced) conversion per sample
+#ifdef BMP280_NORMAL_MODE
+  #define BMP280_IIR_FILTER     BME280::Filter_4 // Filter_2 .. Filter_16: higher is smoother but lags more
+#endif
+
 
 /*======================================
   =                                    =
@@ -331,10 +372,23 @@ enum {A0, A1, A2, A3, A4, A5, A6, A7};
 
 #define  DEFAULT_LOW_PRESSURE    4
 #define  DEFAULT_HIGH_PRESSURE   35
+#define  VALVE_CLOSE_LATENCY     20    // ms, inlet close command to flow stop: the high pressure limit acts this far ahead until calibrated
 #define  DEFAULT_LOW_TIDAL       100
 #define  DEFAULT_HIGH_TIDAL      1200
 #define  DEFAULT_DESIRED_PEEP    3
 
+#define  DEFAULT_MODE            0     // PROP_MODE_TIMED
+#define  DEFAULT_INSP_PRESSURE   15    // cmH2O, pressure control target
+#define  DEFAULT_RISE_TIME       200   // ms, pressure control ramp to the target
+#define  DEFAULT_VOLUME_TARGET   500   // mL, volume control: inspiration ends when delivered
+#define  DEFAULT_TRIG_PRESSURE   0     // cmH2O below PEEP that starts an assisted breath, 0 = off
+#define  DEFAULT_TRIG_FLOW       0     // L/min into the patient that starts an assisted breath, 0 = off
+#define  DEFAULT_VALVE_LATENCY   0     // ms, all four valve latencies until a valve calibration measured them
+#define  DEFAULT_INSP_HOLD       0     // ms, inspiratory hold on top of TM_WAIT_TO_OUT, for the plateau pressure
+#define  DEFAULT_APNEA_TIME      20    // s without a breath (a patient breath when triggering) before apnea, 0 = off
+#define  DEFAULT_BACKUP_BPM      20    // BPM on apnea, until the patient breathes again
+#define  LEAK_ALARM_PERCENT      40    // % of the inspired volume lost to leaks that raises HIGH LEAK
+
 //-------------- Checks ---------------
 #if (LCD_CFG_2_ROWS == 1)
   #define LCD_NUM_ROWS 2
@@ -367,6 +421,15 @@ enum {A0, A1, A2, A3, A4, A5, A6, A7};
                             // Also connected to SW3
 // Profile on April 06th: Main loop taking 180 microseconds to be processed.
 
+//#define SCHED_IDLE_SLEEP  // when no scheduled task is due, idle-sleep the CPU until the next interrupt
+                            // (Timer0 wakes it at least every 1.024 ms). Saves power, adds up to 1 ms latency
+
+//#define LOOP_PROFILE  // per subsystem timing (profiler.h). Needs SERIAL_COMMANDS to get the report:
+                        // send 'p' to print it and 'r' to reset. Costs ~360 bytes of RAM.
+
+//#define SENSOR_TRACE  // binary pressure/flow/valve trace on the telemetry port (trace.h), replayed by VentHost -r.
+                        // With SERIAL_COMMANDS send 't' to start/stop it. Telemetry frames pause while tracing.
+
 //
 
 
@@ -23,46 +23,157 @@
 #include "event.h"
 #include <string.h>
 #include "log.h"
+#include "blackbox.h"
+
+#ifndef VENTSIM
+  #include <util/atomic.h>
+  #define EVT_ATOMIC      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+  #define EVT_ATOMIC
+#endif
    
 
 //----------- Locals -------------
 
+#define NUM_MAX_LISNERS 2   // Alarm and CUiNative: a row per event type, RAM is short on the Nano
 
-#define QUEUE_SIZE 6
-#define NUM_MAX_LISNERS 4
+#define EVT_SRC_TASK    0
+#define EVT_SRC_ISR     1
+#define EVT_NUM_SRC     2
+
+// keeps the compiler from moving the event copy past the index store
+#define EVT_BARRIER()   __asm__ __volatile__("" ::: "memory")
+
+typedef struct evt_ring_st {
+    event_t *           q;
+    uint8_t             mask;
+    volatile uint8_t    head;       // producer only, free running
+    volatile uint8_t    tail;       // evtDispatchAll() only, free running
+    uint8_t             maxDepth;
+    volatile uint16_t   dropped;
+} evt_ring_t;
 
 //extern void LOG(const char * txt);
 
 //------------ Global -----------
- static event_t eventQ[QUEUE_SIZE];
- static int eventQIdxIn = 0;
- static int eventQIdxOut = 0;
- static int eventQIdxCount = 0;
-
- static CEvent * lisners[NUM_MAX_LISNERS];
+ static event_t qAlarm[EVT_ALARM_Q_SIZE];
+ static event_t qAlarmIsr[EVT_Q_SIZE];
+ static event_t qUi[EVT_Q_SIZE];
+ static event_t qUiIsr[EVT_Q_SIZE];
+
+ static evt_ring_t rings[EVT_PRIO_NUM][EVT_NUM_SRC] = {
+     { { qAlarm, EVT_ALARM_Q_SIZE - 1, 0, 0, 0, 0 }, { qAlarmIsr, EVT_Q_SIZE - 1, 0, 0, 0, 0 } },
+     { { qUi,    EVT_Q_SIZE - 1,       0, 0, 0, 0 }, { qUiIsr,    EVT_Q_SIZE - 1, 0, 0, 0, 0 } },
+ };
+ static uint16_t droppedLogged[EVT_PRIO_NUM];
+
+ static CEvent * lisners[EVT_TYPE_NUM][NUM_MAX_LISNERS]; // subscribers of each type, registration order
+ static uint8_t num_type_lisners[EVT_TYPE_NUM];
  static int num_lisners = 0;
 
+#if (EVT_TYPE_NUM > 8)
+  #error "event types do not fit the uint8_t subscription mask"
+#endif
+
+ static evt_prio_t priority(EVENT_TYPE type)
+ {
+     if (type == EVT_KEY_PRESS || type == EVT_KEY_RELEASE)
+         return EVT_PRIO_UI;
+     return EVT_PRIO_ALARM;
+ }
+
+ static void push(evt_ring_t * r, event_t * event)
+ {
+     uint8_t h = r->head;
+     uint8_t depth = (uint8_t) (h - r->tail);
+     if (depth > r->mask) {
+         if (r->dropped < 0xffff) r->dropped++; // logged by the dispatcher, not from here
+         return;
+     }
+     r->q[h & r->mask] = *event;
+     EVT_BARRIER();
+     r->head = h + 1;
+     if (depth + 1 > r->maxDepth) r->maxDepth = depth + 1;
+ }
+
+ // ring to take from: highest priority, main loop ring first. 0 if none
+ static evt_ring_t * nextRing()
+ {
+     uint8_t p, s;
+     for (p = 0; p < EVT_PRIO_NUM; p++) {
+         for (s = 0; s < EVT_NUM_SRC; s++) {
+             evt_ring_t * r = &rings[p][s];
+             if (r->head != r->tail) return r;
+         }
+     }
+     return 0;
+ }
+
+ static void logDrops()
+ {
+     uint8_t p;
+     for (p = 0; p < EVT_PRIO_NUM; p++) {
+         uint16_t d = evtGetDropped((evt_prio_t) p);
+         if (d != droppedLogged[p]) {
+             LOGV("critical error: %u events dropped, priority %d", d - droppedLogged[p], p);
+             droppedLogged[p] = d;
+         }
+     }
+ }
+
  void evtDispatchAll()
  {
      int i;
+     uint8_t n = 0;
      propagate_t ret;
-     while (eventQIdxCount>0) {
-         for (i=0; i<num_lisners; i++) {
-             ret = lisners[i]->onEvent(&eventQ[eventQIdxOut]);
+     evt_ring_t * r;
+     event_t e;
+
+     // listeners post too: bounded to what the rings hold so one pass cannot spin
+     while (n++ < EVT_ALARM_Q_SIZE + 3 * EVT_Q_SIZE && (r = nextRing()) != 0) {
+         uint8_t t = r->tail;
+         e = r->q[t & r->mask]; // copied out: the slot is the producer's again below
+         EVT_BARRIER();
+         r->tail = t + 1;
+         if ((unsigned) e.type >= EVT_TYPE_NUM) continue;
+         for (i=0; i<num_type_lisners[e.type]; i++) {
+             ret = lisners[e.type][i]->onEvent(&e);
              if (ret == PROPAGATE_STOP)
                  break;
          }
+     }
+     logDrops();
+ }
 
-         eventQIdxOut++;
-         if (eventQIdxOut >= QUEUE_SIZE) eventQIdxOut = 0;
-         eventQIdxCount--;
+ uint16_t evtGetDropped(evt_prio_t prio)
+ {
+     uint8_t s;
+     uint16_t d = 0;
+     for (s = 0; s < EVT_NUM_SRC; s++) {
+         EVT_ATOMIC {
+             d += rings[prio][s].dropped; // 16 bits: an interrupt could post between the two bytes
+         }
      }
+     return d;
  }
 
- CEvent::CEvent()
+ uint8_t evtGetMaxDepth(evt_prio_t prio)
  {
+     uint8_t s, m = 0;
+     for (s = 0; s < EVT_NUM_SRC; s++)
+         if (rings[prio][s].maxDepth > m) m = rings[prio][s].maxDepth;
+     return m;
+ }
+
+ CEvent::CEvent(uint8_t typeMask)
+ {
+     uint8_t t;
      if (num_lisners < NUM_MAX_LISNERS) {
-         lisners[num_lisners++] = this;
+         num_lisners++;
+         for (t=0; t<EVT_TYPE_NUM; t++) {
+             if (typeMask & EVT_MASK(t))
+                 lisners[t][num_type_lisners[t]++] = this;
+         }
      }
      else {
          LOG("critical error, no room for CEvent");
@@ -78,35 +189,20 @@
     post(&e);
  }
 
- void CEvent::post( EVENT_TYPE type,
-                    uint64_t lParam)
- {
-     event_t e;
-     e.type = type;
-     e.param.lParam = lParam;
-     post(&e);
- }
-
- void CEvent::post( EVENT_TYPE type,
-                    char * tParam)
+ void CEvent::postFromISR( EVENT_TYPE type,
+                           int iParam)
  {
-     event_t e;
-     e.type = type;
-     memcpy(e.param.tParam, tParam, sizeof(e.param.tParam));
-     post(&e);
+    event_t e;
+    e.type = type;
+    e.param.iParam = iParam;
+    bboxRecord(BBOX_EVENT_ISR + type, (uint8_t) iParam);
+    push(&rings[priority(type)][EVT_SRC_ISR], &e);
  }
 
  void CEvent::post (event_t * event)
  {
-     if (eventQIdxCount >= NUM_MAX_LISNERS ) {
-         LOG("critical error: Event queue full");
-         return;
-     }
-     event_t * e = &eventQ[eventQIdxIn++];
-     eventQIdxCount++;
-     if (eventQIdxIn >= QUEUE_SIZE) eventQIdxIn = 0;
-
-    *e = *event;
+    bboxRecord(BBOX_EVENT + event->type, (uint8_t) event->param.iParam);
+    push(&rings[priority(event->type)][EVT_SRC_TASK], event);
  }
 
 
@@ -21,8 +21,39 @@
  **************************************************************
 */
 
+/**
+ * @file event.h
+ * @brief Event queues and dispatch to the CEvent listeners.
+ *
+ * Events wait in single producer / single consumer rings, one per priority
+ * and per producer context: post() from the main loop, postFromISR() from
+ * interrupt handlers (they do not nest, so all of them are one producer).
+ * The producer owns a ring's head and the dispatcher its tail, both single
+ * bytes, so neither side needs interrupts masked.
+ *
+ * evtDispatchAll() always takes alarm events first (EVT_ALARM and the alarm
+ * display), key events only when no alarm event waits. Within a priority the
+ * main loop ring is emptied before the interrupt ring: each ring keeps its
+ * own order, the order between the two is not kept. The rings
+ * are separate, so a burst of key presses cannot take the room of an alarm.
+ * A full ring drops the new event: drops and the deepest fill are counted
+ * per priority, and the dispatcher logs each new drop.
+ *
+ * A listener subscribes to the event types it handles when it registers
+ * (the CEvent constructor mask). The dispatcher keeps one listener list per
+ * type, in registration order, so an event only reaches its subscribers and
+ * a listener added for one type costs nothing to the others.
+ *
+ * The payload is 16 bits: a key code, or a handle the receiver resolves
+ * when it needs it (EVT_ALARM and EVT_ALARM_DISPLAY_ON carry an alarm index,
+ * alarmGetMessage() gives its text from flash). No text is copied into the
+ * queues, which keeps a slot at 3 bytes on the AVR.
+ */
+
 #include <stdint.h>
-#define TEXT_PARAM_SIZE 21
+
+#define EVT_ALARM_Q_SIZE        8   // power of 2, alarms posted from the main loop
+#define EVT_Q_SIZE              4   // power of 2, the other rings. VentHost prints the deepest fill
 
 enum  {
     KEY_DECREMENT,
@@ -33,7 +64,7 @@ enum  {
 };
 
 
-typedef enum  {
+typedef enum : uint8_t {
     EVT_KEY_PRESS,
     EVT_KEY_RELEASE,
 
@@ -42,8 +73,19 @@ typedef enum  {
     EVT_ALARM_DISPLAY_ON,
     EVT_ALARM_DISPLAY_OFF,
 
+    EVT_TYPE_NUM    // must be the last one, 8 at most (subscription masks)
 } EVENT_TYPE;
 
+#define EVT_MASK(type)  ((uint8_t) (1 << (type)))
+#define EVT_MASK_ALL    ((uint8_t) 0xff)
+
+typedef enum {
+    EVT_PRIO_ALARM,     // alarms and the alarm display: safety first
+    EVT_PRIO_UI,        // keys
+
+    EVT_PRIO_NUM
+} evt_prio_t;
+
 typedef  enum {
     PROPAGATE = 0,
     PROPAGATE_STOP,
@@ -52,29 +94,27 @@ typedef  enum {
 typedef struct event_st {
     EVENT_TYPE type;
     union {
-        int iParam;
-        unsigned long long lParam;
-        char tParam[TEXT_PARAM_SIZE];
+        int16_t  iParam;
+        uint16_t handle;    // resolved by the receiver, see the event types
     } param;
 } event_t;
 
 
 void evtDispatchAll();
+uint16_t evtGetDropped(evt_prio_t prio);    // events lost to a full ring since boot
+uint8_t  evtGetMaxDepth(evt_prio_t prio);   // deepest a ring of this priority has been
 
 class CEvent {
 
 public:
-    CEvent();
+    CEvent(uint8_t typeMask = EVT_MASK_ALL); // EVT_MASK() of every type onEvent() handles
     ~CEvent();
 
     static void post( EVENT_TYPE type,
                       int iParam);
 
-    static void post( EVENT_TYPE type,
-                      uint64_t lParam);
-
-    static void post( EVENT_TYPE type,
-                      char * tParam);
+    static void postFromISR( EVENT_TYPE type,
+                             int iParam);  // interrupt handlers only
 
     virtual propagate_t onEvent(event_t * event);
 
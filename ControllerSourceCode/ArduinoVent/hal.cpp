@@ -25,6 +25,10 @@
 #include "properties.h"
 #include "pressure.h"
 #include "serialWriter.h"
+#include "profiler.h"
+#include "sched.h"
+#include "trace.h"
+#include "blackbox.h"
 
 #ifndef LCD_CFG_I2C
   #include "LcdMv.h"
@@ -35,6 +39,14 @@
 
 
 
+#include <util/atomic.h>
+#ifdef STEPPER_MOTOR_STEP_PIN
+  #include <util/delay.h>
+#endif
+#ifdef SCHED_IDLE_SLEEP
+  #include <avr/sleep.h>
+#endif
+
 #ifdef WATCHDOG_ENABLE
   #if defined(__AVR__)
     #include <avr/wdt.h>
@@ -46,17 +58,11 @@
 
 //---------- Constants ---------
 #define EEPROM_DATA_BLOCK_ADDRESS 0
+#define EEPROM_BLACKBOX_ADDRESS   512   // after the props, within the 1 KB of the ATmega328
 
 static MONITOR_LET_T monitor_led_speed = MONITOR_LED_NORMAL;
 
 //-------- variables --------
-static uint64_t tm_led;
-static bool alarm = false;
-static int alarm_phase = 0;
-static uint64_t tm_alarm;
-
-
-static uint64_t tm_key_sampling;
 
 static char lcdBuffer [LCD_NUM_ROWS][LCD_NUM_COLS];
 static int cursor_col = 0, cursor_row = 0;
@@ -64,32 +70,96 @@ static int cursor_col = 0, cursor_row = 0;
 
 static int led_state = 0;
 
-#define FREQ1 440
-#define FREQ2 740
-#define FREQ3 880
 
 //--------- local prototypes ------
 static void motorInit();
+static void processKeys();
+static void enableWdt();
+
+//--------- scheduled tasks -------
+static sched_task_t ledTask       = SCHED_TASK(halBlinkLED);
+static sched_task_t keysTask      = SCHED_TASK(processKeys);
+static sched_task_t wdtEnableTask = SCHED_TASK(enableWdt);
+
+//-------------------------------------------------------
+//-------  Alarm tones: the Timer2 compare ISR toggles the pin and steps the burst
+//-------------------------------------------------------
+// IEC 60601-1-8 pulses, ms: on, off, on, off... the last off is the interburst interval.
+// high: 2 bursts of 5 pulses (td 150, ts 100, 2ts+td between the 3rd and the 4th), 1 s apart, every 5 s
+// medium: 3 pulses (td 200, ts 200) every 10 s. low: 2 pulses every 20 s
+static const uint16_t toneHigh[] PROGMEM   = { 150, 100, 150, 100, 150, 350, 150, 100, 150, 1000,
+                                               150, 100, 150, 100, 150, 350, 150, 100, 150, 5000 };
+static const uint16_t toneMedium[] PROGMEM = { 200, 200, 200, 200, 200, 10000 };
+static const uint16_t toneLow[] PROGMEM    = { 200, 200, 200, 20000 };
+
+#define TONE_HZ_HIGH        880     // square waves: the harmonics the standard asks for come with it
+#define TONE_HZ_MEDIUM      740
+#define TONE_HZ_LOW         440
+#define TONE_TIMER_HZ       (F_CPU / 128)   // Timer2 prescaler 128: 440 Hz fits the 8 bit compare
+
+static hal_tone_t               toneCurrent = HAL_TONE_OFF;
+static volatile uint8_t *       tonePort;
+static uint8_t                  toneBit;
+static const uint16_t *         toneSeg;        // PROGMEM
+static uint8_t                  toneSegs;
+static uint8_t                  toneIdx;        // even: pulse, odd: silence
+static uint16_t                 toneHalfHz;     // compare matches per second
+static uint16_t                 toneLeft;       // compare matches left in the segment
+
+static uint16_t toneMatches(uint8_t idx)
+{
+  return (uint16_t) ((uint32_t) pgm_read_word(&toneSeg[idx]) * toneHalfHz / 1000);
+}
 
-void halBeepAlarmOnOff( bool on)
+ISR(TIMER2_COMPA_vect)
+{
+  if (toneLeft == 0) {
+    toneIdx = (toneIdx + 1 == toneSegs) ? 0 : toneIdx + 1;
+    toneLeft = toneMatches(toneIdx);
+    *tonePort &= ~toneBit;
+  }
+  toneLeft--;
+  if ((toneIdx & 1) == 0) *tonePort ^= toneBit;
+}
+
+void halAlarmTone(hal_tone_t t)
 {
 #ifndef  NO_ALARM_SOUND
+  uint16_t hz;
+
+  if (t == toneCurrent) return; // keep the burst going
+  toneCurrent = t;
 
-  if (on == true) {
-    alarm = true;
-    alarm_phase = 0;
-    tm_alarm = halStartTimerRef();
-    // turn tone on
-    alarm_phase = 0;
-    tone(ALARM_SOUND_PIN, FREQ1);
+  TCCR2B = 0; // stop the clock: the ISR is quiet while the pattern changes
+  TIMSK2 &= ~_BV(OCIE2A);
+  *tonePort &= ~toneBit;
+  if (t == HAL_TONE_OFF) return;
 
+  if (t == HAL_TONE_HIGH) {
+    toneSeg = toneHigh;
+    toneSegs = sizeof(toneHigh) / sizeof(toneHigh[0]);
+    hz = TONE_HZ_HIGH;
+  }
+  else if (t == HAL_TONE_MEDIUM) {
+    toneSeg = toneMedium;
+    toneSegs = sizeof(toneMedium) / sizeof(toneMedium[0]);
+    hz = TONE_HZ_MEDIUM;
   }
   else {
-    alarm = false;
-    noTone(ALARM_SOUND_PIN);
-    // turn tone off
+    toneSeg = toneLow;
+    toneSegs = sizeof(toneLow) / sizeof(toneLow[0]);
+    hz = TONE_HZ_LOW;
   }
-
+  toneHalfHz = 2 * hz;
+  toneIdx = 0;
+  toneLeft = toneMatches(0);
+
+  TCCR2A = _BV(WGM21);              // CTC on OCR2A
+  OCR2A = TONE_TIMER_HZ / toneHalfHz - 1;
+  TCNT2 = 0;
+  TIFR2 = _BV(OCF2A);               // drop a match left pending
+  TIMSK2 |= _BV(OCIE2A);
+  TCCR2B = _BV(CS22) | _BV(CS20);   // prescaler 128: go
 #endif
 }
 
@@ -107,14 +177,16 @@ void halBeepAlarmOnOff( bool on)
 
 #define TM_WAIT_TO_ENABLE_WATCHDOG 3000
 
-uint64_t tm_wdt = 0;
 static int wdt_st;
 
 //-------------------------------------------------------  
 //-------         Milliseconds Timer
 //-------------------------------------------------------  
 
-uint64_t halStartTimerRef()
+static uint64_t timerRef;
+static bool timerRefLatched = false;
+
+static uint64_t readTimerRef()
 {
     static uint32_t low32, high32 = 0;
     uint32_t new_low32 = millis();
@@ -123,6 +195,19 @@ uint64_t halStartTimerRef()
     return (uint64_t) high32 << 32 | low32;
 }
 
+void halLatchTimerRef()
+{
+    timerRef = readTimerRef();
+    timerRefLatched = true;
+}
+
+// once the main loop runs every caller in the same pass gets the same time for free
+uint64_t halStartTimerRef()
+{
+    if (timerRefLatched) return timerRef;
+    return readTimerRef(); // setup: no pass running yet
+}
+
 bool halCheckTimerExpired(uint64_t timerRef, uint64_t time)
 {
     uint64_t now = halStartTimerRef();
@@ -177,7 +262,7 @@ static void initWdt(uint8_t reset_val)
 {
 #ifdef WATCHDOG_ENABLE
   wdt_st = 0;
-  tm_wdt = halStartTimerRef();
+  schedStart(&wdtEnableTask, TM_WAIT_TO_ENABLE_WATCHDOG, 0);
 
   // the following line always return zero as bootloader clears the bit.
   // see hack at: https://www.reddit.com/r/arduino/comments/29kev1/a_question_about_the_mcusr_and_the_wdrf_after_a/
@@ -193,22 +278,23 @@ static void initWdt(uint8_t reset_val)
   halSetMonitorLED(MONITOR_LED_SLOW);
 #endif
 }
+static void enableWdt() // one shot, TM_WAIT_TO_ENABLE_WATCHDOG after init
+{
+#ifdef WATCHDOG_ENABLE
+  wdt_st = 1;
+  wdt_enable(WDTO_1S); //WDTO_2S Note: LCD Library is TOO SLOW... need to fix to get real time and lower WDT
+
+  /* WDT possible values for ATMega 8, 168, 328, 1280, 2560
+       WDTO_15MS, WDTO_30MS, WDTO_60MS, WDTO_120MS, WDTO_250MS, WDTO_500MS, WDTO_1S, WDTO_2S
+     WDT possible values for  ATMega 168, 328, 1280, 2560
+       WDTO_4S, WDTO_8S */
+#endif
+}
+
 static void loopWdt()
 {
 #ifdef WATCHDOG_ENABLE
-  if (wdt_st == 0) { // wait to enable WDT 
-    if (halCheckTimerExpired(tm_wdt, TM_WAIT_TO_ENABLE_WATCHDOG)) {
-        tm_wdt = halStartTimerRef();
-        wdt_st = 1;
-        wdt_enable(WDTO_1S); //WDTO_2S Note: LCD Library is TOO SLOW... need to fix to get real time and lower WDT
-
-        /* WDT possible values for ATMega 8, 168, 328, 1280, 2560
-             WDTO_15MS, WDTO_30MS, WDTO_60MS, WDTO_120MS, WDTO_250MS, WDTO_500MS, WDTO_1S, WDTO_2S
-           WDT possible values for  ATMega 168, 328, 1280, 2560
-             WDTO_4S, WDTO_8S */
-    }
-    return;
-  }
+  if (wdt_st == 0) return; // wait to enable WDT
   //------- if we are here then WDT is enabled... kick it
   wdt_reset();
 #endif
@@ -217,12 +303,12 @@ static void loopWdt()
   
 void halInit(uint8_t reset_val) {
   int r,c;
-#ifdef DEBUG_SERIAL_LOGS
+#if defined(DEBUG_SERIAL_LOGS) || defined(SERIAL_COMMANDS)
   Serial.begin(9600);
-  LOG("Starting...");
 #endif
+  LOG("Starting...");
+  bboxInit(reset_val); // first: anything after may record
   pinMode(MONITOR_LED_PIN, OUTPUT);
-  tm_led = halStartTimerRef();
   
   propInit();
 #ifdef LCD_CFG_I2C
@@ -260,9 +346,16 @@ void halInit(uint8_t reset_val) {
   halValveInClose();
   halValveOutOpen();
 
-  tm_key_sampling = halStartTimerRef();
+// ------ alarm sound -------
+  pinMode(ALARM_SOUND_PIN, OUTPUT);
+  digitalWrite(ALARM_SOUND_PIN, LOW);
+  tonePort = portOutputRegister(digitalPinToPort(ALARM_SOUND_PIN));
+  toneBit = digitalPinToBitMask(ALARM_SOUND_PIN);
+
+  schedStart(&keysTask, TM_KEY_SAMPLING, TM_KEY_SAMPLING);
   initWdt(reset_val);
   pressInit();
+  halAdcInit(); // after pressInit: analogReference() is set there
   motorInit();
   serialInit();
 }
@@ -279,16 +372,8 @@ static void testKey()
 
 void halSetMonitorLED (MONITOR_LET_T speed)
 {
+  uint16_t tm;
   monitor_led_speed = speed;
-}
-MONITOR_LET_T halGetMonitorLED ()
-{
-  return monitor_led_speed;
-}
-
-void halBlinkLED()
-{
-  uint64_t tm;
   if (monitor_led_speed == MONITOR_LED_FAST) {
     tm = TM_MONITOR_LED_FAST;
   }
@@ -298,49 +383,22 @@ void halBlinkLED()
   else {
     tm = TM_MONITOR_LED_NORMAL;
   }
-  
-    if (halCheckTimerExpired(tm_led, tm)) {
-        tm_led = halStartTimerRef();
-
-
-        if (led_state) {
-          led_state = 0;
-          digitalWrite(MONITOR_LED_PIN, LOW);
-        }
-        else {
-          led_state = 1;
-          digitalWrite(MONITOR_LED_PIN, HIGH);
-        }
-        
-    }
+  schedStart(&ledTask, tm, tm);
+}
+MONITOR_LET_T halGetMonitorLED ()
+{
+  return monitor_led_speed;
 }
 
-static void alarmToggler()
-{
-    if (alarm != true) return;
-    
-    if (halCheckTimerExpired(tm_alarm, TM_ALARM_PERIOD / 5)) {
-      tm_alarm = halStartTimerRef();
-      switch (alarm_phase) {
-        case 0:
-          noTone(ALARM_SOUND_PIN);
-          tone(ALARM_SOUND_PIN, FREQ2);
-          break;
-        case 1:
-          noTone(ALARM_SOUND_PIN);
-          tone(ALARM_SOUND_PIN, FREQ3);
-          break;
-        case 2:
-          noTone(ALARM_SOUND_PIN);
-          break;
-        case 6:
-          tone(ALARM_SOUND_PIN, FREQ1);
-          alarm_phase = 0;
-          return;
-        default:
-          break;
-      }
-      alarm_phase++;
+void halBlinkLED() // ledTask, period set by halSetMonitorLED()
+{
+    if (led_state) {
+      led_state = 0;
+      digitalWrite(MONITOR_LED_PIN, LOW);
+    }
+    else {
+      led_state = 1;
+      digitalWrite(MONITOR_LED_PIN, HIGH);
     }
 }
 
@@ -349,22 +407,14 @@ static void alarmToggler()
 static void lcdUpdate()
 {
     int i,r;
-    char *s, *d;
-    char out[LCD_NUM_COLS + 1];
 
     for (r=0; r<LCD_NUM_ROWS; r++) {
-        d = out;
-        s = &lcdBuffer [r][0];
-        for (i=0; i<LCD_NUM_COLS; i++) {
-            *d++ = *s++;
-        }
-        *d++ = 0;
-      
 #ifdef LCD_CFG_I2C          // only for I2C as LcdMv updates by refresh
         lcd.setCursor(0,r);
-        lcd.print(out);
+        for (i=0; i<LCD_NUM_COLS; i++) {
+            lcd.write((uint8_t) lcdBuffer [r][i]); // what print() did, without a copy on the stack
+        }
 #endif
-      
     }
 }
 
@@ -409,7 +459,9 @@ void halLcdWrite(const char * txt)
   }
   memcpy(&lcdBuffer[cursor_row][cursor_col], txt, n);
   // TODO: row overflow check or clipping
+  PROF_BEGIN(PROF_LCD);
   lcdUpdate();
+  PROF_END(PROF_LCD);
 }
 
 void halLcdWrite(int col, int row, const char * txt)
@@ -419,39 +471,140 @@ void halLcdWrite(int col, int row, const char * txt)
 }
 
 //---------- valves Real
+static uint8_t valveState;
+
 void halValveInOpen()
 {
+    valveState |= HAL_VALVE_IN_OPEN;
 #ifdef VALVE_IN_ACTIVE_LOW
     digitalWrite(VALVE_IN_PIN, LOW);
 #else
     digitalWrite(VALVE_IN_PIN, HIGH);
 #endif
+    bboxValves(valveState);
 }
 void halValveInClose()
 {
+    valveState &= ~HAL_VALVE_IN_OPEN;
 #ifdef VALVE_IN_ACTIVE_LOW
     digitalWrite(VALVE_IN_PIN, HIGH);
 #else
     digitalWrite(VALVE_IN_PIN, LOW);
 #endif
+    bboxValves(valveState);
 }
 void halValveOutOpen()
 {
+    valveState |= HAL_VALVE_OUT_OPEN;
 #ifdef VALVE_OUT_ACTIVE_LOW
     digitalWrite(VALVE_OUT_PIN, LOW);
 #else
     digitalWrite(VALVE_OUT_PIN, HIGH);
 #endif
+    bboxValves(valveState);
 }
 void halValveOutClose()
 {
+    valveState &= ~HAL_VALVE_OUT_OPEN;
 #ifdef VALVE_OUT_ACTIVE_LOW
     digitalWrite(VALVE_OUT_PIN, HIGH);
 #else
     digitalWrite(VALVE_OUT_PIN, LOW);
 #endif
+    bboxValves(valveState);
+}
+uint8_t halGetValveState()
+{
+    return valveState;
 }
 //---------- Stepper Motor ---------
+#ifdef STEPPER_MOTOR_STEP_PIN
+// Timer1 runs in CTC mode with prescaler 8. Each compare match issues one STEP
+// pulse and loads the interval to the next one from the profile, so step timing
+// does not depend on how long a main loop pass takes.
+
+static volatile uint8_t * motorStepPort;
+static uint8_t            motorStepMask;
+static const uint16_t *   motorRamp;
+static uint8_t            motorRampLen;
+static uint16_t           motorCruise;
+static uint16_t           motorSteps;
+static volatile uint16_t  motorPos;
+static volatile bool      motorRunning;
+
+static inline uint16_t motorInterval(uint16_t n)
+{
+  uint16_t k = motorSteps - 1 - n; // steps left: decelerate on the mirrored ramp
+  if (n < k) k = n;
+  return (k < motorRampLen) ? motorRamp[k] : motorCruise;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+  uint16_t n;
+
+  *motorStepPort |= motorStepMask;      // STEP high
+  n = motorPos + 1;
+  motorPos = n;
+  if (n >= motorSteps) {
+    TCCR1B &= ~(_BV(CS12) | _BV(CS11) | _BV(CS10)); // stop the clock
+    TIMSK1 &= ~_BV(OCIE1A);
+    motorRunning = false;
+  }
+  else {
+    OCR1A = halMotorCompare(motorInterval(n));
+  }
+  _delay_us(HAL_MOTOR_PULSE_US);        // the work above can take less than the driver's minimum
+  *motorStepPort &= ~motorStepMask;     // STEP low
+}
+
+void halMotorStop()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1B &= ~(_BV(CS12) | _BV(CS11) | _BV(CS10));
+    TIMSK1 &= ~_BV(OCIE1A);
+    motorRunning = false;
+  }
+}
+
+void halMotorRun(uint16_t steps, const uint16_t * ramp, uint8_t rampLen, uint16_t cruise)
+{
+  halMotorStop();
+  motorPos = 0;
+  if (steps == 0) return;
+
+  motorRamp = ramp;
+  motorRampLen = rampLen;
+  motorCruise = cruise;
+  motorSteps = steps;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12);              // CTC on OCR1A, clock stopped
+    TCNT1 = 0;
+    OCR1A = halMotorCompare(motorInterval(0));
+    TIFR1 = _BV(OCF1A);               // clear a stale match (written as one)
+    TIMSK1 |= _BV(OCIE1A);
+    motorRunning = true;
+    TCCR1B |= _BV(CS11);              // prescaler 8: go
+  }
+}
+
+bool halMotorIsRunning()
+{
+  return motorRunning;
+}
+
+uint16_t halMotorGetPosition()
+{
+  uint16_t pos;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pos = motorPos;
+  }
+  return pos;
+}
+#endif // STEPPER_MOTOR_STEP_PIN
+
 static void motorInit() 
 {
 #ifdef STEPPER_MOTOR_STEP_PIN
@@ -461,6 +614,8 @@ static void motorInit()
   pinMode(STEPPER_MOTOR_EOC_PIN, INPUT_PULLUP);
 #endif
   halMotorStep(false);
+  motorStepPort = portOutputRegister(digitalPinToPort(STEPPER_MOTOR_STEP_PIN));
+  motorStepMask = digitalPinToBitMask(STEPPER_MOTOR_STEP_PIN);
 #endif
 }
 
@@ -484,25 +639,192 @@ void halMotorDir(bool dir)
 
 bool halMotorEOC()
 {
-#ifdef STEPPER_MOTOR_STEP_PIN
-  #ifdef STEPPER_MOTOR_EOC_PIN
-    return digitalRead(STEPPER_MOTOR_EOC_PIN);
-  #else
+#if defined(STEPPER_MOTOR_STEP_PIN) && defined(STEPPER_MOTOR_EOC_PIN)
+    return digitalRead(STEPPER_MOTOR_EOC_PIN) == LOW; // active low, pulled up
+#else
     return false;
-  #endif
 #endif
 }
 
+//-------------------------------------------------------
+//------- ADC scan engine
+//-------------------------------------------------------
+// Conversions are auto triggered by the Timer0 overflow (the millis() timer), so
+// no timer is reconfigured and the sample rate is fixed: one conversion every
+// ADC_TICK_US, round robin over the channels. The ADC ISR stores the result
+// with its tick stamp and selects the next channel, which is applied on the
+// next trigger. analogRead() must not be used once halAdcInit() was called.
+
+#ifdef ADC_SCAN
+
+#define ADC_RING_MASK (ADC_RING_SIZE - 1)
+
+typedef struct adc_ring_st {
+  volatile uint16_t value[ADC_RING_SIZE];
+  volatile uint16_t stamp[ADC_RING_SIZE];
+  volatile uint8_t  head;         // free running, written by the ISR only
+  uint8_t           tail;         // free running, written by halAdcRead only
+  volatile uint32_t sum;          // since the last halAdcGetAverage: a main loop stall
+  volatile uint16_t count;        // longer than the ring still lands in the average
+} adc_ring_t;
+
+static const uint8_t adcPins[ADC_NUM_CHANNELS] = {
+#ifdef ADC_SCAN_PRESSURE
+  PRESSURE_SENSOR_PIN,
+#endif
+#ifdef ADC_SCAN_FLOW
+  FLOW_SENSOR_PIN,
+#endif
+#ifdef ADC_SCAN_JOYSTICK
+  KEY_INCREMENT_PIN,
+#endif
+};
+
+static uint8_t adcMux[ADC_NUM_CHANNELS];
+static adc_ring_t adcRing[ADC_NUM_CHANNELS];
+static volatile uint8_t adcCh;
+static volatile uint16_t adcTick;
+
+static uint8_t adcPinToMux(uint8_t pin)
+{
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+  if (pin >= 54) pin -= 54; // A0 is 54
+#else
+  if (pin >= 14) pin -= 14; // A0 is 14
+#endif
+  return pin;
+}
+
+static inline void adcSelect(uint8_t mux)
+{
+  ADMUX = (ADMUX & 0xE0) | (mux & 0x07); // keep reference selection (REFSn) and ADLAR
+#if defined(MUX5)
+  if (mux & 0x08) ADCSRB |= _BV(MUX5);
+  else            ADCSRB &= ~_BV(MUX5);
+#endif
+}
+
+ISR(ADC_vect)
+{
+  uint8_t ch = adcCh;
+  adc_ring_t * r = &adcRing[ch];
+  uint8_t h = r->head;
+  uint16_t v = ADC;
+
+  r->value[h & ADC_RING_MASK] = v;
+  r->stamp[h & ADC_RING_MASK] = adcTick;
+  r->head = h + 1;
+  r->sum += v;
+  r->count++;
+  adcTick++;
+
+  if (++ch >= ADC_NUM_CHANNELS) ch = 0;
+  adcCh = ch;
+  adcSelect(adcMux[ch]);
+}
+
+void halAdcInit()
+{
+  uint8_t ch, i;
+  uint16_t v;
+
+  //---- prime every ring with a blocking read so consumers never see zeros
+  for (ch=0; ch<ADC_NUM_CHANNELS; ch++) {
+    adcMux[ch] = adcPinToMux(adcPins[ch]);
+    v = (uint16_t) analogRead(adcPins[ch]); // also sets the reference in ADMUX
+    for (i=0; i<ADC_RING_SIZE; i++) {
+      adcRing[ch].value[i] = v;
+      adcRing[ch].stamp[i] = 0;
+    }
+    adcRing[ch].head = ADC_RING_SIZE;
+    adcRing[ch].tail = ADC_RING_SIZE;
+    adcRing[ch].sum = 0;
+    adcRing[ch].count = 0;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    adcCh = 0;
+    adcTick = 0;
+    adcSelect(adcMux[0]);
+    ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | _BV(ADTS2); // trigger: Timer0 overflow
+    ADCSRA |= _BV(ADIF); // clear a stale flag (written as one)
+    ADCSRA |= _BV(ADATE) | _BV(ADIE);
+  }
+}
+
+uint16_t halAdcGetLast(adc_channel_t ch)
+{
+  uint16_t v;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    v = adcRing[ch].value[(uint8_t)(adcRing[ch].head - 1) & ADC_RING_MASK];
+  }
+  return v;
+}
+
+uint16_t halAdcGetAverage(adc_channel_t ch)
+{
+  adc_ring_t * r = &adcRing[ch];
+  uint32_t sum;
+  uint16_t n;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sum = r->sum;
+    n = r->count;
+    r->sum = 0;
+    r->count = 0;
+    if (n == 0) { // read again before the next conversion
+      sum = r->value[(uint8_t)(r->head - 1) & ADC_RING_MASK];
+      n = 1;
+    }
+  }
+  return (uint16_t) (sum / n);
+}
+
+uint8_t halAdcRead(adc_channel_t ch, adc_sample_t * samples, uint8_t max)
+{
+  adc_ring_t * r = &adcRing[ch];
+  uint8_t n = 0;
+  uint8_t head;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    head = r->head;
+    if ((uint8_t)(head - r->tail) > ADC_RING_SIZE) {
+      r->tail = head - ADC_RING_SIZE; // overrun: skip what was overwritten
+    }
+    while (r->tail != head && n < max) {
+      samples[n].value = r->value[r->tail & ADC_RING_MASK];
+      samples[n].stamp = r->stamp[r->tail & ADC_RING_MASK];
+      r->tail++;
+      n++;
+    }
+  }
+  return n;
+}
+
+#else
+void halAdcInit()
+{
+
+}
+#endif // ADC_SCAN
+
 //---------- Analog pressure sensor -----------
 uint16_t halGetAnalogPressure()
 {
-  return (uint16_t) analogRead(PRESSURE_SENSOR_PIN);  //Raw digital input from pressure sensor
+#ifdef ADC_SCAN_PRESSURE
+  return halAdcGetAverage(ADC_CH_PRESSURE);  //Raw digital input from pressure sensor
+#else
+  return 0;
+#endif
 }
 
 //---------- Analog pressure sensor -----------
 uint16_t halGetAnalogFlow()
 {
-  return (uint16_t) analogRead(FLOW_SENSOR_PIN);  //Raw digital input from pressure sensor
+#ifdef ADC_SCAN_FLOW
+  return halAdcGetAverage(ADC_CH_FLOW);  //Raw digital input from pressure sensor
+#else
+  return 0;
+#endif
 }
 
 
@@ -516,6 +838,7 @@ bool halSaveDataBlock(uint8_t * data, int _size)
     EEPROM.update(eeprom_addr, *data);
     eeprom_addr++, data++;
   }
+  return true; // EEPROM.update() does not fail
 }
 
 bool halRestoreDataBlock(uint8_t * data, int _size)
@@ -528,6 +851,29 @@ bool halRestoreDataBlock(uint8_t * data, int _size)
     eeprom_addr++, data++;
 
   }
+  return true;
+}
+
+
+bool halSaveBlackBox(int offset, const uint8_t * data, int size)
+{
+  int i;
+  for (i=0; i<size; i++) {
+    EEPROM.update(EEPROM_BLACKBOX_ADDRESS + offset + i, data[i]);
+#ifdef WATCHDOG_ENABLE
+    wdt_reset(); // up to 3.4 ms a byte
+#endif
+  }
+  return true;
+}
+
+bool halRestoreBlackBox(int offset, uint8_t * data, int size)
+{
+  int i;
+  for (i=0; i<size; i++) {
+    data[i] = EEPROM.read(EEPROM_BLACKBOX_ADDRESS + offset + i);
+  }
+  return true;
 }
 
 
@@ -555,14 +901,14 @@ bool keyPressed(keys_t key)
 #if (KEYS_JOYSTICK == 1)
   if (key.keyCode == KEY_DECREMENT)
   {
-    uint16_t value = analogRead(KEY_INCREMENT);
+    uint16_t value = halAdcGetLast(ADC_CH_JOYSTICK);
     // Serial.print("DECREMENT: ");
     // Serial.println(value);
     return value <= 60;
   }
   if (key.keyCode == KEY_INCREMENT)
   {
-    uint16_t value = analogRead(KEY_INCREMENT);
+    uint16_t value = halAdcGetLast(ADC_CH_JOYSTICK);
     // Serial.print("INCREMENT: ");
     // Serial.println(value);
     return value >= 800;
@@ -583,12 +929,12 @@ bool keyReleased(keys_t key)
 #if (KEYS_JOYSTICK == 1)
   if (key.keyCode == KEY_DECREMENT)
   {
-    int value = analogRead(KEY_INCREMENT);
+    int value = halAdcGetLast(ADC_CH_JOYSTICK);
     return value >= 400 && value < 600;
   }
   if (key.keyCode == KEY_INCREMENT)
   {
-    int value = analogRead(KEY_INCREMENT);
+    int value = halAdcGetLast(ADC_CH_JOYSTICK);
     return value <= 700 && value > 300;
   }
   if (key.keyCode == KEY_SET)
@@ -601,59 +947,95 @@ bool keyReleased(keys_t key)
 #endif
 }
 
-static void processKeys()
+static void processKeys() // keysTask, every TM_KEY_SAMPLING
 {
     int i;
-    if ( halCheckTimerExpired(tm_key_sampling, TM_KEY_SAMPLING)) {
-        tm_key_sampling = halStartTimerRef();
-      for (i=0; i<3; i++) {
-        if (keys[i].state == 0) {
-          // ------- key is release state -------
-          if (keyPressed(keys[i])) { // if key is pressed
-            keys[i].count++;
-            if (keys[i].count >= DEBOUNCING_N) {
-              Serial.print("Pressed: ");
-              Serial.println(keys[i].keyCode);
-              //declare key pressed
-              keys[i].count = 0;
-              keys[i].state = 1;
-              CEvent::post(EVT_KEY_PRESS, keys[i].keyCode);
-            }
-
-          }
-          else {
-              keys[i].count = 0;
+    PROF_BEGIN(PROF_KEYS);
+    for (i=0; i<3; i++) {
+      if (keys[i].state == 0) {
+        // ------- key is release state -------
+        if (keyPressed(keys[i])) { // if key is pressed
+          keys[i].count++;
+          if (keys[i].count >= DEBOUNCING_N) {
+#ifdef DEBUG_SERIAL_LOGS
+            Serial.print("Pressed: ");
+            Serial.println(keys[i].keyCode);
+#endif
+            //declare key pressed
+            keys[i].count = 0;
+            keys[i].state = 1;
+            CEvent::post(EVT_KEY_PRESS, keys[i].keyCode);
           }
+
         }
         else {
-          // ------- key is pressed state -------
-           if (keyReleased(keys[i])) { // if key is release
-            keys[i].count++;
-            if (keys[i].count >= DEBOUNCING_N) {
-              Serial.print("Released: ");
-              Serial.println(keys[i].keyCode);
-              //declare key released
-              keys[i].count = 0;
-              keys[i].state = 0;
-              CEvent::post(EVT_KEY_RELEASE, keys[i].keyCode);
-            }
+            keys[i].count = 0;
+        }
+      }
+      else {
+        // ------- key is pressed state -------
+         if (keyReleased(keys[i])) { // if key is release
+          keys[i].count++;
+          if (keys[i].count >= DEBOUNCING_N) {
+#ifdef DEBUG_SERIAL_LOGS
+            Serial.print("Released: ");
+            Serial.println(keys[i].keyCode);
+#endif
+            //declare key released
+            keys[i].count = 0;
+            keys[i].state = 0;
+            CEvent::post(EVT_KEY_RELEASE, keys[i].keyCode);
           }
-          else {
-              keys[i].count = 0;
-          }       
         }
+        else {
+            keys[i].count = 0;
+        }       
       }
-        
     }
+
+    PROF_END(PROF_KEYS);
+}
+
+#ifdef SERIAL_COMMANDS
+// Answers go out on the Serial port. On a single UART board they share it with
+// the telemetry frames, but never split one: frames are only queued whole from
+// the main loop, which waits here until the answer is written.
+static void processSerialCommands()
+{
+  if (Serial.available() == 0) return;
+  int c = Serial.read();
+  if (c == 'b') bboxDump(false);
+  else if (c == 'w') bboxDump(true);
+#ifdef LOOP_PROFILE
+  if (c == 'p') profReport();
+  else if (c == 'r') profReset();
+#endif
+#ifdef SENSOR_TRACE
+  if (c == 't') {
+    if (traceIsActive()) traceStop();
+    else traceStart();
+  }
+#endif
 }
+#endif
+
+#ifdef LOOP_PROFILE
+uint32_t halProfileMicros()
+{
+  return micros();
+}
+#endif
 
+// LED, keys, alarm sound and props saving are scheduled tasks (sched.h)
 void halLoop()
 {
-  halBlinkLED();
-  processKeys();
-  propLoop();
+  PROF_BEGIN(PROF_PRESS);
   pressLoop();
-  alarmToggler();
+  PROF_END(PROF_PRESS);
+
+#ifdef SERIAL_COMMANDS
+  processSerialCommands();
+#endif
 
 #ifdef WATCHDOG_ENABLE
   loopWdt();
@@ -665,11 +1047,21 @@ void halLoop()
   
   
 #ifndef LCD_CFG_I2C
+  PROF_BEGIN(PROF_LCD);
   lcd.stepRefresh();
+  PROF_END(PROF_LCD);
 #endif
 
 }
 
+#ifdef SCHED_IDLE_SLEEP
+void halIdle()
+{
+  set_sleep_mode(SLEEP_MODE_IDLE); // timers, UART, TWI and ADC keep running
+  sleep_mode();
+}
+#endif
+
 void halWriteSerial(char * s)
 {
 #ifndef VENTSIM
@@ -677,6 +1069,89 @@ void halWriteSerial(char * s)
 #endif
 }
 
+//-------------------------------------------------------
+//-------  Telemetry TX: ring buffer drained by the UART data-register-empty ISR
+//-------------------------------------------------------
+#ifdef TELEMETRY_UART1
+
+#define TX_RING_MASK (TELEMETRY_TX_RING_SIZE - 1)
+#if (TELEMETRY_TX_RING_SIZE & TX_RING_MASK) || (TELEMETRY_TX_RING_SIZE > 256)
+  #error "TELEMETRY_TX_RING_SIZE must be a power of 2 up to 256"
+#endif
+
+// single producer (main loop) / single consumer (ISR): each index is written by one side only
+static uint8_t          txRing[TELEMETRY_TX_RING_SIZE];
+static volatile uint8_t txHead; // written by main loop
+static volatile uint8_t txTail; // written by ISR
+
+ISR(USART1_UDRE_vect)
+{
+  uint8_t t = txTail;
+  if (t == txHead) {
+    UCSR1B &= ~_BV(UDRIE1); // nothing left: stop the interrupt
+    return;
+  }
+  UDR1 = txRing[t];
+  txTail = (t + 1) & TX_RING_MASK;
+}
+
+void halTelemetryInit(uint32_t baud)
+{
+  uint16_t ubrr = (uint16_t) ((F_CPU / 8 / baud) - 1) / 2; // U2X off, rounded
+  txHead = 0;
+  txTail = 0;
+  UBRR1H = ubrr >> 8;
+  UBRR1L = ubrr & 0xff;
+  UCSR1A = 0;
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10); // 8N1
+  UCSR1B = _BV(TXEN1);
+}
+
+bool halTelemetryWrite(const uint8_t * data, uint8_t len)
+{
+  uint8_t h = txHead;
+  uint8_t used = (h - txTail) & TX_RING_MASK;
+  uint8_t i;
+
+  if (len > (TX_RING_MASK - used)) // one slot kept empty to tell full from empty
+    return false;
+
+  for (i=0; i<len; i++) {
+    txRing[h] = data[i];
+    h = (h + 1) & TX_RING_MASK;
+  }
+  txHead = h;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    UCSR1B |= _BV(UDRIE1);
+  }
+  return true;
+}
+
+#else // single UART MCU: the Serial port, HardwareSerial already has an ISR drained TX ring
+
+// Frames and log text cannot share the wire: with TELEMETRY_ENABLE config.h turns
+// DEBUG_SERIAL_LOGS off, without it the port is the logs' and nothing is sent.
+void halTelemetryInit(uint32_t baud)
+{
+#ifdef TELEMETRY_ENABLE
+  Serial.begin(baud);
+#endif
+}
+
+bool halTelemetryWrite(const uint8_t * data, uint8_t len)
+{
+#ifdef TELEMETRY_ENABLE
+  if (Serial.availableForWrite() < len)
+    return false;
+  Serial.write(data, len);
+  return true;
+#else
+  return false;
+#endif
+}
+#endif
+
 
 
  
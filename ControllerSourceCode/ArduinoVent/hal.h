@@ -25,8 +25,10 @@
 #include "config.h"
 
 #ifdef VENTSIM
-  #include <QPlainTextEdit>
-  #include <QLabel>
+  #ifndef VENTHOST
+    #include <QPlainTextEdit>
+    #include <QLabel>
+  #endif
   #define PROGMEM /**/
   #define F /**/
 #else
@@ -52,7 +54,7 @@ typedef enum {
   MONITOR_LED_SLOW,
 } MONITOR_LET_T;
 
-#ifdef VENTSIM
+#if defined(VENTSIM) && !defined(VENTHOST)
   void halInit(QPlainTextEdit * ed,
                QLabel * input_valve_on,
                QLabel * input_valve_off,
@@ -65,7 +67,8 @@ typedef enum {
 void halSetMonitorLED (MONITOR_LET_T speed);
 MONITOR_LET_T halGetMonitorLED ();
 
-uint64_t halStartTimerRef(); // milliseconds reference
+uint64_t halStartTimerRef(); // milliseconds reference. Sampled once per main loop pass once the scheduler runs
+void halLatchTimerRef();     // called by schedRun() at the top of each pass
 bool halCheckTimerExpired(uint64_t timerRef, uint64_t lapseTime); // lapseTime in milliseconds
 
 #ifdef ENABLE_MICROSEC_TIMER
@@ -75,7 +78,18 @@ bool halCheckTimerExpired(uint64_t timerRef, uint64_t lapseTime); // lapseTime i
 
 void halWriteSerial(char * s);
 
+//--------- telemetry port: never blocks ---------
+void halTelemetryInit(uint32_t baud);
+bool halTelemetryWrite(const uint8_t * data, uint8_t len); // all or nothing: false if the TX ring has no room
+
+#ifdef LOOP_PROFILE
+  uint32_t halProfileMicros(); // free running microseconds for profiler.cpp (wraps)
+#endif
+
 void halLoop();
+#ifdef SCHED_IDLE_SLEEP
+  void halIdle(); // sleep until the next interrupt
+#endif
 void halBlinkLED();
 void halLcdClear();
 void halLcdSetCursor(int col, int row);
@@ -87,19 +101,108 @@ void halValveInClose();
 void halValveOutOpen();
 void halValveOutClose();
 
-void halBeepAlarmOnOff( bool on);
+#define HAL_VALVE_IN_OPEN   0x01
+#define HAL_VALVE_OUT_OPEN  0x02
+uint8_t halGetValveState(); // HAL_VALVE_xxx bits, as last commanded
+
+// alarm sound: IEC 60601-1-8 burst pattern of an alarm priority, repeated until changed
+typedef enum : uint8_t {
+    HAL_TONE_HIGH,      // same order as alarm_prio_t (alarm.h)
+    HAL_TONE_MEDIUM,
+    HAL_TONE_LOW,
+    HAL_TONE_OFF,
+} hal_tone_t;
+
+void halAlarmTone(hal_tone_t tone); // a new pattern starts from its first pulse, the same one keeps playing
 
 uint16_t halGetAnalogPressure();
 uint16_t halGetAnalogFlow();
 
+#ifndef VENTSIM
+//--------- ADC scan engine: conversions are triggered by Timer0 overflow, never by the main loop ---------
+#if (USE_Mpxv7002DP_PRESSURE_SENSOR == 1)
+  #define ADC_SCAN_PRESSURE
+#endif
+#if (USE_Mpxv7002DP_FLOW_SENSOR == 1) || defined(USE_CAR_FLOW_SENSOR)
+  #define ADC_SCAN_FLOW
+#endif
+#if (KEYS_JOYSTICK == 1)
+  #define ADC_SCAN_JOYSTICK
+#endif
+#if defined(ADC_SCAN_PRESSURE) || defined(ADC_SCAN_FLOW) || defined(ADC_SCAN_JOYSTICK)
+  #define ADC_SCAN              // any channel: #if cannot see ADC_NUM_CHANNELS, it is an enum
+#endif
+
+typedef enum {
+#ifdef ADC_SCAN_PRESSURE
+  ADC_CH_PRESSURE,      // PRESSURE_SENSOR_PIN
+#endif
+#ifdef ADC_SCAN_FLOW
+  ADC_CH_FLOW,          // FLOW_SENSOR_PIN
+#endif
+#ifdef ADC_SCAN_JOYSTICK
+  ADC_CH_JOYSTICK,      // KEY_INCREMENT_PIN, joystick axis
+#endif
+
+  ADC_NUM_CHANNELS // must be the last one
+} adc_channel_t;
+
+#define ADC_RING_SIZE       4       // samples per channel kept for halAdcRead(), power of 2
+#define ADC_TICK_US         (64UL * 256UL * 1000000UL / F_CPU) // Timer0 overflow period: 1024 us at 16 MHz
+                                    // each channel is sampled every ADC_NUM_CHANNELS ticks
+
+typedef struct {
+  uint16_t value;
+  uint16_t stamp;       // conversion counter, in ADC_TICK_US units (wraps)
+} adc_sample_t;
+
+void     halAdcInit();
+uint16_t halAdcGetLast(adc_channel_t ch);
+uint16_t halAdcGetAverage(adc_channel_t ch); // mean of every sample since the previous call,
+                                             // the last sample if there is no new one
+uint8_t  halAdcRead(adc_channel_t ch, adc_sample_t * samples, uint8_t max); // unread samples, oldest first.
+                                    // returns how many were copied. If the reader falls behind the oldest are lost
+#endif
+
 //uint8_t EEPROM_read(int addr);
 //void EEPROM_write(uint8_t val, int addr);
 
 bool halSaveDataBlock(uint8_t * data, int size);
 bool halRestoreDataBlock(uint8_t * data, int size);
+bool halSaveBlackBox(int offset, const uint8_t * data, int size); // black box snapshot (blackbox.h), apart from the props
+bool halRestoreBlackBox(int offset, uint8_t * data, int size);
 
 void halMotorStep(bool on);
 void halMotorDir(bool dir);
-bool halMotorEOC();
+bool halMotorEOC();     // true while the End Of Course switch is pressed
+
+//--------- stepper pulse train, generated by the Timer1 compare match ISR ---------
+// ramp[k] is the interval in microseconds before step k while accelerating; the same
+// intervals are used backwards to decelerate. Steps in between use cruise.
+// ramp must stay valid until the move is over. Intervals are clamped by halMotorCompare().
+void     halMotorRun(uint16_t steps, const uint16_t * ramp, uint8_t rampLen, uint16_t cruise);
+void     halMotorStop();
+bool     halMotorIsRunning();
+uint16_t halMotorGetPosition(); // steps issued since halMotorRun()
+
+#ifdef F_CPU
+  #define HAL_MOTOR_TICKS_PER_US  (F_CPU / 8000000UL) // Timer1, prescaler 8
+#else
+  #define HAL_MOTOR_TICKS_PER_US  2       // host build: a 16 MHz board
+#endif
+#define HAL_MOTOR_PULSE_US          2       // STEP high time: DRV8825 1.9 us minimum, A4988 1 us
+#define HAL_MOTOR_MIN_INTERVAL_US   20      // the ISR with the pulse in it, then STEP low as long again
+
+// OCR1A value for an interval in microseconds. Timer1 counts 16 bits: 32768 us at most at
+// 16 MHz, longer intervals get that one rather than wrapping to a short one
+static inline uint16_t halMotorCompare(uint16_t us)
+{
+  uint32_t ticks;
+
+  if (us < HAL_MOTOR_MIN_INTERVAL_US) us = HAL_MOTOR_MIN_INTERVAL_US;
+  ticks = (uint32_t) us * HAL_MOTOR_TICKS_PER_US;
+  if (ticks > 0x10000UL) ticks = 0x10000UL;
+  return (uint16_t) (ticks - 1);
+}
 
 #endif // HAL_H
@@ -0,0 +1,179 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "hplimit.h"
+#include "config.h"
+#include "log.h"
+#include "pressure.h"
+#include "sched.h"
+#include "properties.h"
+
+#define HPL_SAMPLES     8       // slope window, 70 ms at BMP280_READ_PERIOD: about two PCV PWM periods
+#define HPL_CONFIRM     2       // consecutive projections over the limit, a valve step is not a trend
+#define HPL_FILTER_TAU  40.0f   // ms, the PCV filter: one PWM period, the ripple is not a trend
+#define HPL_MAX_DT      50      // ms, a longer gap between samples restarts the filter
+#define HPL_MARGIN      2.0f    // cmH2O, further below the limit a projection does not count
+#define HPL_VAL_SCALE   100.0f  // window values in 0.01 cmH2O
+
+static float    limit;
+static uint16_t horizon;
+static int16_t  horizonSet = -1; // hplSetHorizon(), -1 = the inlet closing latency
+static press_sample_t sample;
+static int16_t  val[HPL_SAMPLES];    // filtered pressure, HPL_VAL_SCALE
+static uint16_t stamp[HPL_SAMPLES];  // low bits of the ms stamps: the window is far shorter than 65 s
+static uint8_t  count;
+static uint8_t  head;
+static uint32_t tmStart;
+static uint8_t  ahead;      // consecutive projections over the limit
+static float    filtered;
+static uint32_t lastStamp;
+
+static uint8_t  trip;
+static uint32_t tripTm;
+static float    tripPressure;
+static float    tripSlope;
+static float    tripProjection;
+static float    peak;
+static uint16_t trips[3];
+
+// least squares slope of the window, cmH2O/s
+static float slope()
+{
+  float tm = 0.0f, pm = 0.0f, num = 0.0f, den = 0.0f, t;
+  uint16_t t0 = stamp[head];
+  uint8_t i;
+
+  for (i = 0; i < HPL_SAMPLES; i++) {
+    tm += (float) (uint16_t) (stamp[i] - t0);
+    pm += val[i];
+  }
+  tm /= HPL_SAMPLES;
+  pm /= HPL_SAMPLES;
+  for (i = 0; i < HPL_SAMPLES; i++) {
+    t = (float) (uint16_t) (stamp[i] - t0) - tm;
+    num += t * (val[i] - pm);
+    den += t * t;
+  }
+  if (den <= 0.0f) return 0.0f;
+  return num / den * (1000.0f / HPL_VAL_SCALE);
+}
+
+static void setTrip(uint8_t type, float pressure)
+{
+  trip = type;
+  tripTm = schedNow() - tmStart;
+  tripPressure = pressure;
+  if (trips[type] < 0xffff) trips[type]++;
+}
+
+void hplStart(int lim)
+{
+  limit = (float) lim;
+  count = 0;
+  head = 0;
+  ahead = 0;
+  trip = HPL_NONE;
+  peak = 0.0f;
+  tmStart = schedNow();
+  pressGetFastSample(&sample); // consume what is already there: it predates this breath
+  if (horizonSet >= 0)
+    horizon = (uint16_t) horizonSet;
+  else if (propGetInCloseLatency())
+    horizon = (uint16_t) propGetInCloseLatency(); // measured by valvecal.h
+  else
+    horizon = VALVE_CLOSE_LATENCY;
+}
+
+bool hplLoop(float pressure)
+{
+  float s, p;
+  uint32_t ms;
+
+  if (pressure > peak) peak = pressure;
+  if (pressGetFastSample(&sample)) {
+    if (sample.value > peak) peak = sample.value;
+    ms = sample.stamp - lastStamp;
+    if (count && ms <= HPL_MAX_DT)
+      filtered += (sample.value - filtered) * ms / (HPL_FILTER_TAU + ms);
+    else
+      filtered = sample.value;
+    lastStamp = sample.stamp;
+    val[head] = (int16_t) (filtered * HPL_VAL_SCALE);
+    stamp[head] = (uint16_t) sample.stamp;
+    head = (head + 1) % HPL_SAMPLES; // now the oldest
+    if (count < HPL_SAMPLES) count++;
+
+    if (trip == HPL_NONE && horizon && count == HPL_SAMPLES) {
+      s = slope();
+      // on a ramp the filter lags the pressure by its time constant: project over it as well
+      p = filtered + s * (HPL_FILTER_TAU + horizon + (schedNow() - sample.stamp)) / 1000.0f;
+      if (s > 0.0f && p >= limit && filtered >= limit - HPL_MARGIN) {
+        if (++ahead >= HPL_CONFIRM) {
+          setTrip(HPL_PREDICTED, filtered);
+          tripSlope = s;
+          tripProjection = p;
+        }
+      }
+      else {
+        ahead = 0;
+      }
+    }
+  }
+  if (trip == HPL_NONE && pressure > limit) {
+    setTrip(HPL_LATE, pressure);
+  }
+  return trip != HPL_NONE;
+}
+
+void hplEndBreath()
+{
+  if (trip == HPL_PREDICTED) {
+    LOGV("HP pred %ums p%d dp%d/s proj%d peak%d lim%d", (unsigned) tripTm, (int) (tripPressure * 10),
+         (int) (tripSlope * 10), (int) (tripProjection * 10), (int) (peak * 10), (int) (limit * 10));
+  }
+  else if (trip == HPL_LATE) {
+    LOGV("HP late %ums p%d peak%d lim%d", (unsigned) tripTm, (int) (tripPressure * 10),
+         (int) (peak * 10), (int) (limit * 10));
+  }
+}
+
+void hplSetHorizon(uint16_t ms)
+{
+  horizonSet = (int16_t) ms;
+}
+
+uint8_t hplGetTrip()
+{
+  return trip;
+}
+
+float hplGetPeak()
+{
+  return peak;
+}
+
+uint16_t hplGetTrips(uint8_t type)
+{
+  if (type > HPL_LATE) return 0;
+  return trips[type];
+}
@@ -0,0 +1,63 @@
+#ifndef HPLIMIT_H
+#define HPLIMIT_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file hplimit.h
+ * @brief Predictive high pressure limit.
+ *
+ * Acting when the pressure is already over the limit lets the patient see
+ * the sample period plus the valve latency of overshoot. Instead, the slope
+ * of the last few pressure conversions (least squares on their time stamps)
+ * projects the pressure one valve latency ahead, plus the age of the newest
+ * sample, and the breath is cut when the projection reaches the limit. The
+ * plain "over the limit" check stays as the backstop.
+ *
+ * The conversions go through the same low pass as the PCV loop first, and
+ * the projection also covers the filter lag. A projection only counts within
+ * HPL_MARGIN of the limit: the PCV PWM ripple is a few hundred cmH2O/s
+ * during the hold and must not cut a breath that stays under the limit.
+ *
+ * Each trip is logged when the breath ends, together with the peak that
+ * followed, so the horizon can be tuned from replayed sensor traces:
+ *
+ *   HP pred 412ms p138 dp52/s proj152 peak149 lim150    (pressures in 0.1 cmH2O)
+ *   HP late 530ms p151 peak153 lim150                   (crossed, not predicted)
+ */
+
+#include <stdint.h>
+
+#define HPL_NONE        0
+#define HPL_PREDICTED   1
+#define HPL_LATE        2
+
+void     hplStart(int limit);           // inspiration begins, limit in cmH2O
+bool     hplLoop(float pressure);       // every pass while inspiring: true from the trip on
+void     hplEndBreath();                // expiration begins: logs the trip, if any
+void     hplSetHorizon(uint16_t ms);    // projection horizon override, 0 = no prediction. Default: the calibrated
+                                        // inlet closing latency, VALVE_CLOSE_LATENCY when not calibrated
+
+uint8_t  hplGetTrip();                  // HPL_xxx of the last breath
+float    hplGetPeak();                  // cmH2O, peak of the last breath
+uint16_t hplGetTrips(uint8_t type);     // HPL_PREDICTED or HPL_LATE trips since boot
+
+#endif // HPLIMIT_H
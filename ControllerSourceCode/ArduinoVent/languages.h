@@ -52,7 +52,30 @@
 #define     STR_LOW_TIDAL               "Low  Tidal"
 #define     STR_HIGH_TIDAL              "High Tidal"
 #define     STR_CALIB_PRESSURES         "Cal. Press"
+#define     STR_CALIB_VALVES            "Cal. Valve"        // max 10
 #define     STR_PEEP                    "PEEP"
+#define     STR_MODE                    "Mode"              // max 10
+#define     STR_INSP_PRESSURE           "Insp Press"        // max 10
+#define     STR_RISE_TIME               "Rise (ms)"         // max 10
+#define     STR_VOLUME_TARGET           "Vol Target"        // max 10
+#define     STR_VOLUME_OVERSHOOT        "Vt Over"           // max 10
+#define     STR_TRIG_PRESSURE           "Trig Press"        // max 10
+#define     STR_TRIG_FLOW               "Trig Flow"         // max 10
+#define     STR_INSP_HOLD               "Hold (ms)"         // max 10
+#define     STR_PIP                     "PIP"               // max 10
+#define     STR_PLATEAU                 "Plateau"           // max 10
+#define     STR_PEEP_MEASURED           "PEEP meas."        // max 10
+#define     STR_MINUTE_VOLUME           "Min. Vol."         // max 10
+#define     STR_IE_RATIO                "I:E"               // max 10
+#define     STR_COMPLIANCE              "Cstat"             // max 10
+#define     STR_RESISTANCE              "Raw"               // max 10
+#define     STR_APNEA_TIME              "Apnea (s)"         // max 10
+#define     STR_BACKUP_BPM              "Backup BPM"        // max 10
+#define     STR_LEAK                    "Leak %"            // max 10
+
+#define     STR_MODE_TIMED              "timed"             // must be 5 characters
+#define     STR_MODE_PC                 "   PC"             // must be 5 characters
+#define     STR_MODE_VC                 "   VC"             // must be 5 characters
 
 #define     STR_ALARM_LOW_PRESSURE      "LOW AIRWAY PRES!"      // max 16
 #define     STR_ALARM_HIGH_PRESSURE     "OVER PRES ALARM!"      // max 16
@@ -62,6 +85,12 @@
 #define  STR_ALARM_FAST_CALIB_TO_START  "STARTING CALIB. "
 #define  STR_ALARM_FAST_CALIB_DONE      " CALIB. ENDDED  "
 #define     STR_ALARM_BAD_PRESS_SENSOR  "PRESS SENSOR ERR"      // max 16
+#define  STR_ALARM_VALVE_CALIB_TO_START "VALVE CAL. START"      // max 16
+#define  STR_ALARM_VALVE_CALIB_DONE     "VALVE CAL. DONE "      // max 16
+#define  STR_ALARM_VALVE_CALIB_FAIL     "VALVE CAL. FAIL!"      // max 16
+#define     STR_ALARM_MOTOR_EOC         "MOTOR HOME ERR! "      // max 16
+#define     STR_ALARM_APNEA             "APNEA! BACKUP ON"      // max 16
+#define     STR_ALARM_HIGH_LEAK         "HIGH LEAK!      "      // max 16
 
 #elif (LANGUAGE_PT_BR == 1)
 /************************************************
@@ -93,13 +122,42 @@
 #define     STR_LOW_TIDAL               "Low  Tidal"
 #define     STR_HIGH_TIDAL              "High Tidal"
 #define     STR_CALIB_PRESSURES         "Cal. Press"
+#define     STR_CALIB_VALVES            "Cal. Valv."        // max 10
 #define     STR_PEEP                     "PEEP"
+#define     STR_MODE                    "Modo"              // max 10
+#define     STR_INSP_PRESSURE           "Pres. Insp"        // max 10
+#define     STR_RISE_TIME               "Subida ms"         // max 10
+#define     STR_VOLUME_TARGET           "Vol. Alvo"         // max 10
+#define     STR_VOLUME_OVERSHOOT        "Vt Excesso"        // max 10
+#define     STR_TRIG_PRESSURE           "Disp. Pres"        // max 10
+#define     STR_TRIG_FLOW               "Disp. Flux"        // max 10
+#define     STR_INSP_HOLD               "Pausa Insp"        // max 10
+#define     STR_PIP                     "PIP"               // max 10
+#define     STR_PLATEAU                 "Plato"             // max 10
+#define     STR_PEEP_MEASURED           "PEEP med."         // max 10
+#define     STR_MINUTE_VOLUME           "Vol. Min."         // max 10
+#define     STR_IE_RATIO                "I:E"               // max 10
+#define     STR_COMPLIANCE              "Cest"              // max 10
+#define     STR_RESISTANCE              "Rva"               // max 10
+#define     STR_APNEA_TIME              "Apneia (s)"        // max 10
+#define     STR_BACKUP_BPM              "BPM Reserv"        // max 10
+#define     STR_LEAK                    "Vazam. %"          // max 10
+
+#define     STR_MODE_TIMED              "tempo"             // must be 5 characters
+#define     STR_MODE_PC                 "   PC"             // must be 5 characters
+#define     STR_MODE_VC                 "   VC"             // must be 5 characters
 
 #define     STR_ALARM_LOW_PRESSURE      " BAIXA PRESSAO! "      // max 16
 #define     STR_ALARM_HIGH_PRESSURE     " ALTA PRESSAO! "      // max 16
 #define     STR_ALARM_LOW_TIDAL         " BAIXA VOLUME!"      // max 16
 #define     STR_ALARM_HIGH_TIDAL        " ALTA VOL!"      // max 16
 #define     STR_ALARM_UNDER_SPEED       "MOT. BAIXA VEL.!"      // max 16
+#define  STR_ALARM_VALVE_CALIB_TO_START "CAL. VALV. INIC."      // max 16
+#define  STR_ALARM_VALVE_CALIB_DONE     "CAL. VALV. FIM  "      // max 16
+#define  STR_ALARM_VALVE_CALIB_FAIL     "CAL. VALV. ERRO!"      // max 16
+#define     STR_ALARM_MOTOR_EOC         "MOTOR ORIG. ERRO"      // max 16
+#define     STR_ALARM_APNEA             "APNEIA! RESERVA "      // max 16
+#define     STR_ALARM_HIGH_LEAK         "VAZAMENTO ALTO! "      // max 16
 
 #else
   #error "One Language must be set to 1 in config.h"
@@ -0,0 +1,177 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "leak.h"
+#include "config.h"
+#include "pressure.h"
+#include "sched.h"
+
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1)
+
+typedef enum {
+  LEAK_IDLE,
+  LEAK_IN,
+  LEAK_HOLD,
+  LEAK_OUT
+} leak_phase_t;
+
+static leak_phase_t phase = LEAK_IDLE;
+static press_sample_t sample;
+static uint32_t lastStamp;
+static uint32_t tmStart;
+static float    ptIn;           // cmH2O.ms, pressure-time product of the inspiratory flow
+static float    ptOut;          // and of the rest: hold, expiration and pause
+static float    vIn;            // mL inspired
+static float    k;              // mL per cmH2O.ms, averaged
+static bool     kValid;
+
+static float    tidal;
+static float    leaked;
+static float    flow;
+static uint8_t  percent;
+
+static void integrate()
+{
+  if (pressGetFastSample(&sample) == false) return;
+  int32_t dt = (int32_t) (sample.stamp - lastStamp);
+  float p = sample.value > 0.0f ? sample.value : 0.0f; // nothing leaks in below ambient
+  if (dt <= 0) return; // converted before the phase began
+  lastStamp = sample.stamp;
+  if (phase == LEAK_IN)
+    ptIn += p * dt;
+  else
+    ptOut += p * dt;
+}
+
+void leakStartBreath()
+{
+  uint32_t now = schedNow();
+
+  if (phase == LEAK_OUT) {
+    integrate();
+    float pt = ptIn + ptOut;
+    float vOut = pressGetExpVolume();
+    if (vOut * 100.0f < vIn * LEAK_MIN_EXP_PERCENT) {
+      // the sensor did not see the expiration: no estimate, Vt uncompensated
+      kValid = false;
+      leaked = 0.0f;
+      flow = 0.0f;
+      percent = 0;
+    }
+    else if (pt > 0.0f) {
+      float kb = (vIn - vOut) / pt;
+      if (kb < 0.0f) kb = 0.0f; // sensor offset or air trapping, not a leak
+      if (kValid) {
+        k += (kb - k) / LEAK_AVG_BREATHS;
+      }
+      else {
+        k = kb;
+        kValid = true;
+      }
+      leaked = k * pt;
+      flow = now != tmStart ? leaked * 60.0f / (float) (now - tmStart) : 0.0f; // mL/ms to L/min
+      float pc = vIn > 0.0f ? leaked * 100.0f / vIn : 0.0f;
+      percent = pc > 100.0f ? 100 : (uint8_t) pc;
+    }
+  }
+  else {
+    pressGetFastSample(&sample); // consume what is already there: it predates this breath
+  }
+  lastStamp = now;
+  tmStart = now;
+  ptIn = 0.0f;
+  ptOut = 0.0f;
+  phase = LEAK_IN;
+}
+
+void leakLoop()
+{
+  if (phase == LEAK_IDLE) return;
+  integrate();
+}
+
+void leakEndInspiration()
+{
+  if (phase != LEAK_IN) return;
+  integrate();
+  phase = LEAK_HOLD;
+}
+
+void leakStartExpiration()
+{
+  if (phase != LEAK_HOLD) return;
+  integrate();
+  vIn = pressGetVolume();
+  tidal = vIn - (kValid ? k * ptIn : 0.0f);
+  if (tidal < 0.0f) tidal = 0.0f;
+  pressVolumeExpStart();
+  phase = LEAK_OUT;
+}
+
+void leakStop()
+{
+  phase = LEAK_IDLE;
+  kValid = false;
+}
+
+float leakGetTidalVolume()
+{
+  return tidal;
+}
+
+float leakGetVolume()
+{
+  return leaked;
+}
+
+float leakGetFlow()
+{
+  return flow;
+}
+
+uint8_t leakGetPercent()
+{
+  return percent;
+}
+
+#else
+
+// inlet only flow sensor: the inspired volume is all there is
+static float    tidal;
+
+void leakStartBreath() {}
+void leakLoop() {}
+void leakEndInspiration() {}
+void leakStartExpiration()
+{
+  tidal = pressGetVolume();
+  pressVolumeExpStart();
+}
+void leakStop() {}
+
+float leakGetTidalVolume() { return tidal; }
+float leakGetVolume() { return 0.0f; }
+float leakGetFlow() { return 0.0f; }
+uint8_t leakGetPercent() { return 0; }
+
+#endif // FLOW_SENSOR_BIDIRECTIONAL
@@ -0,0 +1,67 @@
+#ifndef LEAK_H
+#define LEAK_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file leak.h
+ * @brief Circuit leak estimate and leak compensated tidal volume.
+ *
+ * The flow sensor sits on the machine side of the leak: what it integrates
+ * over the inspiration (pressure.h, pressVolumeStart()) is the tidal volume
+ * plus what leaked meanwhile, and over the expiration and pause
+ * (pressVolumeExpStart()) the tidal volume minus what leaked meanwhile.
+ * Breath after breath the lung comes back to the same volume, so the
+ * difference is the leak of the whole breath.
+ *
+ * The leak flow follows the airway pressure, so it is split between the two
+ * phases in proportion to their pressure-time products, integrated on the
+ * pressure conversions. With the valves closed (hold, pause) the leak drains
+ * the lung rather than passing the sensor: it counts on the expiration side. The leak conductance (mL per cmH2O.ms) is averaged
+ * over LEAK_AVG_BREATHS breaths, and the tidal volume of a breath is its
+ * inspired volume less the conductance times its inspiratory pressure-time
+ * product. That is known when the expiration starts, so the volume alarms
+ * check the compensated value.
+ *
+ * All of that needs a flow sensor that also reads the expired flow
+ * (FLOW_SENSOR_BIDIRECTIONAL in config.h). Without one, or when a breath
+ * expired less than LEAK_MIN_EXP_PERCENT of its inspired volume (sensor not
+ * seeing the expiration), there is no estimate: the leak reads 0 and the
+ * tidal volume is the inspired volume, uncompensated.
+ */
+
+#include <stdint.h>
+
+#define LEAK_AVG_BREATHS     4
+#define LEAK_MIN_EXP_PERCENT 10     // of the inspired volume, less expired is no expiratory flow seen
+
+void     leakStartBreath();         // inspiration begins: the breath that ended updates the estimate
+void     leakLoop();                // every breather pass while ventilating
+void     leakEndInspiration();      // inlet valve told to close
+void     leakStartExpiration();     // exhale valve opens, inspired volume final: compensated tidal volume
+void     leakStop();                // ventilation stopped: the estimate starts over
+
+float    leakGetTidalVolume();      // mL, last breath, leak compensated
+float    leakGetVolume();           // mL leaked over the last breath
+float    leakGetFlow();             // L/min, average over the last breath
+uint8_t  leakGetPercent();          // leaked over inspired volume, last breath
+
+#endif // LEAK_H
@@ -24,7 +24,9 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-#ifdef VENTSIM
+#ifdef VENTHOST
+  static bool quiet = false;
+#elif defined(VENTSIM)
   #include <QDebug>
   #include <QElapsedTimer>
 #else
@@ -35,6 +37,9 @@
 static char buf[V_BUF_SIZE];
 
 void logv(const char *fmt, ...) {
+#ifdef VENTHOST
+    if (quiet) return;
+#endif
     int len;
     va_list args;
     va_start(args, fmt);
@@ -46,14 +51,25 @@ void logv(const char *fmt, ...) {
         buf[V_BUF_SIZE - 3] = '.';
         buf[V_BUF_SIZE - 4] = '.';
     }
-#ifdef VENTSIM
+#ifdef VENTHOST
+    fprintf(stderr, "%s\n", buf);
+#elif defined(VENTSIM)
     qDebug() << buf;
 #else
     Serial.println(buf);
 #endif
 }
 
-#ifdef VENTSIM
+#ifdef VENTHOST
+void LOG(const char * s) {
+    if (quiet) return;
+    fprintf(stderr, "%s\n", s);
+}
+
+void logSetQuiet(bool q) {
+    quiet = q;
+}
+#elif defined(VENTSIM)
 void LOG(const char * s) {
     qDebug() << QString(s);
 }
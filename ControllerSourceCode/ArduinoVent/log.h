@@ -38,6 +38,9 @@ void logv(const char *fmt, ...);
 #else
   void LOG(const char * txt); // goes to flash memory in Arduino
   #define LOGV(...) logv(__VA_ARGS__)      // char * comes from a variable
+  #ifdef VENTHOST
+    void logSetQuiet(bool quiet); // host harness: drop logs during long runs
+  #endif
 #endif
 
 #endif // LOG_H
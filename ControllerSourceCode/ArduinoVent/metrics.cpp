@@ -0,0 +1,194 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "metrics.h"
+#include "config.h"
+#include "pressure.h"
+#include "sched.h"
+#include "leak.h"
+
+#define MET_MIN_FLOW        10.0f   // L/min, under it the end inspiratory flow is too small to divide by
+#define MET_MIN_DRIVING     1.0f    // cmH2O, plateau - PEEP under it gives no compliance
+#define MET_MIN_PLATEAU_N   2       // conversions in the plateau window
+#define MET_MV_WINDOW       60000.0f // ms, minute volume averaging
+
+typedef enum {
+  MET_IDLE,
+  MET_IN,
+  MET_HOLD,
+  MET_OUT
+} met_phase_t;
+
+static met_phase_t phase = MET_IDLE;
+static press_sample_t psample;
+static press_sample_t fsample;
+static uint32_t tmStart;        // breath start
+static uint32_t tmHold;         // plateau window start
+static uint32_t tmOut;          // expiration start
+static float    peak;
+static float    pEnd;           // pressure and flow when the inlet valve was told to close
+static float    fEnd;
+static float    plSum;
+static uint8_t  plCount;
+static float    peepBase;       // EEP this breath started from
+static bool     mvValid;
+
+static float pip = MET_NONE;
+static float plateau = MET_NONE;
+static float peep = MET_NONE;
+static float vt = MET_NONE;
+static float mv = MET_NONE;
+static float ie = MET_NONE;
+static float cstat = MET_NONE;
+static float raw = MET_NONE;
+
+void metStartBreath(float eep)
+{
+  uint32_t now = schedNow();
+
+  if (phase == MET_OUT) {
+    // a full breath ended: its expiration is known now
+    float period = (float) (now - tmStart);
+    float ti = (float) (tmOut - tmStart);
+    if (ti > 0.0f) ie = (float) (now - tmOut) / ti;
+    if (period > 0.0f && vt >= 0.0f) {
+      float v = vt * 60.0f / period; // mL per ms to L/min
+      if (mvValid) {
+        float w = period / MET_MV_WINDOW;
+        if (w > 1.0f) w = 1.0f;
+        mv += w * (v - mv);
+      }
+      else {
+        mv = v;
+        mvValid = true;
+      }
+    }
+    peep = eep;
+    peepBase = eep;
+  }
+  else {
+    peepBase = MET_NONE; // nothing expired before this one, no baseline
+  }
+  tmStart = now;
+  peak = 0.0f;
+  pEnd = 0.0f;
+  fEnd = 0.0f;
+  pressGetFastSample(&psample); // consume what is already there: it predates this breath
+  pressGetFastFlow(&fsample);
+  phase = MET_IN;
+}
+
+void metLoop()
+{
+  if (phase != MET_IN && phase != MET_HOLD) return;
+
+  if (pressGetFastSample(&psample)) {
+    if (psample.value > peak) peak = psample.value; // the inlet valve may still be closing in the hold
+    if (phase == MET_IN) {
+      pEnd = psample.value;
+    }
+    else if ((int32_t) (psample.stamp - tmHold) >= 0) {
+      plSum += psample.value;
+      plCount++;
+    }
+  }
+  if (phase == MET_IN && pressGetFastFlow(&fsample))
+    fEnd = fsample.value;
+}
+
+void metEndInspiration(uint16_t holdMs)
+{
+  if (phase != MET_IN) return;
+  metLoop(); // the newest conversions belong to the inspiration
+  tmHold = schedNow() + holdMs / 2;
+  plSum = 0.0f;
+  plCount = 0;
+  phase = MET_HOLD;
+}
+
+void metStartExpiration(bool holdValid)
+{
+  if (phase != MET_HOLD) return;
+  metLoop();
+  tmOut = schedNow();
+  phase = MET_OUT;
+
+  pip = peak;
+  vt = leakGetTidalVolume(); // leakStartExpiration() comes first
+  plateau = MET_NONE;
+  cstat = MET_NONE;
+  raw = MET_NONE;
+  if (!holdValid || plCount < MET_MIN_PLATEAU_N) return;
+
+  plateau = plSum / plCount;
+  if (peepBase >= 0.0f && plateau - peepBase >= MET_MIN_DRIVING)
+    cstat = vt / (plateau - peepBase);
+  if (fEnd >= MET_MIN_FLOW && pEnd > plateau)
+    raw = (pEnd - plateau) / (fEnd / 60.0f);
+}
+
+void metStop()
+{
+  phase = MET_IDLE;
+  mvValid = false;
+}
+
+float metGetPip()
+{
+  return pip;
+}
+
+float metGetPlateau()
+{
+  return plateau;
+}
+
+float metGetPeep()
+{
+  return peep;
+}
+
+float metGetTidalVolume()
+{
+  return vt;
+}
+
+float metGetMinuteVolume()
+{
+  return mv;
+}
+
+float metGetIE()
+{
+  return ie;
+}
+
+float metGetCompliance()
+{
+  return cstat;
+}
+
+float metGetResistance()
+{
+  return raw;
+}
@@ -0,0 +1,71 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file metrics.h
+ * @brief Per breath respiratory mechanics.
+ *
+ * Fed by the pressure and flow conversions (pressGetFastSample(),
+ * pressGetFastFlow()) while the breath runs, a few running values per breath
+ * and nothing buffered:
+ *
+ *   PIP         highest airway pressure of the inspiration and hold
+ *   plateau     mean pressure over the second half of the hold (inlet and
+ *               exhale valves closed, no flow across the airway resistance)
+ *   PEEP        end expiratory pressure measured by peep.h
+ *   Vt          inspired volume, leak compensated (leak.h)
+ *   Cstat       Vt / (plateau - PEEP)                          mL/cmH2O
+ *   Raw         (pressure - plateau) / flow, both at the end of the
+ *               inspiratory flow                               cmH2O/(L/s)
+ *   MV          Vt per breath period, averaged over about a minute, L/min
+ *   I:E         expiration (pause included) over inspiration (hold included)
+ *
+ * The hold is TM_WAIT_TO_OUT plus the inspiratory hold setting, longer holds
+ * give a better plateau. No plateau (and no Cstat or Raw) when the hold was
+ * cut short by the high pressure limit. Raw needs a steady inspiratory flow,
+ * it is not reported for breaths that end on a flow under MET_MIN_FLOW (the
+ * tail of a pressure control breath).
+ *
+ * Getters return MET_NONE when the value is not available.
+ */
+
+#include <stdint.h>
+
+#define MET_NONE        -1.0f
+
+void  metStartBreath(float peep);       // inspiration begins, peep = EEP of the expiration just ended, cmH2O
+void  metLoop();                        // every breather pass while ventilating
+void  metEndInspiration(uint16_t holdMs); // inlet valve told to close, the hold follows
+void  metStartExpiration(bool holdValid);  // exhale valve opens: PIP, plateau, Vt, Cstat and Raw published
+void  metStop();                        // ventilation stopped: last values kept, MV average restarts
+
+float metGetPip();                      // cmH2O
+float metGetPlateau();                  // cmH2O
+float metGetPeep();                     // cmH2O
+float metGetTidalVolume();              // mL
+float metGetMinuteVolume();             // L/min
+float metGetIE();                       // E per I, 2.0 is 1:2
+float metGetCompliance();               // mL/cmH2O
+float metGetResistance();               // cmH2O/(L/s)
+
+#endif // METRICS_H
@@ -28,12 +28,14 @@
 
 #ifdef STEPPER_MOTOR_STEP_PIN
 
+#include <math.h>
 
 /*
 
 Limitations:
 
-This code is using bit-bang to generate pulses
+Pulses are generated by the Timer1 compare match ISR in hal.cpp (halMotorRun). This
+file only computes the trapezoidal velocity profile of each stroke.
 
  P_START: is the mechanism position where the bag is deflated.
  P_END: is the mechanism position the the bag deflated.
@@ -54,8 +56,34 @@ This code is using bit-bang to generate pulses
        |  M  |                                                              |
         \   /                                                              EOC
 
+Velocity profile (one stroke of "stroke" steps in the requested time):
+
+   speed
+     ^      ____________________
+     |     /       cruise       \
+     |    /                      \
+     |   /ramp            mirrored\
+     +----------------------------------> steps
+
+ The acceleration ramp only depends on MOTOR_ACCEL, so its step intervals are
+ computed once in motorInit(). For each stroke we only pick how far to climb
+ it and the cruise period that makes the whole stroke last the requested time.
+
+Stroke adaptation:
+
+ The inspiration stroke starts at STROKE_START steps and, after each breath,
+ moves towards target / delivered times itself (motorAdaptStroke()), half
+ way per breath. The bag is not linear but volume grows with the stroke, so
+ this settles on the stroke that delivers the target in a few breaths. It is
+ limited to P_END - P_START: past that the arm reaches the EOC switch.
 */
 #define MIN_STEP_PERIOD 1200 // in microseconds. this is limited by the motor (max RPM)
+#define MAX_STEP_PERIOD 32000 // in microseconds. Timer1 range (prescaler 8 at 16 MHz)
+#define HOMING_FAST_PERIOD 2500 // in microseconds. Constant speed while looking for EOC
+#define HOMING_SLOW_PERIOD 10000 // in microseconds. Backing off EOC: its release is the reference
+
+#define MOTOR_ACCEL     6000 // steps/s^2
+#define MOTOR_RAMP_SIZE 64   // must reach 1/MIN_STEP_PERIOD: ACCEL >= (1e6/MIN_STEP_PERIOD)^2 / (2 * RAMP_SIZE)
 
 //#define MAX_STEP_SPEED (1000000 / MIN_STEP_PERIOD) // steps per second (833 for MIN_STEP_PERIOD = 1200)
 
@@ -64,6 +92,13 @@ This code is using bit-bang to generate pulses
 #define     P_END       600
 #define     EOC         P_END
 
+#define     STROKE_START        300     // steps, first breath: half the travel
+#define     STROKE_MIN          60      // steps
+#define     STROKE_GAIN         0.5     // share of the correction applied per breath
+#define     STROKE_MAX_CHANGE   0.25    // per breath, both signs
+#define     STROKE_MIN_VOLUME   20      // mL, less is no flow reading rather than a small breath
+#define     STROKE_SHORT        0.9     // full stroke under this share of the target: alarm
+
 // initialization:
 //   - If starts with EOC == true then move back until EOC is false. It must find before ( (P_MAX - EOC) *  2)
 //      - otherwise, declare motor error "EOC always true" and give up
@@ -72,6 +107,9 @@ This code is using bit-bang to generate pulses
 //     - move back until EOC is false. It must find before ( (P_MAX - EOC) *  2)
 //        - otherwise, declare motor error "EOC always true 2" and give up
 //     - move back P_END - P_START steps and declare this final position as P_START.
+//
+// Moving towards EOC is done at HOMING_FAST_PERIOD, backing off it at HOMING_SLOW_PERIOD:
+// the release point is the reference, found within a loop pass of the step that caused it.
 
 typedef enum {
   ST_INIT,
@@ -93,54 +131,154 @@ typedef enum {
   BWD
 } dir_t;
 
-static uint16_t   speed; // in steps per second
 static state_t    state;
-static uint64_t   microTimerRef;
-
-static uint32_t   step_periodo = MIN_STEP_PERIOD;  // must be >= MIN_STEP_PERIOD 
-static uint8_t    phase;
 static dir_t      direction;
-static uint32_t   stepCounter;
-static uint32_t   progress;
 
+static uint16_t   ramp[MOTOR_RAMP_SIZE]; // step intervals in microseconds while accelerating
+static uint8_t    rampLen;               // ramp entries used by the current stroke
+static uint16_t   cruisePeriod;          // in microseconds
 
+static uint16_t   position;              // steps from P_START, valid once homed
+static uint16_t   moveSteps;             // steps of the stroke in progress
+static uint16_t   stroke = STROKE_START; // inspiration stroke, adapted breath by breath
 
-static void updateMicroFreeRunningTimer();
+//------------- Velocity profile -----------
 
-//
+static void buildRamp()
+{
+  int k;
+  float c = 1000000.0 * sqrt(2.0 / MOTOR_ACCEL); // time to the first step from rest
+  float period;
+
+  // step k happens at t = sqrt(2 * k / MOTOR_ACCEL)
+  for (k=0; k<MOTOR_RAMP_SIZE; k++) {
+    period = c * (sqrt((float) k + 1) - sqrt((float) k));
+    if (period > MAX_STEP_PERIOD) period = MAX_STEP_PERIOD;
+    ramp[k] = (uint16_t) period;
+  }
+  if (ramp[MOTOR_RAMP_SIZE - 1] > MIN_STEP_PERIOD) {
+    LOG("motor: ramp too short for full speed");
+  }
+}
+
+// choose rampLen and cruisePeriod so that "steps" steps take "milli" milliseconds
+static void buildProfile(uint32_t milli, uint16_t steps)
+{
+  uint32_t t = milli * 1000; // microseconds
+  uint32_t ramped = 0;       // time spent accelerating + decelerating
+  uint32_t cruise;
+  uint16_t left;             // cruise steps: the loop keeps 2 * n below steps
+  uint8_t  n = 0;
+
+  if (steps == 0) {
+    // exhalation from P_START, or a stroke adapted down to nothing
+    rampLen = 0;
+    return;
+  }
+  for (;;) {
+    left = steps - 2 * n;
+    cruise = (t > ramped) ? (t - ramped) / left : 0;
+    if (cruise < MIN_STEP_PERIOD) cruise = MIN_STEP_PERIOD;
+    if (cruise > MAX_STEP_PERIOD) cruise = MAX_STEP_PERIOD;
+
+    // climb the ramp while it is slower than the cruise speed
+    if (n >= MOTOR_RAMP_SIZE || ramp[n] <= cruise || 2 * (n + 1) >= steps) break;
+    ramped += 2UL * ramp[n];
+    n++;
+  }
+  rampLen = n;
+  cruisePeriod = (uint16_t) cruise;
+
+  if (ramped + (uint32_t) left * cruise > t + t / 20) {
+    // more than 5% late even at full speed
+    CEvent::post(EVT_ALARM, ALARM_IDX_UNDER_SPEED_MOTOR);
+    LOG("motor underspeed");
+  }
+  LOGV("Period = %d microsec", cruisePeriod);
+}
+
+static void setDirection(dir_t dir)
+{
+  direction = dir;
+  halMotorDir(dir == FWD); // FWD squeezes the bag, towards EOC
+}
+
+// a macro: LOG() takes the text as a literal and keeps it in flash
+#define HOMING_ERROR(why) do { LOG(why); homingError(); } while (0)
+
+static void homingError()
+{
+  halMotorStop();
+  CEvent::post(EVT_ALARM, ALARM_IDX_MOTOR_EOC);
+  state = ST_ERROR;
+}
 
 //------------- Finite State Machine -----------
 
 static void fsmSt_INIT()
 {
-  stepCounter = P_END;
-  halMotorDir(FWD);
+  if (halMotorEOC()) {
+    // already on the switch: back off it straight away
+    setDirection(BWD);
+    halMotorRun((P_MAX - EOC) * 2, ramp, 0, HOMING_SLOW_PERIOD);
+    state = ST_INIT_MOVING_OUT_OF_END;
+    return;
+  }
+  setDirection(FWD);
+  halMotorRun(P_MAX, ramp, 0, HOMING_FAST_PERIOD);
   state = ST_INIT_MOVING_TO_END;
 }
 
 static void fsmSt_INIT_MOVING_TO_END()
 {
-  if (stepCounter == 0) {
-    halMotorDir(BWD);
-    stepCounter = P_END;
+  if (halMotorEOC()) {
+    halMotorStop();
+    setDirection(BWD);
+    halMotorRun((P_MAX - EOC) * 2, ramp, 0, HOMING_SLOW_PERIOD);
     state = ST_INIT_MOVING_OUT_OF_END;
   }
-  
+  else if (halMotorIsRunning() == false) {
+    HOMING_ERROR("motor: EOC always false");
+  }
 }
 
 static void fsmSt_INIT_MOVING_OUT_OF_END()
 {
-  
+  if (halMotorEOC() == false) {
+    // released: we are at EOC
+    halMotorStop();
+    setDirection(BWD);
+    halMotorRun(P_END - P_START, ramp, 0, HOMING_FAST_PERIOD);
+    state = ST_INIT_MOVING_TO_START;
+  }
+  else if (halMotorIsRunning() == false) {
+    HOMING_ERROR("motor: EOC always true");
+  }
 }
 
 static void fsmSt_INIT_MOVING_TO_START()
 {
-  
+  if (halMotorIsRunning() == false) {
+    position = 0;
+    LOG("motor: homed");
+    state = ST_STOPPED;
+  }
 }
  
 static void fsmSt_AIR_IN()
 {
-  
+  if (halMotorEOC()) {
+    // lost steps: the position is not what we think, home again
+    halMotorStop();
+    LOG("motor: EOC in inspiration");
+    CEvent::post(EVT_ALARM, ALARM_IDX_MOTOR_EOC);
+    state = ST_INIT;
+    return;
+  }
+  if (halMotorIsRunning() == false) {
+    position += moveSteps;
+    state = ST_AIR_IN_PAUSE;
+  }
 }
 
 static void fsmSt_AIR_IN_PAUSE()
@@ -151,7 +289,10 @@ static void fsmSt_AIR_IN_PAUSE()
 
 static void fsmSt_AIR_OUT()
 {
-  
+  if (halMotorIsRunning() == false) {
+    position -= moveSteps;
+    state = ST_AIR_OUT_PAUSE;
+  }
 }
 
 
@@ -176,14 +317,18 @@ static void fsmSt_ERROR()
 //---------------- Global functions ----------------
 void motorInit()
 {
-  state = ST_AIR_IN_PAUSE; // ST_INIT;
-  microTimerRef = halStartTimerRef();
+  buildRamp();
+#ifdef STEPPER_MOTOR_EOC_PIN
+  state = ST_INIT;
+#else
+  LOG("motor: no EOC, P_START assumed");
+  position = 0;
+  state = ST_STOPPED;
+#endif
 }
 
 void motorLoop()
 {
-  static int lastProrgress = 0;
-  
   switch (state) {
     case ST_INIT:                   fsmSt_INIT();                   break;
     case ST_INIT_MOVING_TO_END:     fsmSt_INIT_MOVING_TO_END();     break;
@@ -198,90 +343,77 @@ void motorLoop()
     default: return;
 
   }
-  
-  if (stepCounter == 0) return;
-  //--------- may move motor if stepCounter > 0 --------
-  if (phase == 0) {
-    //halMotorStep (true);      // Step PIN high
-    microTimerRef = halStartMicroTimerRef();
-    phase++;
-    return;
-  }
-  if (phase == 1) {
-    if (halCheckMicroTimerExpired(microTimerRef, step_periodo/10)) {
-      halMotorStep (true);      // Step PIN high
-      phase++;
-    }
-    return;
-  }
-
-  if (phase == 2) {
-    if (halCheckMicroTimerExpired(microTimerRef, step_periodo/2)) {
-      halMotorStep (false);      // Step PIN low
-      phase++;
-    }
-    return;
-  }
-  if (phase == 3) {
-    if (halCheckMicroTimerExpired(microTimerRef, step_periodo)) {
-      stepCounter--;
-      phase = 0;
-
-      if (stepCounter == 0) {
-        progress = 100;
-      }
-      else {
-        progress = 100 - (stepCounter * 100)/ P_END;
-        if (progress >= 100) progress = 99;
-        if (progress < 0) progress = 0;
-        
-      }
-      if (lastProrgress != progress) {
-        lastProrgress = progress;
-        //LOGV("%d", progress);;
-      }
-    }
-  }  
+  // steps are issued by the Timer1 ISR: nothing else to do here
 }
 
-
-static int getStepPeriod(uint32_t milli) {
-  int r = (milli * 1000) / P_END;
-  if (r < MIN_STEP_PERIOD) {
-    CEvent::post(EVT_ALARM, ALARM_IDX_UNDER_SPEED_MOTOR);
-    LOG("motor underspeed");
-    return MIN_STEP_PERIOD;
-  }
-  LOGV("Period = %d microsec", r);
-  return r;
+bool motorIsReady()
+{
+  return state >= ST_AIR_IN && state <= ST_STOPPED;
 }
 
 void motorStartInspiration(int millisec)
 {
+  if (motorIsReady() == false) return;
   LOG(">> motorStartInspiration");
-  progress = 0;
-  direction = FWD;
-  halMotorDir(true);
-  step_periodo = getStepPeriod(millisec);
-  stepCounter = P_END;
-  microTimerRef = halStartMicroTimerRef();
-  
+  // the arm is back at P_START after each exhalation, never past EOC
+  moveSteps = stroke;
+  if (moveSteps > P_END - P_START - position) moveSteps = P_END - P_START - position;
+  setDirection(FWD);
+  buildProfile(millisec, moveSteps);
+  halMotorRun(moveSteps, ramp, rampLen, cruisePeriod);
+  state = ST_AIR_IN;
 }
 
 void motorStartExhalation(int millisec)
 {
-    LOG("<< motorStartExhalation");
-  progress = 0;
-  direction = BWD;
-  halMotorDir(false);
-  step_periodo = getStepPeriod(millisec);
-  stepCounter = P_END;
-  microTimerRef = halStartMicroTimerRef();
+  if (motorIsReady() == false) return;
+  LOG("<< motorStartExhalation");
+  moveSteps = position; // all the way back to P_START
+  setDirection(BWD);
+  buildProfile(millisec, moveSteps);
+  halMotorRun(moveSteps, ramp, rampLen, cruisePeriod);
+  state = ST_AIR_OUT;
 }
 
 int motorGetProgress()
 {
-  return progress;
+  uint16_t pos;
+
+  if (state != ST_AIR_IN && state != ST_AIR_OUT) return 100; // nothing moving the bag: do not hold the breather
+  if (moveSteps == 0) return 100;
+  pos = halMotorGetPosition(); // ISR step counter
+  if (pos >= moveSteps) return 100;
+  return (int) (((uint32_t) pos * 100) / moveSteps);
+}
+
+void motorAdaptStroke(float delivered, int target)
+{
+  float ratio, s;
+
+  if (delivered < STROKE_MIN_VOLUME) {
+    LOG("motor: no volume reading, stroke kept");
+    return;
+  }
+  ratio = (float) target / delivered;
+  if (ratio > 1.0 + STROKE_MAX_CHANGE) ratio = 1.0 + STROKE_MAX_CHANGE;
+  if (ratio < 1.0 - STROKE_MAX_CHANGE) ratio = 1.0 - STROKE_MAX_CHANGE;
+
+  s = stroke * (1.0 + STROKE_GAIN * (ratio - 1.0));
+  if (s < STROKE_MIN) s = STROKE_MIN;
+  if (s >= P_END - P_START) {
+    s = P_END - P_START;
+    if (delivered < target * STROKE_SHORT) {
+      // the whole bag is not enough
+      CEvent::post(EVT_ALARM, ALARM_IDX_LOW_TIDAL_VOLUME);
+    }
+  }
+  stroke = (uint16_t) (s + 0.5);
+  LOGV("stroke %d steps (Vt %d, target %d)", stroke, (int) delivered, target);
+}
+
+uint16_t motorGetStroke()
+{
+  return stroke;
 }
 
 
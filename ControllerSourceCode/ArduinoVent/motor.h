@@ -21,12 +21,18 @@
  **************************************************************
 */
 
-void motorInit();
+#include <stdint.h>
+
+void motorInit();           // homes on the EOC switch, if there is one
 void motorLoop();
+bool motorIsReady();        // homed, strokes are accepted
 
-void motorStartInspiration(int millisec);
-void motorStartExhalation(int millisec);
+void motorStartInspiration(int millisec);   // one stroke towards EOC
+void motorStartExhalation(int millisec);    // back to P_START
 int motorGetProgress();
 
+void motorAdaptStroke(float delivered, int target); // end of each inspiration, volumes in mL
+uint16_t motorGetStroke();  // steps of the next inspiration
+
 //---------------------------------------------------------------
 #endif // MOTOR_H
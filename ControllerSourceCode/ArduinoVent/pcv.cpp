@@ -0,0 +1,159 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+#include "pcv.h"
+#include "hal.h"
+#include "log.h"
+#include "pressure.h"
+#include "sched.h"
+
+#define PCV_PWM_PERIOD      40      // ms
+#define PCV_MIN_PULSE       5       // ms, shorter on/off times are below what the solenoid follows
+
+#define PCV_KP              0.3f    // duty per cmH2O
+#define PCV_KI              0.5f    // duty per cmH2O.s
+#define PCV_KD              0.01f   // duty per cmH2O/s, on the measurement (no kick when the set point moves)
+#define PCV_I_MAX           1.0f
+#define PCV_FILTER_TAU      40.0f   // ms, about one PWM period: the ripple is not something to chase
+#define PCV_MAX_DT          50      // ms, a longer gap between samples restarts the filter
+
+#define ST_IDLE             0
+#define ST_RISE             1
+#define ST_HOLD             2
+
+static void pwmTask();
+static void closeTask();
+static sched_task_t pwmTaskEntry = SCHED_TASK(pwmTask);
+static sched_task_t closeTaskEntry = SCHED_TASK(closeTask);
+
+static uint8_t  state = ST_IDLE;
+static float    base;       // pressure when the breath started
+static float    target;
+static uint16_t rise;
+static uint32_t tmStart;
+static float    integral;
+static float    duty;
+static press_sample_t sample;
+static float    filtered;
+static float    lastFiltered;
+static uint32_t lastStamp;
+static bool     haveLast;
+
+static void closeTask()
+{
+  halValveInClose();
+}
+
+static void pwmTask()
+{
+  uint16_t on = (uint16_t) (duty * PCV_PWM_PERIOD);
+
+  if (on < PCV_MIN_PULSE) {
+    schedStop(&closeTaskEntry);
+    halValveInClose();
+    return;
+  }
+  halValveInOpen();
+  if (on > PCV_PWM_PERIOD - PCV_MIN_PULSE)
+    schedStop(&closeTaskEntry); // stays open into the next period
+  else
+    schedStart(&closeTaskEntry, on, 0);
+}
+
+static float setPoint(uint32_t t)
+{
+  uint32_t elapsed = t - tmStart;
+  if (elapsed >= rise) return target;
+  return base + (target - base) * elapsed / rise;
+}
+
+static void update()
+{
+  float sp = setPoint(sample.stamp);
+  float e, dt, d = 0.0f;
+  float out;
+  uint32_t ms = sample.stamp - lastStamp;
+
+  if (haveLast && ms <= PCV_MAX_DT && ms != 0) {
+    dt = ms / 1000.0f;
+    filtered += (sample.value - filtered) * ms / (PCV_FILTER_TAU + ms);
+    d = (filtered - lastFiltered) / dt;
+    e = sp - filtered;
+    // anti windup: do not integrate further into a saturated output
+    if (!((duty >= 1.0f && e > 0.0f) || (duty <= 0.0f && e < 0.0f))) {
+      integral += PCV_KI * e * dt;
+      if (integral > PCV_I_MAX) integral = PCV_I_MAX;
+      if (integral < -PCV_I_MAX) integral = -PCV_I_MAX;
+    }
+  }
+  else {
+    filtered = sample.value;
+    e = sp - filtered;
+  }
+  lastFiltered = filtered;
+  lastStamp = sample.stamp;
+  haveLast = true;
+
+  out = PCV_KP * e + integral - PCV_KD * d;
+  if (out > 1.0f) out = 1.0f;
+  if (out < 0.0f) out = 0.0f;
+  duty = out;
+}
+
+void pcvStart(int targetCmH2O, int riseMs)
+{
+  target = (float) targetCmH2O;
+  rise = (uint16_t) riseMs;
+  tmStart = schedNow();
+  base = pressGetVal(PRESSURE);
+  if (base > target) base = target;
+  integral = 0.0f;
+  haveLast = false;
+  pressGetFastSample(&sample); // consume what is already there: it predates this breath
+  state = (rise > 0) ? ST_RISE : ST_HOLD;
+
+  // full flow until the first sample of the breath says otherwise
+  duty = 1.0f;
+  pwmTask();
+  schedStart(&pwmTaskEntry, PCV_PWM_PERIOD, PCV_PWM_PERIOD);
+}
+
+void pcvLoop()
+{
+  if (state == ST_IDLE) return;
+  if (state == ST_RISE && schedNow() - tmStart >= rise) state = ST_HOLD;
+  if (pressGetFastSample(&sample)) update();
+}
+
+void pcvStop()
+{
+  if (state == ST_IDLE) return;
+  schedStop(&pwmTaskEntry);
+  schedStop(&closeTaskEntry);
+  halValveInClose();
+  state = ST_IDLE;
+}
+
+bool pcvIsActive()
+{
+  return state != ST_IDLE;
+}
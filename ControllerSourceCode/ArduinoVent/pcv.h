@@ -0,0 +1,46 @@
+#ifndef PCV_H
+#define PCV_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file pcv.h
+ * @brief Pressure control inspiration.
+ *
+ * While the breather is in inspiration with PROP_MODE_PC, the inlet valve is
+ * driven by a software PWM (PCV_PWM_PERIOD, scheduled tasks) whose duty comes
+ * from a PID on the airway pressure. The set point ramps from the pressure at
+ * the start of the breath to the target in the rise time, then holds:
+ *
+ *   IDLE -> pcvStart() -> RISE -> (rise time elapsed) -> HOLD -> pcvStop() -> IDLE
+ *
+ * The PID runs once per pressure conversion (pressGetFastSample()), with the
+ * conversion time stamps as its time base, not on the averaged pressure task.
+ */
+
+#include <stdint.h>
+
+void pcvStart(int target, int riseMs);  // inspiration begins, target in cmH2O
+void pcvLoop();                         // call on every pass while inspiring
+void pcvStop();                         // inspiration ends: inlet valve closed
+bool pcvIsActive();
+
+#endif // PCV_H
@@ -0,0 +1,154 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+#include "peep.h"
+#include "hal.h"
+#include "log.h"
+#include "pressure.h"
+#include "sched.h"
+#include "properties.h"
+
+#define PEEP_PWM_PERIOD     200     // ms
+#define PEEP_MIN_PULSE      20      // ms, shorter pulses are below what the solenoid follows
+#define PEEP_MIN_OFF        30      // ms closed before each sample: settle time + one pressure read
+#define PEEP_MAX_PULSE      (PEEP_PWM_PERIOD - PEEP_MIN_OFF)
+
+#define PEEP_KP             0.25f   // duty per cmH2O
+#define PEEP_KI             0.2f    // duty per cmH2O.s
+#define PEEP_I_MAX          0.2f    // integral share of the duty, both signs
+#define PEEP_I_BAND         1.0f    // cmH2O, integrate only this close to the set point
+
+#define PEEP_KB             0.5f    // set point correction per cmH2O of EEP error, per breath
+#define PEEP_TRIM_MAX       2.0f    // cmH2O
+
+static void pwmTask();
+static void closeTask();
+static sched_task_t pwmTaskEntry = SCHED_TASK(pwmTask);
+static sched_task_t closeTaskEntry = SCHED_TASK(closeTask);
+
+static bool     active;
+static int      desiredPeep = -1;
+static float    trim;       // breath by breath set point correction
+static float    integral;
+static float    eep;
+static float    lastSample; // taken at the start of the current PWM period, valve closed
+static bool     sampled;
+static uint32_t closeTm;
+static uint16_t actuations;
+static int16_t  latOpen;    // exhale valve latencies, ms (valvecal.h)
+static int16_t  latClose;
+
+static void closeTask()
+{
+  halValveOutClose();
+  closeTm = schedNow();
+}
+
+static void pwmTask()
+{
+  float p = pressGetVal(PRESSURE);
+  float e = p - ((float) desiredPeep + trim); // > 0: too high, open
+  float duty;
+  int16_t on;
+
+  lastSample = p;
+  sampled = true;
+
+  // anti windup: the integral only acts near the set point, where the
+  // proportional part is not saturating the duty during the initial blow down
+  if (e < PEEP_I_BAND && e > -PEEP_I_BAND) {
+    integral += PEEP_KI * e * (PEEP_PWM_PERIOD / 1000.0f);
+    if (integral > PEEP_I_MAX) integral = PEEP_I_MAX;
+    if (integral < -PEEP_I_MAX) integral = -PEEP_I_MAX;
+  }
+
+  duty = PEEP_KP * e + integral;
+  if (duty <= 0.0f) return; // valve stays closed: no air is added in expiration, holding is all we can do
+
+  on = (duty >= 1.0f) ? PEEP_MAX_PULSE : (int16_t) (duty * PEEP_PWM_PERIOD);
+  if (on < PEEP_MIN_PULSE) return;
+  if (on > PEEP_MAX_PULSE) on = PEEP_MAX_PULSE;
+
+  // the valve opens latOpen and closes latClose after its commands: stretch
+  // the command by the difference, and end it early enough for the valve to
+  // be closed the off time before the next sample
+  on += latOpen - latClose;
+  if (on > PEEP_MAX_PULSE - latClose) on = PEEP_MAX_PULSE - latClose;
+  if (on <= 0) return;
+
+  if (actuations < 0xffff) actuations++;
+  halValveOutOpen();
+  schedStart(&closeTaskEntry, on, 0);
+}
+
+void peepStart(int desired)
+{
+  if (desired != desiredPeep) {
+    desiredPeep = desired;
+    trim = 0.0f;
+  }
+  integral = 0.0f;
+  sampled = false;
+  active = true;
+  latOpen = (int16_t) propGetOutOpenLatency();
+  latClose = (int16_t) propGetOutCloseLatency();
+  halValveOutClose(); // ours from here: a high pressure trip leaves it open
+  closeTm = schedNow();
+  pwmTask();
+  schedStart(&pwmTaskEntry, PEEP_PWM_PERIOD, PEEP_PWM_PERIOD);
+}
+
+void peepStop()
+{
+  schedStop(&pwmTaskEntry);
+  schedStop(&closeTaskEntry);
+  halValveOutClose();
+  active = false;
+}
+
+void peepEndBreath()
+{
+  if (!active) return;
+
+  // the live reading is the EEP unless a pulse is open or just closed,
+  // then the sample from the start of the PWM period is the closest valid one
+  if ((halGetValveState() & HAL_VALVE_OUT_OPEN) == 0 && schedNow() - closeTm >= (uint32_t) (PEEP_MIN_OFF + latClose))
+    eep = pressGetVal(PRESSURE);
+  else if (sampled)
+    eep = lastSample;
+  peepStop();
+  if (!sampled) return;
+
+  trim += PEEP_KB * ((float) desiredPeep - eep);
+  if (trim > PEEP_TRIM_MAX) trim = PEEP_TRIM_MAX;
+  if (trim < -PEEP_TRIM_MAX) trim = -PEEP_TRIM_MAX;
+}
+
+float peepGetEep()
+{
+  return eep;
+}
+
+uint16_t peepGetActuations()
+{
+  return actuations;
+}
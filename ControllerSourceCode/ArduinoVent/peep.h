@@ -0,0 +1,51 @@
+#ifndef PEEP_H
+#define PEEP_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file peep.h
+ * @brief PEEP regulation on the exhale valve.
+ *
+ * During expiration the exhale valve is driven by a slow software PWM
+ * (PEEP_PWM_PERIOD, scheduled tasks) whose duty comes from a PI controller on
+ * the airway pressure. Pressure is taken at the start of each PWM period, when
+ * the valve has been closed for the off time and the sensor reads the lung
+ * rather than the drop across the open valve. Pulses shorter than the solenoid
+ * can follow are not issued, which is what keeps the valve from chattering.
+ *
+ * Breath by breath, the pressure measured at the end of expiration (EEP)
+ * trims the controller set point so the delivered PEEP converges on the
+ * setting even if the valve or the sensor have an offset.
+ *
+ * Pulses are commanded with the calibrated exhale valve latencies
+ * (valvecal.h) so the valve, not the command, is open for the wanted time.
+ */
+
+#include <stdint.h>
+
+void     peepStart(int desired);    // expiration begins, desired PEEP in cmH2O
+void     peepEndBreath();           // inspiration begins: EEP feedback, valve closed
+void     peepStop();                // abort (stop, calibration): valve closed, no feedback
+float    peepGetEep();              // last measured end expiratory pressure, cmH2O
+uint16_t peepGetActuations();       // valve openings issued by the controller since boot
+
+#endif // PEEP_H
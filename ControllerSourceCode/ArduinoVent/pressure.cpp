@@ -53,9 +53,11 @@ end
 #include "config.h"
 #include "bmp280_int.h"
 #include "toyotaMafSensor.h"
+#include "sched.h"
+#include "trace.h"
 #include <stdint.h>
 
-#ifdef VENTSIM
+#if defined(VENTSIM) && !defined(VENTHOST)
 #include <QRandomGenerator>
 #define TEST_RAND_MIN 300
 #define TEST_RAND_MAX 400
@@ -72,18 +74,90 @@ static float binCounts[NUM_P_SENSORS];
 static float peaks[NUM_P_SENSORS];
 static float last[NUM_P_SENSORS];
 
-static uint64_t tm_press;
-
-static float volumeInCurrentCycle = 0;
-static uint16_t tidalVolume = 0;
+static void sampleTask();
+static sched_task_t pressTask = SCHED_TASK(sampleTask); // every PRESSURE_READ_DELAY
 
 static float av[NUM_P_SENSORS];
-static uint64_t volumeStartTimerRef;
+
+static float volumeDelivered;     // mL, fast integrator: inspiration
+static float volumeExhaled;       // mL, expiration (negative flow counts up)
+static bool exhaling;             // which of the two the conversions go to
+static float lastFlow;
+static uint32_t lastFlowStamp;
+static bool haveFlow;
+static uint16_t flowSeq;
+static uint32_t flowTime;
+
+#if (USE_BMP280_PRESSURE_SENSOR == 0)
+static uint16_t sampleSeq;  // analog pressure: the sample task is the conversion rate
+static uint32_t sampleTime;
+#endif
 
 #ifdef SHOW_VAL
 static uint64_t tm_log;
 #endif
 
+//---- fast volume integrator
+#define FLOW_READ_BURST     4
+#define US_LPM_TO_ML        (1.0 / 60000.0) // 1 L/min for 1 us
+
+static void addFlowSample(float flow, uint32_t stamp)
+{
+  if (haveFlow) {
+    uint32_t dt = stamp - lastFlowStamp; // us, the stamps wrap
+    float v = (flow + lastFlow) * 0.5 * dt * US_LPM_TO_ML;
+    if (exhaling)
+      volumeExhaled -= v;
+    else
+      volumeDelivered += v;
+  }
+  lastFlow = flow;
+  lastFlowStamp = stamp;
+  haveFlow = true;
+  flowTime = (uint32_t) halStartTimerRef();
+  flowSeq++;
+}
+
+static void integrateFlow()
+{
+#if (USE_CAR_FLOW_SENSOR == 1)
+  flow_sample_t s[FLOW_READ_BURST];
+  uint8_t i, n;
+  do {
+    n = mafReadFlow(s, FLOW_READ_BURST);
+    for (i = 0; i < n; i++) {
+      addFlowSample(s[i].flow, s[i].stamp);
+    }
+  } while (n == FLOW_READ_BURST);
+#endif
+}
+
+void pressVolumeStart()
+{
+  integrateFlow(); // what came before belongs to the previous phase
+  exhaling = false;
+  volumeDelivered = 0;
+}
+
+void pressVolumeExpStart()
+{
+  integrateFlow();
+  exhaling = true;
+  volumeExhaled = 0;
+}
+
+float pressGetExpVolume()
+{
+  integrateFlow();
+  return volumeExhaled;
+}
+
+float pressGetVolume()
+{
+  integrateFlow();
+  return volumeDelivered;
+}
+
 void CalculateAveragePressure(psensor_t sensor)
 {
   int i;
@@ -137,6 +211,17 @@ void CalculateAveragePressure(psensor_t sensor)
     }
 
     last[i] = rawSensorValue;
+#if (USE_CAR_FLOW_SENSOR != 1)
+    if (i == FLOW) {
+      addFlowSample(rawSensorValue, (uint32_t) halStartTimerRef() * 1000); // no fast path: one conversion per task
+    }
+#endif
+#if (USE_BMP280_PRESSURE_SENSOR == 0)
+    if (i == PRESSURE) {
+      sampleTime = (uint32_t) halStartTimerRef();
+      sampleSeq++;
+    }
+#endif
     // clamp it to the max (max value provided by the sensor)
     if (rawSensorValue >= peaks[i])
       peaks[i] = rawSensorValue;
@@ -152,15 +237,6 @@ void CalculateAveragePressure(psensor_t sensor)
       binCounts[i] = 1;
       peaks[i] = rawSensorValue;
     }
-
-    if(i==FLOW) {    
-      uint64_t timerNow = halStartTimerRef();
-      float slotVolume = ((av[i] *  100.0) * (timerNow - volumeStartTimerRef));
-      volumeInCurrentCycle = volumeInCurrentCycle + slotVolume;
-      // Serial.println(volumeInCurrentCycle);
-      // Serial.println(slotVolume);
-      volumeStartTimerRef = timerNow;
-    }
   } // for loop
 }
 
@@ -177,32 +253,28 @@ void pressInit()
   bpm280Init();
 #endif
 
-  tm_press = halStartTimerRef();
+  schedStart(&pressTask, PRESSURE_READ_DELAY, PRESSURE_READ_DELAY);
 
 #ifdef SHOW_VAL
-  tm_log = tm_press;
+  tm_log = halStartTimerRef();
 #endif
 }
 
-void startTidalVolumeCalculation() {
-    volumeInCurrentCycle = 0.0;
-    tidalVolume = 0;
-    volumeStartTimerRef = halStartTimerRef();
-}
 
-void endTidalVolumeCalculation() {
-  tidalVolume = volumeInCurrentCycle * (1000 /* litres to cm3*/) / (60000 * 100); // lires per min instead of per milliseconds
-  volumeInCurrentCycle = 0;
+static void sampleTask()
+{
+  CalculateAveragePressure(PRESSURE);
+#ifdef SENSOR_TRACE
+  traceSample(last[PRESSURE], last[FLOW]);
+#endif
 }
 
-
 void pressLoop()
 {
-  if (halCheckTimerExpired(tm_press, PRESSURE_READ_DELAY))
-  {
-    CalculateAveragePressure(PRESSURE);
-    tm_press = halStartTimerRef();
-  }
+#if (USE_BMP280_PRESSURE_SENSOR == 1)
+  bmp280Loop();
+#endif
+  integrateFlow(); // keep up with the conversion ring
 
 #ifdef SHOW_VAL
   char buf[24];
@@ -225,8 +297,32 @@ float pressGetVal(psensor_t sensor)
   return last[sensor];
 }
 
-uint16_t pressGetTidalVolume() {
-  return tidalVolume;
+bool pressGetFastSample(press_sample_t * s)
+{
+#if (USE_BMP280_PRESSURE_SENSOR == 1)
+  // straight from the driver: one sample per BMP280 conversion
+  uint16_t seq = bmp280GetSampleSeq();
+  if (seq == s->seq) return false;
+  s->value = getCmH2OGauge();
+  s->stamp = bmp280GetSampleTime();
+#else
+  uint16_t seq = sampleSeq;
+  if (seq == s->seq) return false;
+  s->value = last[PRESSURE];
+  s->stamp = sampleTime;
+#endif
+  s->seq = seq;
+  return true;
+}
+
+bool pressGetFastFlow(press_sample_t * s)
+{
+  integrateFlow();
+  if (flowSeq == s->seq) return false;
+  s->value = lastFlow; // only the newest: a trigger wants the current flow, not the backlog
+  s->stamp = flowTime;
+  s->seq = flowSeq;
+  return true;
 }
 //-----------------------------------------------------------------
 #else
@@ -234,5 +330,11 @@ uint16_t pressGetTidalVolume() {
 void pressInit() {}
 void pressLoop() {}
 float pressGetFloatVal(psensor_t sensor) { return 0.0; }
+bool pressGetFastSample(press_sample_t * s) { return false; }
+void pressVolumeStart() {}
+bool pressGetFastFlow(press_sample_t * s) { return false; }
+float pressGetVolume() { return 0.0; }
+void pressVolumeExpStart() {}
+float pressGetExpVolume() { return 0.0; }
 
 #endif //#if ( (USE_Mpxv7002DP_PRESSURE_SENSOR == 1) || (USE_Mpxv7002DP_FLOW_SENSOR == 1) )
@@ -23,7 +23,7 @@
 #include <stdint.h>
 
 #define AVERAGE_BIN_NUMBER        2        // Number of averaging bins for the averaging routine
-#define PRESSURE_READ_DELAY       20L       // wait 20 ms between reads
+#define PRESSURE_READ_DELAY       10L       // wait 10 ms between reads (BMP280_READ_PERIOD)
 
 typedef enum {
   PRESSURE,
@@ -37,8 +37,25 @@ void pressLoop();
 
 float pressGetVal(psensor_t sensor);
 
-void startTidalVolumeCalculation();
-void endTidalVolumeCalculation();
-uint16_t pressGetTidalVolume();
+//---- fast path: every pressure conversion, not averaged, with its time stamp.
+//     For control loops that must see each sample exactly once (pcv.cpp, trigger.cpp)
+typedef struct press_sample_st {
+  float    value;   // gauge pressure in cmH2O, or flow in L/min
+  uint32_t stamp;   // milliseconds, halStartTimerRef() time base
+  uint16_t seq;     // conversion counter
+} press_sample_t;
+
+bool pressGetFastSample(press_sample_t * s); // true and *s updated if a conversion newer than s->seq is available
+bool pressGetFastFlow(press_sample_t * s);   // newest flow conversion seen by the volume integrator, if newer
+                                             // than s->seq. Stamped when drained, within a loop pass of the conversion
+
+//---- delivered volume: every flow conversion (mafReadFlow()) integrated on its time
+//     stamp, trapezoidal rule. Runs continuously into one of two volumes: inspired from
+//     pressVolumeStart(), expired from pressVolumeExpStart(), each zeroed at its start
+void pressVolumeStart();
+float pressGetVolume();     // mL since pressVolumeStart(), includes conversions not yet seen by pressLoop().
+                            // Frozen from pressVolumeExpStart() on
+void pressVolumeExpStart();
+float pressGetExpVolume();  // mL out of the patient since pressVolumeExpStart()
 
 #endif // PRESSURE_H
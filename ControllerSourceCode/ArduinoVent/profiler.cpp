@@ -0,0 +1,161 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+#include "config.h"
+
+#ifdef LOOP_PROFILE
+
+#include "profiler.h"
+#include "hal.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FIRST_BUCKET_SHIFT  4       // first bucket upper limit is 16 microseconds
+#define SAT_16              0xffff
+
+// RAM usage: PROF_NUM_SECTIONS * (12 + 2 * PROF_NUM_BUCKETS) bytes
+typedef struct prof_st {
+    uint16_t min;               // microseconds, saturated at 65535
+    uint16_t max;
+    uint32_t sum;
+    uint32_t count;
+    uint16_t hist[PROF_NUM_BUCKETS];
+} prof_t;
+
+static prof_t stats[PROF_NUM_SECTIONS];
+static uint32_t tm_last_cycle;
+static bool first_cycle;
+
+#ifndef VENTSIM
+static const char sectionNames[PROF_NUM_SECTIONS][8] PROGMEM = {
+#else
+static const char sectionNames[PROF_NUM_SECTIONS][8] = {
+#endif
+    "cycle",
+    "hal",
+    "evt",
+    "ui",
+    "breath",
+    "motor",
+    "keys",
+    "props",
+    "press",
+    "lcd",
+    "sched",
+    "late",
+};
+
+static void loadName(char * dst, int idx)
+{
+#ifndef VENTSIM
+    strcpy_P(dst, sectionNames[idx]);
+#else
+    strcpy(dst, sectionNames[idx]);
+#endif
+}
+
+void profReset()
+{
+    int i;
+    memset(stats, 0, sizeof(stats));
+    for (i=0; i<PROF_NUM_SECTIONS; i++) {
+        stats[i].min = SAT_16;
+    }
+    first_cycle = true;
+}
+
+void profInit()
+{
+    profReset();
+}
+
+void profAdd(prof_section_t sec, uint32_t micros)
+{
+    prof_t * s = &stats[sec];
+    uint16_t t16 = (micros > SAT_16) ? SAT_16 : (uint16_t) micros;
+    uint8_t b = 0;
+    uint32_t v = micros >> FIRST_BUCKET_SHIFT;
+    int i;
+
+    if (t16 < s->min) s->min = t16;
+    if (t16 > s->max) s->max = t16;
+
+    //---- keep the mean meaningful for long runs: halve sum and count instead of wrapping
+    if (s->sum > 0x7fffffff) {
+        s->sum >>= 1;
+        s->count >>= 1;
+    }
+    s->sum += micros;
+    s->count++;
+
+    while (v && b < PROF_NUM_BUCKETS - 1) {
+        v >>= 1;
+        b++;
+    }
+    if (s->hist[b] == SAT_16) {
+        // keep the shape of the histogram
+        for (i=0; i<PROF_NUM_BUCKETS; i++) s->hist[i] >>= 1;
+    }
+    s->hist[b]++;
+}
+
+void profCycle()
+{
+    uint32_t now = halProfileMicros();
+    if (first_cycle == false) {
+        profAdd(PROF_CYCLE, now - tm_last_cycle);
+    }
+    first_cycle = false;
+    tm_last_cycle = now;
+}
+
+void profReport()
+{
+    char buf[96];
+    char name[8];
+    int i, b, len;
+    prof_t * s;
+
+    halWriteSerial((char *) "--- loop profile (us) ---\n");
+    for (i=0; i<PROF_NUM_SECTIONS; i++) {
+        s = &stats[i];
+        if (s->count == 0) continue;
+        loadName(name, i);
+        snprintf(buf, sizeof(buf), "%-6s n=%lu min=%u avg=%lu max=%u\n",
+                 name,
+                 (unsigned long) s->count,
+                 s->min,
+                 (unsigned long) (s->sum / s->count),
+                 s->max);
+        halWriteSerial(buf);
+
+        len = snprintf(buf, sizeof(buf), "  hist");
+        for (b=0; b<PROF_NUM_BUCKETS; b++) {
+            len += snprintf(&buf[len], sizeof(buf) - len, " %u", s->hist[b]);
+            if (len >= (int) sizeof(buf) - 1) break;
+        }
+        halWriteSerial(buf);
+        halWriteSerial((char *) "\n");
+    }
+}
+
+//---------------------------------------------------
+#endif // LOOP_PROFILE
@@ -0,0 +1,74 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file profiler.h
+ * @brief Main loop timing instrumentation.
+ *
+ * Enabled by LOOP_PROFILE in config.h. Each section keeps min/max/mean and a
+ * log2 histogram of its execution time in microseconds. PROF_CYCLE is the
+ * time between two consecutive ventLoop() calls, i.e. the real loop period.
+ *
+ * Send 'p' over the debug serial to print the report, 'r' to reset it.
+ * When LOOP_PROFILE is not defined all the macros below compile to nothing.
+ */
+
+#include "config.h"
+#include <stdint.h>
+
+typedef enum {
+    PROF_CYCLE,     // ventLoop() to ventLoop()
+    PROF_HAL,       // halLoop()
+    PROF_EVT,       // evtDispatchAll()
+    PROF_UI,        // uiNativeLoop()
+    PROF_BREATHER,  // breatherLoop()
+    PROF_MOTOR,     // motorLoop()
+    PROF_KEYS,      // processKeys() task
+    PROF_PROPS,     // props save task
+    PROF_PRESS,     // pressLoop() inside halLoop
+    PROF_LCD,       // LCD refresh (I2C write or parallel stepRefresh)
+    PROF_SCHED,     // schedRun(), including the tasks that were due
+    PROF_LATE,      // lateness of scheduled tasks (deadline to start)
+
+    PROF_NUM_SECTIONS // must be the last one
+} prof_section_t;
+
+#define PROF_NUM_BUCKETS    12  // <16us, 16-31us, 32-63us ... >= 32ms
+
+#ifdef LOOP_PROFILE
+  #define PROF_BEGIN(sec)   uint32_t prof_tm_##sec = halProfileMicros()
+  #define PROF_END(sec)     profAdd(sec, halProfileMicros() - prof_tm_##sec)
+  #define PROF_CYCLE_MARK() profCycle()
+
+  void profInit();
+  void profReset();
+  void profCycle();
+  void profAdd(prof_section_t sec, uint32_t micros);
+  void profReport();   // goes out through halWriteSerial()
+#else
+  #define PROF_BEGIN(sec)
+  #define PROF_END(sec)
+  #define PROF_CYCLE_MARK()
+#endif
+
+#endif // PROFILER_H
@@ -25,13 +25,16 @@
 #include <stdint.h>
 #include "crc.h"
 #include "hal.h"
+#include "sched.h"
+#include "profiler.h"
+#include "languages.h"
 
 #ifndef VENTSIM
   #include <EEPROM.h>
 #endif
 
 #define TAG1 0xd8
-#define TAG2 0x34
+#define TAG2 0x3A // bumped whenever PROPS_T changes
 
 typedef struct __attribute__ ((packed))  props_st {
   uint8_t tag1;
@@ -50,12 +53,27 @@ typedef struct __attribute__ ((packed))  props_st {
   uint16_t propHighTidal;
   uint8_t propDesiredPeep;
 
+  uint8_t propMode;
+  uint8_t propInspPressure;
+  uint16_t propRiseTime;
+  uint16_t propVolumeTarget;
+  uint8_t propTrigPressure;
+  uint8_t propTrigFlow;
+  uint8_t propInOpenLatency;
+  uint8_t propInCloseLatency;
+  uint8_t propOutOpenLatency;
+  uint8_t propOutCloseLatency;
+  uint16_t propInspHold;
+  uint8_t propApneaTime;
+  uint8_t propBackupBpm;
+
   uint8_t crc;
 } PROPS_T;
 
 static PROPS_T props;
-static bool pendingSave = false;
-static uint64_t tm_save;
+
+static void saveTimeout();
+static sched_task_t saveTask = SCHED_TASK(saveTimeout); // armed while a save is pending
 
 // Note: defaults values will takes place in case the stored parameters are corrupted or empty
 
@@ -66,6 +84,12 @@ const char * propDutyCycleTxt[PROT_DUTY_CYCLE_SIZE] = {
     "  1:4"
 };
 
+const char * propModeTxt[PROP_MODE_SIZE] = {
+    STR_MODE_TIMED,
+    STR_MODE_PC,
+    STR_MODE_VC
+};
+
 static void setDefaultValues()
 {
   props.tag1             = TAG1;
@@ -84,6 +108,20 @@ static void setDefaultValues()
   props.propHighTidal          = DEFAULT_HIGH_TIDAL;
   props.propDesiredPeep        = DEFAULT_DESIRED_PEEP;
 
+  props.propMode               = DEFAULT_MODE;
+  props.propInspPressure       = DEFAULT_INSP_PRESSURE;
+  props.propRiseTime           = DEFAULT_RISE_TIME;
+  props.propVolumeTarget       = DEFAULT_VOLUME_TARGET;
+  props.propTrigPressure       = DEFAULT_TRIG_PRESSURE;
+  props.propTrigFlow           = DEFAULT_TRIG_FLOW;
+  props.propInOpenLatency      = DEFAULT_VALVE_LATENCY;
+  props.propInCloseLatency     = DEFAULT_VALVE_LATENCY;
+  props.propOutOpenLatency     = DEFAULT_VALVE_LATENCY;
+  props.propOutCloseLatency    = DEFAULT_VALVE_LATENCY;
+  props.propInspHold           = DEFAULT_INSP_HOLD;
+  props.propApneaTime          = DEFAULT_APNEA_TIME;
+  props.propBackupBpm          = DEFAULT_BACKUP_BPM;
+
 }
 
 static bool checkRecord(PROPS_T * prop_ptr)
@@ -116,21 +154,18 @@ void propInit()
   }
 }
 
-void propLoop()
+static void saveTimeout() // saveTask: UI was quiet for TM_SAVE_TIMEOUT
 {
-  if (pendingSave) {
-    if (halCheckTimerExpired(tm_save, TM_SAVE_TIMEOUT)) {
-      // save props in EEPROM
-      LOG("Save timeout... lets save props into EEPROM");
-      propSave();
-    }
-  }
+  PROF_BEGIN(PROF_PROPS);
+  // save props in EEPROM
+  LOG("Save timeout... lets save props into EEPROM");
+  propSave();
+  PROF_END(PROF_PROPS);
 }
 
 static void setSavePending()
 {
-  pendingSave = true;
-  tm_save = halStartTimerRef();
+  schedStart(&saveTask, TM_SAVE_TIMEOUT, 0); // restarts the timeout on every change
 }
 
 bool propSave()
@@ -138,8 +173,8 @@ bool propSave()
   // update crc
   uint16_t crc = crc_8( (uint8_t *) &props, sizeof(PROPS_T) - 1);
   props.crc = crc;
-  halSaveDataBlock((uint8_t *) &props, sizeof(PROPS_T) );
-  pendingSave = false;
+  schedStop(&saveTask);
+  return halSaveDataBlock((uint8_t *) &props, sizeof(PROPS_T) );
 }
 
 void propSetVent(uint8_t val) {
@@ -208,6 +243,71 @@ void propSetDesiredPeep(int val) {
       setSavePending();
 }
 
+void propSetMode(int val) {
+      props.propMode =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetInspPressure(int val) {
+      props.propInspPressure =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetRiseTime(int val) {
+      props.propRiseTime =  (uint16_t) val & 0x0000ffff;
+      setSavePending();
+}
+
+void propSetVolumeTarget(int val) {
+      props.propVolumeTarget =  (uint16_t) val & 0x0000ffff;
+      setSavePending();
+}
+
+void propSetTrigPressure(int val) {
+      props.propTrigPressure =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetTrigFlow(int val) {
+      props.propTrigFlow =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetInOpenLatency(int val) {
+      props.propInOpenLatency =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetInCloseLatency(int val) {
+      props.propInCloseLatency =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetOutOpenLatency(int val) {
+      props.propOutOpenLatency =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetOutCloseLatency(int val) {
+      props.propOutCloseLatency =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetInspHold(int val) {
+      props.propInspHold =  (uint16_t) val & 0x0000ffff;
+      setSavePending();
+}
+
+void propSetApneaTime(int val) {
+      props.propApneaTime =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
+void propSetBackupBpm(int val) {
+      props.propBackupBpm =  (uint8_t) val & 0x000000ff;
+      setSavePending();
+}
+
 // ---------- Getters ------------
 uint8_t propGetVent() {
 //    LOG("propGetVent");
@@ -259,6 +359,48 @@ int propGetDesiredPeep() {
       //LOG("propDesiredPeep");
       return props.propDesiredPeep;
 }
+int propGetMode() {
+      return props.propMode;
+}
+int propGetInspPressure() {
+      return props.propInspPressure;
+}
+int propGetRiseTime() {
+      return props.propRiseTime;
+}
+int propGetVolumeTarget() {
+      return props.propVolumeTarget;
+}
+int propGetTrigPressure() {
+      return props.propTrigPressure;
+}
+int propGetTrigFlow() {
+      return props.propTrigFlow;
+}
+int propGetInOpenLatency() {
+      return props.propInOpenLatency;
+}
+int propGetInCloseLatency() {
+      return props.propInCloseLatency;
+}
+int propGetOutOpenLatency() {
+      return props.propOutOpenLatency;
+}
+int propGetOutCloseLatency() {
+      return props.propOutCloseLatency;
+}
+
+int propGetInspHold() {
+      return props.propInspHold;
+}
+
+int propGetApneaTime() {
+      return props.propApneaTime;
+}
+
+int propGetBackupBpm() {
+      return props.propBackupBpm;
+}
 
 
 //---------------- in case we decide to do a Wear leveling
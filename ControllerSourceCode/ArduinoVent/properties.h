@@ -25,8 +25,14 @@
 #define PROT_DUTY_CYCLE_SIZE        4
 extern const char * propDutyCycleTxt[PROT_DUTY_CYCLE_SIZE];
 
+//---- ventilation modes (propGetMode)
+#define PROP_MODE_TIMED             0   // inlet valve open for the whole inspiration time
+#define PROP_MODE_PC                1   // pressure control: inlet valve PWM tracks propGetInspPressure()
+#define PROP_MODE_VC                2   // volume control: inspiration ends when propGetVolumeTarget() was delivered
+#define PROP_MODE_SIZE              3
+extern const char * propModeTxt[PROP_MODE_SIZE];
+
 void propInit();
-void propLoop();
 
 bool propSave();
 
@@ -42,6 +48,19 @@ void propSetHighPressure(int val);
 void propSetLowTidal(int val);
 void propSetHighTidal(int val);
 void propSetDesiredPeep(int val);
+void propSetMode(int val);
+void propSetInspPressure(int val);
+void propSetRiseTime(int val);
+void propSetVolumeTarget(int val);
+void propSetTrigPressure(int val);
+void propSetTrigFlow(int val);
+void propSetInOpenLatency(int val);     // ms, valve command to response (valvecal.h)
+void propSetInCloseLatency(int val);
+void propSetOutOpenLatency(int val);
+void propSetOutCloseLatency(int val);
+void propSetInspHold(int val);         // ms added to the end inspiratory hold (metrics.h)
+void propSetApneaTime(int val);        // s, apnea interval (apnea.h), 0 = off
+void propSetBackupBpm(int val);
 
 // ---------- Getters ------------
 uint8_t propGetVent();
@@ -55,5 +74,18 @@ int propGetHighPressure();
 int propGetLowTidal();
 int propGetHighTidal();
 int propGetDesiredPeep();
+int propGetMode();
+int propGetInspPressure();
+int propGetRiseTime();
+int propGetVolumeTarget();
+int propGetTrigPressure();
+int propGetTrigFlow();
+int propGetInOpenLatency();
+int propGetInCloseLatency();
+int propGetOutOpenLatency();
+int propGetOutCloseLatency();
+int propGetInspHold();
+int propGetApneaTime();
+int propGetBackupBpm();
 
 #endif // PROPS_H
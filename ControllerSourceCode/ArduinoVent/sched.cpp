@@ -0,0 +1,125 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+#include "sched.h"
+#include "hal.h"
+#include "profiler.h"
+
+static sched_task_t * head;     // armed tasks sorted by deadline
+static uint32_t now;
+static uint16_t maxLate;
+
+// true if deadline a comes before deadline b (wrap safe)
+static inline bool before(uint32_t a, uint32_t b)
+{
+    return (int32_t) (a - b) < 0;
+}
+
+static void unlink(sched_task_t * task)
+{
+    sched_task_t ** pp = &head;
+    while (*pp) {
+        if (*pp == task) {
+            *pp = task->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    task->armed = false;
+}
+
+static void insert(sched_task_t * task)
+{
+    sched_task_t ** pp = &head;
+    // same deadline: keep registration order (FIFO)
+    while (*pp && !before(task->due, (*pp)->due)) {
+        pp = &(*pp)->next;
+    }
+    task->next = *pp;
+    *pp = task;
+    task->armed = true;
+}
+
+void schedStart(sched_task_t * task, uint16_t delay, uint16_t period)
+{
+    if (task->armed) unlink(task);
+    if (delay == 0) delay = 1; // never due again in the pass that armed it
+    task->period = period;
+    task->due = (uint32_t) halStartTimerRef() + delay;
+    insert(task);
+}
+
+void schedStop(sched_task_t * task)
+{
+    if (task->armed) unlink(task);
+}
+
+bool schedIsArmed(sched_task_t * task)
+{
+    return task->armed;
+}
+
+uint16_t schedRun()
+{
+    sched_task_t * task;
+    uint32_t late;
+
+    halLatchTimerRef();
+    now = (uint32_t) halStartTimerRef();
+
+    while (head && !before(now, head->due)) {
+        task = head;
+        head = task->next;
+        task->armed = false;
+
+        late = now - task->due;
+        if (late > 0xffff) late = 0xffff;
+        if (late > task->maxLate) task->maxLate = (uint16_t) late;
+        if (late > maxLate) maxLate = (uint16_t) late;
+#ifdef LOOP_PROFILE
+        profAdd(PROF_LATE, late * 1000);
+#endif
+
+        if (task->period) {
+            task->due += task->period;
+            if (!before(now, task->due)) {
+                task->due = now + task->period; // fell behind: skip the missed runs
+            }
+            insert(task);
+        }
+        task->fn(); // may re-arm or stop itself
+    }
+
+    if (head == 0) return 0xffff;
+    late = head->due - now;
+    return (late > 0xffff) ? 0xffff : (uint16_t) late;
+}
+
+uint32_t schedNow()
+{
+    return now;
+}
+
+uint16_t schedGetMaxLate()
+{
+    return maxLate;
+}
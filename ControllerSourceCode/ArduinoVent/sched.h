@@ -0,0 +1,60 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file sched.h
+ * @brief Cooperative deadline scheduler.
+ *
+ * Subsystems register periodic or one shot tasks instead of polling
+ * halCheckTimerExpired() on every main loop pass. schedRun() samples the
+ * millisecond clock once per pass (halLatchTimerRef) and runs only the tasks
+ * that are due, in deadline order. Task storage belongs to the caller
+ * (a static sched_task_t), so there is no allocation and no task limit.
+ *
+ * Times are 32 bits milliseconds compared with wrap safe arithmetic.
+ */
+
+#include <stdint.h>
+
+typedef void (*sched_fn_t)(void);
+
+typedef struct sched_task_st {
+    sched_fn_t              fn;
+    uint32_t                due;        // milliseconds
+    uint16_t                period;     // 0 for one shot tasks
+    uint16_t                maxLate;    // worst lateness seen, in milliseconds
+    bool                    armed;
+    struct sched_task_st *  next;
+} sched_task_t;
+
+#define SCHED_TASK(fn)  { fn, 0, 0, 0, false, 0 }
+
+void     schedStart(sched_task_t * task, uint16_t delay, uint16_t period); // (re)arm: first run in "delay" ms (min 1)
+void     schedStop(sched_task_t * task);
+bool     schedIsArmed(sched_task_t * task);
+
+uint16_t schedRun();        // run due tasks. Returns milliseconds to the next deadline (0xffff if none)
+uint32_t schedNow();        // clock sampled by the current pass
+uint16_t schedGetMaxLate(); // worst lateness of any task since boot, in milliseconds
+
+#endif // SCHED_H
@@ -1,15 +1,23 @@
-#include <Arduino.h>
-#include <SoftwareSerial.h>
 #include "config.h"
 #include "serialWriter.h"
 #include "properties.h"
 #include "pressure.h"
 #include "log.h"
+#include "hal.h"
 #include "breather.h"
+#include "trace.h"
+#include "metrics.h"
+#include "leak.h"
 
-#define byte uint8_t
+// Two frames. The status frame keeps the original layout, so existing receivers
+// (looking for "##") still parse it. The per breath metrics go in a frame of
+// their own with another start marker and a version byte.
+#define FRAME_START         0x23    // "##": status
+#define FRAME_START_METRICS 0x25    // "%%": metrics
+#define FRAME_END           0x24
+#define METRICS_VERSION     1       // bump when telemetryMetrics changes
+#define METRIC_NONE         0xffff  // metrics.h has no value yet
 
-static SoftwareSerial monitor(RX_PIN, TX_PIN);
 struct telemetryEvent
 {
   uint8_t ventStatus;
@@ -20,32 +28,105 @@ struct telemetryEvent
   float pressure;
   float flow;
   uint16_t tidalVolume;
-};
+} __attribute__ ((packed));
+
+// last breath (metrics.h), scaled to integers: the frame stays small at any rate
+struct telemetryMetrics
+{
+  uint8_t version;          // METRICS_VERSION
+  uint16_t pip;             // 0.1 cmH2O
+  uint16_t plateau;         // 0.1 cmH2O
+  uint16_t peepMeasured;    // 0.1 cmH2O
+  uint16_t minuteVolume;    // 0.01 L/min
+  uint16_t compliance;      // 0.1 mL/cmH2O
+  uint16_t resistance;      // 0.1 cmH2O/(L/s)
+  uint8_t ieRatio;          // E per I in tenths, 20 is 1:2, 0xff none
+  uint8_t leakPercent;      // of the inspired volume (leak.h)
+} __attribute__ ((packed));
 
 typedef struct telemetryEvent TelemetryEvent;
+typedef struct telemetryMetrics TelemetryMetrics;
+
+typedef struct telemetryFrame_st {
+  uint8_t start[2];
+  TelemetryEvent evt;
+  uint8_t end[2];
+} __attribute__ ((packed)) TelemetryFrame;
+
+typedef struct metricsFrame_st {
+  uint8_t start[2];
+  TelemetryMetrics m;
+  uint8_t end[2];
+} __attribute__ ((packed)) MetricsFrame;
+
+static uint16_t droppedFrames;
+
+static uint16_t metric(float v, float scale)
+{
+    if (v < 0.0f) return METRIC_NONE;
+    v = v * scale + 0.5f;
+    if (v >= (float) METRIC_NONE) return METRIC_NONE - 1;
+    return (uint16_t) v;
+}
 
 void serialInit()
 {
-    monitor.begin(9600);
+    droppedFrames = 0;
+    halTelemetryInit(TELEMETRY_BAUD);
 }
 
+static void send(const void * frame, uint8_t len)
+{
+    if (halTelemetryWrite((const uint8_t *) frame, len) == false) {
+        if (droppedFrames < 0xffff) droppedFrames++;
+    }
+}
+
+// Never waits for the wire: each frame is queued whole in the HAL TX ring (drained
+// by the UART interrupt) or dropped whole and counted.
 void sendDataViaSerial()
 {
-    TelemetryEvent evt;
-
-    evt.dutyCycle = propGetDutyCycle();
-    evt.bpm = propGetBpm();
-    evt.ventStatus = propGetVent();
-    evt.tidalVolume = pressGetTidalVolume();
-    evt.pressure = pressGetVal(PRESSURE);
-    evt.flow = pressGetVal(FLOW);
-    evt.peep = propGetDesiredPeep();
-    evt.phase = (uint8_t)breatherGetState();
-    uint8_t *evtBytes = (uint8_t*)&evt;
-    
-    monitor.write(0x23);
-    monitor.write(0x23);
-    monitor.write(evtBytes, sizeof(evt));
-    monitor.write(0x24);
-    monitor.write(0x24);
-}
\ No newline at end of file
+    TelemetryFrame f;
+    MetricsFrame mf;
+
+#ifndef TELEMETRY_ENABLE
+    return; // config.h: the port is kept for the logs
+#endif
+#ifdef SENSOR_TRACE
+    if (traceIsActive()) return; // the port carries the binary trace
+#endif
+    f.start[0] = FRAME_START;
+    f.start[1] = FRAME_START;
+    f.evt.dutyCycle = propGetDutyCycle();
+    f.evt.bpm = propGetBpm();
+    f.evt.ventStatus = propGetVent();
+    f.evt.tidalVolume = (uint16_t) leakGetTidalVolume(); // leak compensated
+    f.evt.pressure = pressGetVal(PRESSURE);
+    f.evt.flow = pressGetVal(FLOW);
+    f.evt.peep = propGetDesiredPeep();
+    f.evt.phase = (uint8_t)breatherGetState();
+    f.end[0] = FRAME_END;
+    f.end[1] = FRAME_END;
+    send(&f, sizeof(f));
+
+    mf.start[0] = FRAME_START_METRICS;
+    mf.start[1] = FRAME_START_METRICS;
+    mf.m.version = METRICS_VERSION;
+    mf.m.pip = metric(metGetPip(), 10.0f);
+    mf.m.plateau = metric(metGetPlateau(), 10.0f);
+    mf.m.peepMeasured = metric(metGetPeep(), 10.0f);
+    mf.m.minuteVolume = metric(metGetMinuteVolume(), 100.0f);
+    mf.m.compliance = metric(metGetCompliance(), 10.0f);
+    mf.m.resistance = metric(metGetResistance(), 10.0f);
+    uint16_t ie = metric(metGetIE(), 10.0f);
+    mf.m.ieRatio = ie == METRIC_NONE ? 0xff : (ie > 0xfe ? 0xfe : (uint8_t) ie);
+    mf.m.leakPercent = leakGetPercent();
+    mf.end[0] = FRAME_END;
+    mf.end[1] = FRAME_END;
+    send(&mf, sizeof(mf));
+}
+
+uint16_t serialGetDroppedFrames()
+{
+    return droppedFrames;
+}
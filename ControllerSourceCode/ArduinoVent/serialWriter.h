@@ -1,7 +1,10 @@
 #ifndef SERIALWRITER_H
 #define SERIALWRITER_H
 
+#include <stdint.h>
+
 void serialInit();
 void sendDataViaSerial();
+uint16_t serialGetDroppedFrames(); // frames (status or metrics) not sent
 
-#endif // SERIALWRITER_H
\ No newline at end of file
+#endif // SERIALWRITER_H
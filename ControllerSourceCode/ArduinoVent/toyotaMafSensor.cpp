@@ -17,17 +17,24 @@ static uint64_t tm;
 static float fFlow;
 static float fRefFlow;
 
+static uint16_t lastTick;   // ADC scan engine stamp of the last conversion handed out
+static uint32_t stampUs;
+
 void mafSetReference()
 {
   LOGV("Set Flow Ref %d.", fFlow);
   fRefFlow = fFlow;
 }
 
-void updateRawFlowRate()
+static float adcToFlow(uint16_t val)
 {
-	uint16_t val = analogRead(FLOW_SENSOR_PIN);
 	float volt = val * ( 5.0 ) / (1023L) * 1000; //Calibrated to mV
-	fFlow = (volt - FLOW_RELATION_INTERCEPT) / FLOW_RELATION_SLOPE;
+	return (volt - FLOW_RELATION_INTERCEPT) / FLOW_RELATION_SLOPE;
+}
+
+void updateRawFlowRate()
+{
+	fFlow = adcToFlow(halAdcGetAverage(ADC_CH_FLOW)); // ADC scan engine: no conversion wait
 }
 
 static void checkInit()
@@ -54,4 +61,23 @@ float getFlowRate()
 	updateRawFlowRate();
 	return fFlow - fRefFlow;
 }
+
+uint8_t mafReadFlow(flow_sample_t * samples, uint8_t max)
+{
+	adc_sample_t raw[ADC_RING_SIZE];
+	uint8_t i, n;
+
+	checkInit();
+	if (max > ADC_RING_SIZE) max = ADC_RING_SIZE;
+	n = halAdcRead(ADC_CH_FLOW, raw, max);
+	for (i = 0; i < n; i++)
+	{
+		// widen the 16 bit tick stamp: 67 s wrap at 1024 us per tick
+		stampUs += (uint16_t)(raw[i].stamp - lastTick) * ADC_TICK_US;
+		lastTick = raw[i].stamp;
+		samples[i].flow = adcToFlow(raw[i].value) - fRefFlow;
+		samples[i].stamp = stampUs;
+	}
+	return n;
+}
 #endif
\ No newline at end of file
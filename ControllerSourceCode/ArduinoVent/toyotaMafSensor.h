@@ -1,8 +1,18 @@
 #ifndef TOYOTA_MAF_SENSOR_H
 #define TOYOTA_MAF_SENSOR_H
 
+#include <stdint.h>
+
 float getPsi(int p);
 
 float getFlowRate();
+
+//---- fast path: every flow conversion, calibrated but not averaged, with its time stamp
+typedef struct flow_sample_st {
+  float    flow;    // L/min, reference removed like getFlowRate()
+  uint32_t stamp;   // microseconds, free running (wraps)
+} flow_sample_t;
+
+uint8_t mafReadFlow(flow_sample_t * samples, uint8_t max); // unread conversions, oldest first. Returns how many
 //std::string getFlowRateF();
 #endif //TOYOTA_MAF_SENSOR_H
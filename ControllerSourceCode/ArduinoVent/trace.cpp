@@ -0,0 +1,150 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+#include "trace.h"
+
+#ifdef SENSOR_TRACE
+
+#include <string.h>
+#include "hal.h"
+#include "log.h"
+#include "pressure.h"
+#if (USE_BMP280_PRESSURE_SENSOR == 1)
+  #include "bmp280_int.h"
+#endif
+
+#define PA_PER_CMH2O    98.0665f
+
+static bool     active;
+static bool     headerSent;
+static uint64_t lastTm;     // time of the last record accepted by the port
+static uint16_t dropped;
+
+static int16_t quantize(float v, float scale)
+{
+  float r = v / scale;
+  if (r > 32767.0f) return 32767;
+  if (r < -32768.0f) return -32768;
+  return (int16_t) (r < 0 ? r - 0.5f : r + 0.5f);
+}
+
+static bool sendHeader(float pressure)
+{
+  trace_header_t h;
+
+  memset(&h, 0, sizeof(h));
+  h.magic[0] = TRACE_MAGIC_0;
+  h.magic[1] = TRACE_MAGIC_1;
+  h.magic[2] = TRACE_MAGIC_2;
+  h.magic[3] = TRACE_MAGIC_3;
+  h.version = TRACE_VERSION;
+  h.headerSize = sizeof(h);
+  h.samplePeriod = PRESSURE_READ_DELAY;
+  h.pressScale = TRACE_PRESS_SCALE;
+  h.flowScale = TRACE_FLOW_SCALE;
+
+#if (USE_BMP280_PRESSURE_SENSOR == 1)
+  h.sensors |= TRACE_SENS_BMP280;
+  // the reference is not exported by bmp280_int: recover it from absolute - gauge
+  if (bpm280GetPressure() > 0)
+    h.pressRefPa = bpm280GetPressure() - pressure * PA_PER_CMH2O;
+#elif (USE_Mpxv7002DP_PRESSURE_SENSOR == 1)
+  h.sensors |= TRACE_SENS_MPX_PRESS;
+#endif
+
+#if (USE_CAR_FLOW_SENSOR == 1)
+  h.sensors |= TRACE_SENS_MAF_FLOW;
+  h.flowRelSlope = FLOW_RELATION_SLOPE;
+  h.flowRelIntercept = FLOW_RELATION_INTERCEPT;
+#elif (USE_Mpxv7002DP_FLOW_SENSOR == 1)
+  h.sensors |= TRACE_SENS_MPX_FLOW;
+#endif
+
+  return halTelemetryWrite((const uint8_t *) &h, sizeof(h));
+}
+
+void traceStart()
+{
+  LOG("trace start");
+  active = true;
+  headerSent = false;
+  dropped = 0;
+}
+
+void traceStop()
+{
+  LOGV("trace stop, %u dropped", dropped);
+  active = false;
+}
+
+bool traceIsActive()
+{
+  return active;
+}
+
+uint16_t traceGetDropped()
+{
+  return dropped;
+}
+
+void traceSample(float pressure, float flow)
+{
+  trace_record_t r;
+  uint64_t now;
+  uint64_t dt;
+
+  if (!active) return;
+
+  now = halStartTimerRef();
+  if (!headerSent) {
+    // retried on every sample until the port has room (telemetry frames may still be queued)
+    if (!sendHeader(pressure)) return;
+    headerSent = true;
+    lastTm = now;
+  }
+
+  r.pressure = quantize(pressure, TRACE_PRESS_SCALE);
+  r.flow = quantize(flow, TRACE_FLOW_SCALE);
+  r.valves = halGetValveState();
+
+  dt = now - lastTm;
+  while (dt > 255) {
+    r.dt = 255;
+    if (!halTelemetryWrite((const uint8_t *) &r, sizeof(r))) {
+      if (dropped < 0xffff) dropped++;
+      return;
+    }
+    lastTm += 255;
+    dt -= 255;
+  }
+
+  r.dt = (uint8_t) dt;
+  if (halTelemetryWrite((const uint8_t *) &r, sizeof(r))) {
+    lastTm = now;
+  }
+  else {
+    // lastTm is kept: the next record carries this delta too
+    if (dropped < 0xffff) dropped++;
+  }
+}
+
+#endif // SENSOR_TRACE
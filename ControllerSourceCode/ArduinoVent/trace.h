@@ -0,0 +1,93 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file trace.h
+ * @brief Sensor trace: binary record of what the signal path consumed.
+ *
+ * Enabled by SENSOR_TRACE in config.h. Once started, every pressure/flow
+ * sample (pressure.cpp sampling task) becomes one 6 byte record on the
+ * telemetry port, after a header carrying the scale factors and the
+ * calibration constants in use. Telemetry frames are paused while tracing so
+ * the stream stays parseable. VentHost (-r) replays a trace deterministically.
+ *
+ * Stream layout (little endian):
+ *   trace_header_t
+ *   trace_record_t ...
+ *
+ * A record that does not fit in the telemetry TX ring is dropped; the next one
+ * carries the accumulated time delta so the timeline stays correct.
+ * Gaps longer than 255 ms are split in several records with the same values.
+ */
+
+#include "config.h"
+#include <stdint.h>
+
+#define TRACE_MAGIC_0       'O'
+#define TRACE_MAGIC_1       'V'
+#define TRACE_MAGIC_2       'T'
+#define TRACE_MAGIC_3       'R'
+#define TRACE_VERSION       1
+
+#define TRACE_PRESS_SCALE   0.01f   // cmH2O per raw unit
+#define TRACE_FLOW_SCALE    0.01f   // L/min per raw unit
+
+//---- trace_header_t.sensors
+#define TRACE_SENS_BMP280       0x01
+#define TRACE_SENS_MPX_PRESS    0x02
+#define TRACE_SENS_MAF_FLOW     0x04
+#define TRACE_SENS_MPX_FLOW     0x08
+
+//---- trace_record_t.valves, same bits as halGetValveState()
+#define TRACE_VALVE_IN_OPEN     0x01
+#define TRACE_VALVE_OUT_OPEN    0x02
+
+typedef struct __attribute__ ((packed)) trace_header_st {
+    char     magic[4];          // "OVTR"
+    uint8_t  version;           // TRACE_VERSION
+    uint8_t  headerSize;        // sizeof(trace_header_t): readers skip fields they do not know
+    uint8_t  sensors;           // TRACE_SENS_xxx
+    uint8_t  samplePeriod;      // nominal milliseconds between records
+    float    pressScale;        // cmH2O per raw pressure unit
+    float    flowScale;         // L/min per raw flow unit
+    float    pressRefPa;        // absolute reference the gauge pressure is relative to
+    float    flowRelSlope;      // flow sensor calibration (mV per L/min)
+    float    flowRelIntercept;  // flow sensor calibration (mV at zero flow)
+} trace_header_t;
+
+typedef struct __attribute__ ((packed)) trace_record_st {
+    uint8_t  dt;                // milliseconds since the previous record
+    int16_t  pressure;          // gauge pressure, pressScale units
+    int16_t  flow;              // flow, flowScale units
+    uint8_t  valves;            // TRACE_VALVE_xxx
+} trace_record_t;
+
+#ifdef SENSOR_TRACE
+  void     traceStart();
+  void     traceStop();
+  bool     traceIsActive();
+  void     traceSample(float pressure, float flow); // cmH2O, L/min
+  uint16_t traceGetDropped();
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,154 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "trigger.h"
+#include "hal.h"
+#include "log.h"
+#include "pressure.h"
+#include "sched.h"
+
+#define TRIG_REFRACTORY     300     // ms after arming: the exhale transient is not an effort
+#define TRIG_SETTLE         30      // ms the exhale valve must have been closed for pressure to count,
+                                    // an open valve makes the airway read below the lung
+#define TRIG_FLOW_COUNT     2       // consecutive flow conversions over the threshold, ADC noise is a few LSB
+
+static bool     armed;
+static bool     usePressure;
+static bool     useFlow;
+static float    pressThreshold;
+static float    flowThreshold;
+static uint32_t tmArm;
+static uint32_t tmOutOpen;          // last pass the exhale valve was seen open
+static uint8_t  flowOver;
+static press_sample_t pressSample;
+static press_sample_t flowSample;
+static press_sample_t lastPress;    // previous conversions, for the crossing time
+static press_sample_t lastFlow;
+static bool     haveLastPress;
+static bool     haveLastFlow;
+static uint32_t flowCross;          // first flow conversion of the run over the threshold
+
+static uint32_t fireStamp;
+static uint16_t latency;
+static uint16_t maxLatency;
+static uint16_t count;
+
+void triggerArm(int peep, int pressSens, int flowSens)
+{
+  usePressure = pressSens > 0;
+  useFlow = flowSens > 0;
+  armed = usePressure || useFlow;
+  pressThreshold = (float) (peep - pressSens);
+  flowThreshold = (float) flowSens;
+  tmArm = schedNow();
+  tmOutOpen = tmArm;
+  flowOver = 0;
+  haveLastPress = false;
+  haveLastFlow = false;
+}
+
+void triggerDisarm()
+{
+  armed = false;
+}
+
+// time the signal went past the threshold, interpolated between the conversion
+// before and the one past it: the latency then counts the sample age too
+static uint32_t crossing(bool havePrev, const press_sample_t * prev, const press_sample_t * cur, float threshold)
+{
+  if (!havePrev || prev->value == cur->value) return cur->stamp;
+  float f = (prev->value - threshold) / (prev->value - cur->value);
+  if (f <= 0.0f || f > 1.0f) return cur->stamp; // was already past it: blocked by refractory or settle time
+  return prev->stamp + (uint32_t) (f * (float) (cur->stamp - prev->stamp));
+}
+
+static bool fire(uint32_t stamp)
+{
+  armed = false;
+  fireStamp = stamp;
+  return true;
+}
+
+bool triggerLoop()
+{
+  uint32_t now = schedNow();
+  bool newPress, newFlow;
+  bool ret = false;
+
+  if (!armed) return false;
+  if (halGetValveState() & HAL_VALVE_OUT_OPEN) tmOutOpen = now;
+
+  // always consume, so nothing from the refractory time is judged later
+  newPress = usePressure && pressGetFastSample(&pressSample);
+  newFlow = useFlow && pressGetFastFlow(&flowSample);
+  if (now - tmArm < TRIG_REFRACTORY) {
+    ret = false;
+  }
+  else if (newPress && (int32_t) (pressSample.stamp - tmOutOpen) >= TRIG_SETTLE &&
+      pressSample.value < pressThreshold) {
+    ret = fire(crossing(haveLastPress, &lastPress, &pressSample, pressThreshold));
+  }
+  else if (newFlow && flowSample.value > flowThreshold) {
+    if (flowOver++ == 0)
+      flowCross = crossing(haveLastFlow, &lastFlow, &flowSample, flowThreshold);
+    if (flowOver >= TRIG_FLOW_COUNT) ret = fire(flowCross);
+  }
+  else if (newFlow) {
+    flowOver = 0;
+  }
+
+  if (newPress) {
+    lastPress = pressSample;
+    haveLastPress = true;
+  }
+  if (newFlow) {
+    lastFlow = flowSample;
+    haveLastFlow = true;
+  }
+  return ret;
+}
+
+void triggerValveOpened()
+{
+  latency = (uint16_t) ((uint32_t) halStartTimerRef() - fireStamp);
+  if (latency > maxLatency) maxLatency = latency;
+  if (count < 0xffff) count++;
+  if (latency > TRIG_MAX_LATENCY) {
+    LOGV("Trigger latency %d ms", latency);
+  }
+}
+
+uint16_t triggerGetLatency()
+{
+  return latency;
+}
+
+uint16_t triggerGetMaxLatency()
+{
+  return maxLatency;
+}
+
+uint16_t triggerGetCount()
+{
+  return count;
+}
@@ -0,0 +1,55 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file trigger.h
+ * @brief Patient effort detection for assisted breaths.
+ *
+ * Armed while the breather is in expiration or pause. An inspiratory effort
+ * is either the airway pressure dropping below PEEP by the pressure
+ * sensitivity, or flow into the patient above the flow sensitivity. Both are
+ * checked on every conversion (pressGetFastSample(), pressGetFastFlow()), not
+ * on the averaged pressure task, so detection costs at most one conversion
+ * period. The set rate stays the backup: a patient that does not trigger
+ * gets the timed breath.
+ *
+ * Trigger to valve latency is the time from the effort crossing the
+ * threshold, interpolated between the conversion before and the one past it,
+ * to the inlet valve command (triggerValveOpened()). It includes the age of
+ * the sample, not just the time from its processing to the valve.
+ */
+
+#include <stdint.h>
+
+#define TRIG_MAX_LATENCY    50      // ms, logged when exceeded
+
+void     triggerArm(int peep, int pressSens, int flowSens); // expiration begins. Sensitivities in cmH2O and L/min, 0 = off
+void     triggerDisarm();
+bool     triggerLoop();             // call on every pass while armed: true once when an effort is detected
+void     triggerValveOpened();      // the assisted breath started: closes the latency measurement
+
+uint16_t triggerGetLatency();       // ms, last assisted breath
+uint16_t triggerGetMaxLatency();    // ms, worst since boot
+uint16_t triggerGetCount();         // assisted breaths since boot
+
+#endif // TRIGGER_H
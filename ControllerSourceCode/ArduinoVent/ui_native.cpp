@@ -31,6 +31,8 @@
 #include "languages.h"
 #include "toyotaMafSensor.h"
 #include "pressure.h"
+#include "metrics.h"
+#include "leak.h"
 
 //#define TEST_WDT // Debug only... it makes Watchdor to trigger reset when Set button is pressed
 
@@ -117,6 +119,7 @@ static CUiNative * uiNative;
 
 // -------------  prototypes --------------
 static void handleChangeCalibration(int val);
+static void handleChangeValveCalibration(int val);
 
 
 void uiNativeInit()
@@ -137,7 +140,7 @@ void CUiNative::updateStatus(bool blank)
 
   if (alarm_mode == true) {
     if (blank == false) {
-      strcpy(buf, alarm_msg);
+      alarmGetMessage(alarm_handle, buf);
       len = strlen(buf);
     }
     else len = 0;
@@ -159,7 +162,17 @@ static int valHighPressure;
 static int valLowTidal;
 static int valHighTidal;
 static int valCalibration;
+static int valValveCalibration;
 static int valDesiredPeep;
+static int valMode;
+static int valInspPressure;
+static int valRiseTime;
+static int valVolumeTarget;
+static int valTrigPressure;
+static int valTrigFlow;
+static int valInspHold;
+static int valApneaTime;
+static int valBackupBpm;
 
 //----------- Setters ----------
 
@@ -208,6 +221,42 @@ static void handleChangeDesiredPeep(int val) {
     propSetDesiredPeep(val);
 }
 
+static void handleChangeMode(int val) {
+    propSetMode(val);
+}
+
+static void handleChangeInspPressure(int val) {
+    propSetInspPressure(val);
+}
+
+static void handleChangeRiseTime(int val) {
+    propSetRiseTime(val);
+}
+
+static void handleChangeVolumeTarget(int val) {
+    propSetVolumeTarget(val);
+}
+
+static void handleChangeTrigPressure(int val) {
+    propSetTrigPressure(val);
+}
+
+static void handleChangeTrigFlow(int val) {
+    propSetTrigFlow(val);
+}
+
+static void handleChangeInspHold(int val) {
+    propSetInspHold(val);
+}
+
+static void handleChangeApneaTime(int val) {
+    propSetApneaTime(val);
+}
+
+static void handleChangeBackupBpm(int val) {
+    propSetBackupBpm(val);
+}
+
 //-------- getters ------
 
 static int handleGetVent() {
@@ -246,6 +295,42 @@ static int handleGetDesiredPeep() {
     return propGetDesiredPeep();
 }
 
+static int handleGetMode() {
+    return propGetMode();
+}
+
+static int handleGetInspPressure() {
+    return propGetInspPressure();
+}
+
+static int handleGetRiseTime() {
+    return propGetRiseTime();
+}
+
+static int handleGetVolumeTarget() {
+    return propGetVolumeTarget();
+}
+
+static int handleGetTrigPressure() {
+    return propGetTrigPressure();
+}
+
+static int handleGetTrigFlow() {
+    return propGetTrigFlow();
+}
+
+static int handleGetInspHold() {
+    return propGetInspHold();
+}
+
+static int handleGetApneaTime() {
+    return propGetApneaTime();
+}
+
+static int handleGetBackupBpm() {
+    return propGetBackupBpm();
+}
+
 static char *  getFlow ()
 {
  static char buf[8];
@@ -262,7 +347,7 @@ static char *  getFlow ()
 static char *  getTidalVolume()
 {
  static char buf [sizeof(unsigned int)*8+1];
- uint16_t f = pressGetTidalVolume();
+ uint16_t f = (uint16_t) leakGetTidalVolume(); // leak compensated
 #ifndef VENTSIM
     utoa(f, buf, 10);
 #else
@@ -271,6 +356,79 @@ static char *  getTidalVolume()
     return buf;
 }
 
+static char *  getVolumeOvershoot()
+{
+ static char buf [sizeof(int)*8+1];
+ int v = breatherGetVolumeOvershoot();
+#ifndef VENTSIM
+    itoa(v, buf, 10);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%i", v);
+#endif
+    return buf;
+}
+
+// breath metrics (metrics.h), "--" until measured
+static char * metricTxt(float v, uint8_t decimals)
+{
+ static char buf[8];
+ buf[sizeof(buf) - 1] = 0;
+    if (v < 0) return (char *) "--";
+#ifndef VENTSIM
+    dtostrf(v, 1, decimals, buf);
+#else
+    snprintf(buf, sizeof(buf) - 1, "%.*f", decimals, v);
+#endif
+    return buf;
+}
+
+static char *  getPip()
+{
+    return metricTxt(metGetPip(), 1);
+}
+
+static char *  getPlateau()
+{
+    return metricTxt(metGetPlateau(), 1);
+}
+
+static char *  getPeepMeasured()
+{
+    return metricTxt(metGetPeep(), 1);
+}
+
+static char *  getMinuteVolume()
+{
+    return metricTxt(metGetMinuteVolume(), 2);
+}
+
+static char *  getIeRatio()
+{
+ static char buf[10];
+    float e = metGetIE();
+    if (e < 0) return (char *) "--";
+    strcpy(buf, "1:");
+    strcat(buf, metricTxt(e, 1));
+    return buf;
+}
+
+static char *  getCompliance()
+{
+    return metricTxt(metGetCompliance(), 1);
+}
+
+static char *  getResistance()
+{
+    return metricTxt(metGetResistance(), 1);
+}
+
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1)
+static char *  getLeak()
+{
+    return metricTxt(leakGetPercent(), 0);
+}
+#endif
+
 static char *  getPressure()
 {
  static char buf[8];
@@ -347,6 +505,114 @@ static const char * yesNoTxt[] = {
       { handleGetPause }        // propGetter
     },
 
+    { PARAM_CHOICES,            // type
+      STR_MODE,                 // name
+      &valMode,                 // val
+      1,                        // step
+      0,                        // min
+      PROP_MODE_SIZE - 1,       // max
+      propModeTxt,              // text array for options
+      true,                     // no dynamic changes
+      handleChangeMode,         // change prop function
+      { handleGetMode }         // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_INSP_PRESSURE,        // name
+      &valInspPressure,         // val
+      1,                        // step
+      5,                        // min
+      40,                       // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeInspPressure, // change prop function
+      { handleGetInspPressure } // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_RISE_TIME,            // name
+      &valRiseTime,             // val
+      50,                       // step
+      0,                        // min
+      1000,                     // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeRiseTime,     // change prop function
+      { handleGetRiseTime }     // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_VOLUME_TARGET,        // name
+      &valVolumeTarget,         // val
+      10,                       // step
+      100,                      // min
+      1000,                     // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeVolumeTarget, // change prop function
+      { handleGetVolumeTarget } // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_TRIG_PRESSURE,        // name
+      &valTrigPressure,         // val
+      1,                        // step
+      0,                        // min, 0 = no pressure trigger
+      10,                       // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeTrigPressure, // change prop function
+      { handleGetTrigPressure } // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_TRIG_FLOW,            // name
+      &valTrigFlow,             // val
+      1,                        // step
+      0,                        // min, 0 = no flow trigger
+      10,                       // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeTrigFlow,     // change prop function
+      { handleGetTrigFlow }     // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_INSP_HOLD,            // name
+      &valInspHold,             // val
+      50,                       // step
+      0,                        // min, TM_WAIT_TO_OUT only
+      2000,                     // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeInspHold,     // change prop function
+      { handleGetInspHold }     // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_APNEA_TIME,           // name
+      &valApneaTime,            // val
+      5,                        // step
+      0,                        // min, 0 = no apnea monitor
+      60,                       // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeApneaTime,    // change prop function
+      { handleGetApneaTime }    // propGetter
+    },
+
+    { PARAM_INT,                // type
+      STR_BACKUP_BPM,           // name
+      &valBackupBpm,            // val
+      1,                        // step
+      10,                       // min
+      30,                       // max
+      0,                        // text array for options
+      true,                     // no dynamic changes
+      handleChangeBackupBpm,    // change prop function
+      { handleGetBackupBpm }    // propGetter
+    },
+
     {  PARAM_TEXT_GETTER,       // type
       STR_PRESSURE,             // name
       0,                        // val
@@ -392,6 +658,116 @@ static const char * yesNoTxt[] = {
 
     },
 
+    {  PARAM_TEXT_GETTER,       // type
+      STR_VOLUME_OVERSHOOT,     // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getVolumeOvershoot } // last volume control breath, delivered - target in mL
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_PIP,                  // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getPip } // last breath, cmH2O
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_PLATEAU,              // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getPlateau } // end of the inspiratory hold, cmH2O
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_PEEP_MEASURED,        // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getPeepMeasured } // end expiratory pressure, cmH2O
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_MINUTE_VOLUME,        // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getMinuteVolume } // L/min
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_IE_RATIO,             // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getIeRatio } // achieved, hold and pause included
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_COMPLIANCE,           // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getCompliance } // static, mL/cmH2O
+    },
+
+    {  PARAM_TEXT_GETTER,       // type
+      STR_RESISTANCE,           // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getResistance } // airway, cmH2O/(L/s)
+    },
+
+#if (FLOW_SENSOR_BIDIRECTIONAL == 1) // no leak estimate with an inlet only flow sensor
+    {  PARAM_TEXT_GETTER,       // type
+      STR_LEAK,                 // name
+      0,                        // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      0,                        // text array for options
+      false,                    // no dynamic changes
+      0,  // change prop function
+      { (propgetfunc_t) getLeak } // of the inspired volume, last breath
+    },
+#endif
+
     { PARAM_INT,                // type
       STR_PEEP,         // name
       &valDesiredPeep,          // val
@@ -452,6 +828,18 @@ static const char * yesNoTxt[] = {
       { handleGetHighTidal }    // propGetter
     },
 
+    { PARAM_CHOICES,            // type
+      STR_CALIB_VALVES,         // name
+      &valValveCalibration,     // val
+      1,                        // step
+      0,                        // min
+      1,                        // max
+      onOffTxt ,                // text array for options
+      false,                    // no dynamic changes
+      handleChangeValveCalibration, // change prop function, ventilation off and a test lung only
+      0,        // propGetter
+    },
+
     // *******************************************
     // NOTE: THIS MUST BE THE VERY LAST PARAMETER
     // *******************************************
@@ -493,15 +881,23 @@ params_t * loadParamRecord(int idx) {
 }
 #endif
 
-static void handleChangeCalibration(int val) {
+static void handleChangeCalibration(int) {
   breatherRequestFastCalibration();
   params_t * par = loadParamRecord(NUM_PARAMS - 1);
   *par->val = 0; // reset val
 }
 
+static void handleChangeValveCalibration(int val) {
+  if (val) breatherRequestValveCalibration();
+  valValveCalibration = 0; // reset val
+}
+
 
 //------------ Global -----------
-CUiNative::CUiNative()
+CUiNative::CUiNative() : CEvent(EVT_MASK(EVT_KEY_PRESS)          |
+                                 EVT_MASK(EVT_KEY_RELEASE)        |
+                                 EVT_MASK(EVT_ALARM_DISPLAY_ON)   |
+                                 EVT_MASK(EVT_ALARM_DISPLAY_OFF))
 {
     params_idx = 0;
     ui_state = SHOW_MODE;
@@ -513,6 +909,7 @@ CUiNative::CUiNative()
     blink_mask = 0;
     blink_phase = 0;
     alarm_mode = false;
+    alarm_handle = 0;
     bps = 10;
     dutyCycle = 0.1f;
 
@@ -573,11 +970,11 @@ void CUiNative::blinker()
 {   
     char buf[(LCD_NUM_COLS - PARAM_VAL_START_COL) + 1];
     int len = LCD_NUM_COLS - PARAM_VAL_START_COL;
-    memset(buf, 0x20, (size_t) len); // spaces
-    buf[len] = 0; // NULL terminate
 
     if (halCheckTimerExpired(tm_blink, TM_BLINK)) {
         tm_blink = halStartTimerRef();
+        memset(buf, 0x20, (size_t) len); // spaces
+        buf[len] = 0; // NULL terminate
 
 //        if (blink_mask == 0) return;
 
@@ -744,7 +1141,7 @@ propagate_t CUiNative::onEvent(event_t * event)
 
     if (event->type == EVT_ALARM_DISPLAY_ON) {
         alarm_mode = true;
-        strcpy(alarm_msg, event->param.tParam);
+        alarm_handle = event->param.handle;
         return PROPAGATE_STOP;
     }
 
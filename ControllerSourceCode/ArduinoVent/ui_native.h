@@ -83,7 +83,7 @@ public:
     int blink_phase; // = 0;
 
     bool alarm_mode; // = false;
-    char alarm_msg[LCD_NUM_COLS+1];
+    uint16_t alarm_handle;  // alarm shown, its text read from flash when drawn
 
     int bps; // = 10;
     float dutyCycle; // = 0.1f;
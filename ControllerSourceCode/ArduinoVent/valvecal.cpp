@@ -0,0 +1,226 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include "valvecal.h"
+#include "hal.h"
+#include "log.h"
+#include "pressure.h"
+#include "properties.h"
+#include "sched.h"
+
+#define VCAL_ROUNDS         4
+#define VCAL_VENT           1000    // ms, exhale open: empties the test lung
+#define VCAL_SETTLE         300     // ms, both closed before the inlet pulse
+#define VCAL_FILL           300     // ms, inlet open: fills the test lung / flows through the open exhale
+#define VCAL_HOLD           200     // ms, both closed: the held pressure settles
+#define VCAL_TIMEOUT        250     // ms, no response: valve or sensor not working, or no test lung
+
+#define VCAL_FLOW           3.0f    // L/min, inlet response, a few times the flow sensor noise
+#define VCAL_PRESS          0.5f    // cmH2O, exhale response
+#define VCAL_MIN_PRESS      2.0f    // cmH2O, held in the test lung for the exhale open step
+
+#define LAT_IN_OPEN         0
+#define LAT_IN_CLOSE        1
+#define LAT_OUT_OPEN        2
+#define LAT_OUT_CLOSE       3
+#define LAT_NUM             4
+
+#define ST_VENT             0
+#define ST_SETTLE           1
+#define ST_IN_OPEN          2       // waiting for the response of the command
+#define ST_FILL             3
+#define ST_IN_CLOSE         4
+#define ST_HOLD             5
+#define ST_OUT_OPEN         6
+#define ST_REFILL           7
+#define ST_OUT_CLOSE        8
+
+static uint8_t  status = VCAL_IDLE;
+static uint8_t  step;
+static uint8_t  cycle;      // round, 0..VCAL_ROUNDS - 1
+static uint32_t tm;         // last command or phase start
+static uint32_t lastTm;     // newest sample after the command that showed no response yet
+static float    ref;        // pressure before an exhale valve command
+static press_sample_t flowSample;
+static press_sample_t pressSample;
+static uint16_t sum[LAT_NUM];
+
+static void command(uint8_t st)
+{
+  tm = schedNow();
+  lastTm = tm;
+  step = st;
+}
+
+// a macro: LOG() takes the text as a literal and keeps it in flash
+#define FAIL(why) do { LOG(why); fail(); } while (0)
+
+static void fail()
+{
+  valveCalAbort();
+  status = VCAL_FAILED;
+}
+
+// true once the response shows: the latency is taken at the middle of the
+// interval between the last sample without it and the first one with it
+static bool respond(press_sample_t * s, bool responded, uint8_t idx)
+{
+  if ((int32_t) (s->stamp - tm) <= 0) return false; // converted before the command
+  if (!responded) {
+    lastTm = s->stamp;
+    return false;
+  }
+  sum[idx] += (uint16_t) ((lastTm - tm) + (s->stamp - lastTm) / 2);
+  return true;
+}
+
+static void store()
+{
+  uint8_t lat[LAT_NUM];
+  uint8_t i;
+
+  for (i = 0; i < LAT_NUM; i++) {
+    lat[i] = (uint8_t) ((sum[i] + VCAL_ROUNDS / 2) / VCAL_ROUNDS);
+  }
+  propSetInOpenLatency(lat[LAT_IN_OPEN]);
+  propSetInCloseLatency(lat[LAT_IN_CLOSE]);
+  propSetOutOpenLatency(lat[LAT_OUT_OPEN]);
+  propSetOutCloseLatency(lat[LAT_OUT_CLOSE]);
+  LOGV("Valve cal: in %d/%d out %d/%d ms", lat[LAT_IN_OPEN], lat[LAT_IN_CLOSE],
+       lat[LAT_OUT_OPEN], lat[LAT_OUT_CLOSE]);
+}
+
+void valveCalStart()
+{
+  uint8_t i;
+  for (i = 0; i < LAT_NUM; i++) sum[i] = 0;
+  cycle = 0;
+  status = VCAL_RUNNING;
+  halValveInClose();
+  halValveOutOpen();
+  command(ST_VENT);
+}
+
+bool valveCalLoop()
+{
+  bool newFlow, newPress;
+  uint32_t elapsed;
+
+  if (status != VCAL_RUNNING) return false;
+
+  newFlow = pressGetFastFlow(&flowSample);
+  newPress = pressGetFastSample(&pressSample);
+  elapsed = schedNow() - tm;
+
+  switch (step) {
+    case ST_VENT:
+      if (elapsed < VCAL_VENT) break;
+      halValveOutClose();
+      command(ST_SETTLE);
+      break;
+
+    case ST_SETTLE:
+      // each round lands on another phase of the sensor conversions
+      if (elapsed < VCAL_SETTLE + cycle * PRESSURE_READ_DELAY / VCAL_ROUNDS) break;
+      halValveInOpen();
+      command(ST_IN_OPEN);
+      break;
+
+    case ST_IN_OPEN:
+      if (newFlow && respond(&flowSample, flowSample.value > VCAL_FLOW, LAT_IN_OPEN)) {
+        step = ST_FILL; // timed from the command
+      }
+      else if (elapsed >= VCAL_TIMEOUT) FAIL("Valve cal: no inlet flow");
+      break;
+
+    case ST_FILL:
+      if (elapsed < VCAL_FILL) break;
+      halValveInClose();
+      command(ST_IN_CLOSE);
+      break;
+
+    case ST_IN_CLOSE:
+      if (newFlow && respond(&flowSample, flowSample.value < VCAL_FLOW, LAT_IN_CLOSE)) {
+        step = ST_HOLD;
+      }
+      else if (elapsed >= VCAL_TIMEOUT) FAIL("Valve cal: inlet flow does not stop");
+      break;
+
+    case ST_HOLD:
+      if (elapsed < VCAL_HOLD) break;
+      ref = pressGetVal(PRESSURE);
+      if (ref < VCAL_MIN_PRESS) {
+        FAIL("Valve cal: no pressure held, test lung?");
+        break;
+      }
+      halValveOutOpen();
+      command(ST_OUT_OPEN);
+      break;
+
+    case ST_OUT_OPEN:
+      if (newPress && respond(&pressSample, pressSample.value < ref - VCAL_PRESS, LAT_OUT_OPEN)) {
+        halValveInOpen(); // flows straight out: the pressure it holds is what the close step looks for
+        step = ST_REFILL;
+      }
+      else if (elapsed >= VCAL_TIMEOUT) FAIL("Valve cal: exhale does not vent");
+      break;
+
+    case ST_REFILL:
+      if (elapsed < VCAL_FILL) break;
+      ref = pressGetVal(PRESSURE);
+      halValveOutClose();
+      command(ST_OUT_CLOSE);
+      break;
+
+    case ST_OUT_CLOSE:
+      if (newPress && respond(&pressSample, pressSample.value > ref + VCAL_PRESS, LAT_OUT_CLOSE)) {
+        halValveInClose();
+        halValveOutOpen();
+        if (++cycle < VCAL_ROUNDS) {
+          command(ST_VENT);
+          break;
+        }
+        store();
+        status = VCAL_DONE;
+      }
+      else if (elapsed >= VCAL_TIMEOUT) FAIL("Valve cal: exhale does not close");
+      break;
+
+    default:
+      break;
+  }
+  return status == VCAL_RUNNING;
+}
+
+void valveCalAbort()
+{
+  if (status != VCAL_RUNNING) return;
+  halValveInClose();
+  halValveOutOpen();
+  status = VCAL_IDLE;
+}
+
+uint8_t valveCalGetStatus()
+{
+  return status;
+}
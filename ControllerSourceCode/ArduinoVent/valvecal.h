@@ -0,0 +1,55 @@
+#ifndef VALVECAL_H
+#define VALVECAL_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file valvecal.h
+ * @brief Valve latency calibration.
+ *
+ * Solenoids follow their command after a pull-in (open) and drop-out (close)
+ * delay that differs from one valve model to the next. With a test lung on the
+ * patient port and ventilation off, this routine pulses each valve and times
+ * the command to the first response:
+ *
+ *   inlet open / close    flow sensor crosses VCAL_FLOW
+ *   exhale open / close   airway pressure moves by VCAL_PRESS
+ *
+ * Each latency is the average of VCAL_ROUNDS rounds; the rounds are staggered
+ * against the sensor conversions so the sample period averages out. On success
+ * the four latencies go to the properties (propGetInOpenLatency()...), where
+ * the breather and the PEEP controller use them to issue commands early.
+ * A failed run leaves the stored values alone.
+ */
+
+#include <stdint.h>
+
+#define VCAL_IDLE       0
+#define VCAL_RUNNING    1
+#define VCAL_DONE       2
+#define VCAL_FAILED     3
+
+void    valveCalStart();    // takes both valves until valveCalLoop() returns false
+bool    valveCalLoop();     // every pass: true while running
+void    valveCalAbort();    // inlet closed, exhale open, nothing stored
+uint8_t valveCalGetStatus();
+
+#endif // VALVECAL_H
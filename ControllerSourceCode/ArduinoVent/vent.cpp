@@ -31,33 +31,59 @@
 #include "breather.h"
 #include "motor.h"
 #include "bmp280_int.h"
+#include "profiler.h"
+#include "sched.h"
 
 //------------ Global -----------
 void ventLoop()
 {
+  uint16_t idle;
+
+  PROF_CYCLE_MARK();
+
+  PROF_BEGIN(PROF_SCHED);
+  idle = schedRun(); // timed work: LED, keys, sampling, alarm sound, props save...
+  PROF_END(PROF_SCHED);
+
+  PROF_BEGIN(PROF_HAL);
   halLoop();
+  PROF_END(PROF_HAL);
+
+  PROF_BEGIN(PROF_EVT);
   evtDispatchAll();
+  PROF_END(PROF_EVT);
+
+  PROF_BEGIN(PROF_UI);
   uiNativeLoop();
+  PROF_END(PROF_UI);
+
+  PROF_BEGIN(PROF_BREATHER);
   breatherLoop();
+  PROF_END(PROF_BREATHER);
    
 #ifdef STEPPER_MOTOR_STEP_PIN
+  PROF_BEGIN(PROF_MOTOR);
   motorLoop();
+  PROF_END(PROF_MOTOR);
+#endif
+
+#if defined(SCHED_IDLE_SLEEP) && !defined(VENTSIM)
+  if (idle) halIdle(); // nothing due this millisecond: sleep until the next interrupt
+#else
+  (void) idle;
 #endif
 }
 
 void ventSetup()
 {
+#ifdef LOOP_PROFILE
+  profInit();
+#endif
   alarmInit();     // must be called before uiNativeInit
   uiNativeInit();
   
 #ifdef STEPPER_MOTOR_STEP_PIN
   motorInit();
 #endif
-
-#ifndef VENTSIM
-  #if (USE_BMP280_PRESSURE_SENSOR == 1)
-    bpm280Init();
-  #endif
-#endif
 }
  
@@ -0,0 +1,149 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+
+#include <string.h>
+#include <vector>
+#include "blackbox_file.h"
+#include "event.h"
+#include "breather.h"
+#include "alarm.h"
+#include "hal.h"
+
+// same order as EVENT_TYPE (event.h) and B_STATE_t (breather.h)
+static const char * const eventNames[] = {
+    "key press", "key release", "alarm", "alarm display on", "alarm display off",
+};
+static const char * const stateNames[] = {
+    "stopped", "in", "wait to out", "out", "initial fast calib", "fast calib", "pause", "stopping", "valve calib",
+};
+
+static const char * const prioNames[] = { "high", "medium", "low" }; // alarm_prio_t
+
+static void describe(const bbox_entry_t * e, char * d, size_t size)
+{
+    char msg[LCD_NUM_COLS + 1];
+    uint8_t t = e->type & 0x0f;
+
+    switch (e->type) {
+      case BBOX_BOOT:
+        snprintf(d, size, "boot            reset flags 0x%02x", e->arg);
+        return;
+      case BBOX_STATE:
+        snprintf(d, size, "state           %s", e->arg < sizeof(stateNames) / sizeof(stateNames[0]) ? stateNames[e->arg] : "?");
+        return;
+      case BBOX_VALVES:
+        snprintf(d, size, "valves          in %s, out %s", (e->arg & HAL_VALVE_IN_OPEN) ? "open" : "closed",
+                 (e->arg & HAL_VALVE_OUT_OPEN) ? "open" : "closed");
+        return;
+      case BBOX_ALARM_ON:
+        alarmGetMessage(e->arg, msg);
+        snprintf(d, size, "alarm on        %u %s (%s)", e->arg, msg, prioNames[alarmGetPriority(e->arg)]);
+        return;
+      case BBOX_ALARM_OFF:
+        if (e->arg == BBOX_ALL) snprintf(d, size, "alarm off       all");
+        else snprintf(d, size, "alarm off       %u", e->arg);
+        return;
+    }
+    if ((e->type & 0xf0) == BBOX_EVENT || (e->type & 0xf0) == BBOX_EVENT_ISR) {
+        const char * name = t < sizeof(eventNames) / sizeof(eventNames[0]) ? eventNames[t] : "?";
+        msg[0] = 0;
+        if (t == EVT_ALARM || t == EVT_ALARM_DISPLAY_ON) alarmGetMessage(e->arg, msg);
+        snprintf(d, size, "%-15s %s %u %s", (e->type & 0xf0) == BBOX_EVENT ? "event" : "event (isr)", name, e->arg, msg);
+        return;
+    }
+    snprintf(d, size, "type 0x%02x       arg 0x%02x", e->type, e->arg);
+}
+
+void bboxPrintTimeline(const bbox_entry_t * e, int n, FILE * out)
+{
+    std::vector<uint32_t> tm(n, 0);
+    char d[64];
+    int i, first = -1;
+    uint32_t hi = 0;
+
+    // after a BBOX_TIME the high bits are known, before the first one they are rebuilt
+    // backwards from the 16-bit differences
+    for (i=0; i<n; i++) {
+        if (e[i].type == BBOX_TIME) {
+            hi = e[i].tm;
+            if (first < 0) first = i;
+        }
+        tm[i] = (hi << 16) | (e[i].type == BBOX_TIME ? 0 : e[i].tm);
+    }
+    if (first >= 0) {
+        uint32_t t = (first + 1 < n) ? tm[first + 1] : (hi << 16);
+        uint16_t lo = (uint16_t) t;
+        for (i=first-1; i>=0; i--) {
+            t -= (uint16_t) (lo - e[i].tm);
+            lo = e[i].tm;
+            tm[i] = t;
+        }
+    }
+
+    for (i=0; i<n; i++) {
+        if (e[i].type == BBOX_TIME) continue;
+        describe(&e[i], d, sizeof(d));
+        fprintf(out, "%10.3f s  %s\n", tm[i] / 1000.0, d);
+    }
+}
+
+bool bboxFileDecode(const char * path, FILE * out)
+{
+    FILE * f = fopen(path, "r");
+    char line[128], src[8];
+    unsigned n, tm, type, arg;
+    unsigned long now;
+    std::vector<bbox_entry_t> entries;
+    bool in = false;
+    int dumps = 0;
+
+    if (f == NULL) return false;
+    while (fgets(line, sizeof(line), f)) {
+        // the tail of a telemetry frame can sit in front of the first line
+        const char * p = strstr(line, "BBOX");
+        if (p == NULL) p = line + strspn(line, " \t\r");
+        if (strncmp(p, "BBOX end", 8) == 0) {
+            if (!in) continue;
+            bboxPrintTimeline(entries.data(), (int) entries.size(), out);
+            in = false;
+            dumps++;
+        }
+        else if (sscanf(p, "BBOX %7s %u %lx", src, &n, &now) == 3) {
+            if (strcmp(src, "wdt") == 0)
+                fprintf(out, "black box: snapshot of the last watchdog reset, %u entries\n", n);
+            else
+                fprintf(out, "black box: %u entries, dumped at %.3f s\n", n, now / 1000.0);
+            entries.clear();
+            in = true;
+        }
+        else if (in && sscanf(p, "BB %x %x %x", &tm, &type, &arg) == 3) {
+            bbox_entry_t e;
+            e.tm = (uint16_t) tm;
+            e.type = (uint8_t) type;
+            e.arg = (uint8_t) arg;
+            entries.push_back(e);
+        }
+    }
+    fclose(f);
+    return dumps > 0;
+}
@@ -0,0 +1,39 @@
+#ifndef BLACKBOX_FILE_H
+#define BLACKBOX_FILE_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file blackbox_file.h
+ * @brief Decoder of black box dumps (ArduinoVent/blackbox.h) into a timeline.
+ *
+ * Accepts a capture of the debug serial port: log lines around the dumps are
+ * skipped, every dump found is printed. Times are rebuilt from the 16-bit
+ * entry times and the BBOX_TIME entries.
+ */
+
+#include <stdio.h>
+#include "blackbox.h"
+
+bool bboxFileDecode(const char * path, FILE * out); // false if missing or no dump in it
+void bboxPrintTimeline(const bbox_entry_t * e, int n, FILE * out); // oldest first
+
+#endif // BLACKBOX_FILE_H
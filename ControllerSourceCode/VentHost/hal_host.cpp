@@ -0,0 +1,454 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+#include "hal.h"
+#include "hal_host.h"
+#include "event.h"
+#include "config.h"
+#include "properties.h"
+#include "pressure.h"
+#include "profiler.h"
+#include "serialWriter.h"
+#include "blackbox.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef LOOP_PROFILE
+  #include <chrono>
+#endif
+
+//---------- Constants ----------
+
+#define STORAGE_SIZE 64   // same order as the ATmega EEPROM area used by props
+#define BBOX_STORAGE_SIZE 512 // the ATmega EEPROM area of the black box snapshot
+
+static MONITOR_LET_T monitor_led_speed = MONITOR_LED_NORMAL;
+
+//-------- variables --------
+static uint64_t virtualMicros;
+
+static uint64_t tm_led;
+
+static hal_tone_t tone_playing = HAL_TONE_OFF;
+static bool valve_in_open = false;
+static bool valve_out_open = false;
+static uint32_t valve_out_openings;
+
+static float sensorPressure;
+static float sensorFlow;
+
+static uint32_t telemetry_baud;
+static FILE *   telemetry_file;
+static uint32_t tx_level;           // bytes waiting in the emulated TX ring
+static uint64_t tx_drain_us;        // virtual time of the last drain
+static uint64_t tx_bytes;
+
+static uint8_t storage[STORAGE_SIZE];
+static uint8_t bbox_storage[BBOX_STORAGE_SIZE];
+static bool storage_valid = false;
+
+static char lcdBuffer [LCD_NUM_ROWS][LCD_NUM_COLS];
+static int cursor_col = 0, cursor_row = 0;
+
+//-------------------------------------------------------
+//-------         Virtual clock
+//-------------------------------------------------------
+
+void halHostAdvanceTime(uint32_t micros)
+{
+    virtualMicros += micros;
+}
+
+uint64_t halHostGetMicros()
+{
+    return virtualMicros;
+}
+
+uint64_t halStartTimerRef()
+{
+    return virtualMicros / 1000;
+}
+
+void halLatchTimerRef()
+{
+    // virtual time only moves between passes
+}
+
+bool halCheckTimerExpired(uint64_t timerRef, uint64_t time)
+{
+    uint64_t now = halStartTimerRef();
+    if (timerRef + time < now)
+        return true;
+    return false;
+}
+
+#ifdef ENABLE_MICROSEC_TIMER
+uint64_t halStartMicroTimerRef()
+{
+    return virtualMicros;
+}
+
+bool halCheckMicroTimerExpired(uint64_t microTimerRef, uint64_t time)
+{
+    if ( (microTimerRef + time) < virtualMicros)
+        return true;
+    return false;
+}
+#endif
+
+//-------------------------------------------------------
+
+void halInit(uint8_t reset_val)
+{
+  bboxInit(reset_val);
+  tm_led = halStartTimerRef();
+  halLcdClear();
+  propInit();
+  halValveInClose();
+  halValveOutOpen();
+  pressInit();
+  serialInit();
+}
+
+void halSetMonitorLED (MONITOR_LET_T speed)
+{
+  monitor_led_speed = speed;
+}
+
+MONITOR_LET_T halGetMonitorLED ()
+{
+  return monitor_led_speed;
+}
+
+void halBlinkLED()
+{
+  uint64_t tm;
+  if (monitor_led_speed == MONITOR_LED_FAST) {
+    tm = TM_MONITOR_LED_FAST;
+  }
+  else if (monitor_led_speed == MONITOR_LED_SLOW) {
+    tm = TM_MONITOR_LED_SLOW;
+  }
+  else {
+    tm = TM_MONITOR_LED_NORMAL;
+  }
+
+  if (halCheckTimerExpired(tm_led, tm)) {
+    tm_led = halStartTimerRef();
+  }
+}
+
+void halAlarmTone(hal_tone_t t)
+{
+  tone_playing = t;
+}
+
+bool halHostBeepIsOn()
+{
+  return tone_playing != HAL_TONE_OFF;
+}
+
+hal_tone_t halHostGetTone()
+{
+  return tone_playing;
+}
+
+//-------- display --------
+
+void halLcdClear()
+{
+    memset(lcdBuffer, 0x20, sizeof(lcdBuffer));
+    cursor_col = 0;
+    cursor_row = 0;
+}
+
+void halLcdSetCursor(int col, int row)
+{
+    if ( col >= LCD_NUM_COLS) {
+        LOG("halLcdSetCursor: bad cursor_col");
+        return;
+    }
+    if ( row >= LCD_NUM_ROWS) {
+        LOG("halLcdSetCursor: bad cursor_row");
+        return;
+    }
+    cursor_col = col;
+    cursor_row = row;
+}
+
+void halLcdWrite(const char * txt)
+{
+  int n;
+  n = strlen(txt);
+  if (n > ( LCD_NUM_COLS - cursor_col)) {
+      n = LCD_NUM_COLS - cursor_col;
+  }
+  memcpy(&lcdBuffer[cursor_row][cursor_col], txt, n);
+}
+
+void halLcdWrite(int col, int row, const char * txt)
+{
+    halLcdSetCursor(col, row);
+    halLcdWrite(txt);
+}
+
+const char * halHostGetLcdRow(int row)
+{
+    return &lcdBuffer[row][0];
+}
+
+//---------- valves -------------
+
+void halValveInOpen()
+{
+  valve_in_open = true;
+  bboxValves(halGetValveState());
+}
+void halValveInClose()
+{
+  valve_in_open = false;
+  bboxValves(halGetValveState());
+}
+void halValveOutOpen()
+{
+  if (!valve_out_open) valve_out_openings++;
+  valve_out_open = true;
+  bboxValves(halGetValveState());
+}
+void halValveOutClose()
+{
+  valve_out_open = false;
+  bboxValves(halGetValveState());
+}
+
+uint8_t halGetValveState()
+{
+  return (valve_in_open ? HAL_VALVE_IN_OPEN : 0) | (valve_out_open ? HAL_VALVE_OUT_OPEN : 0);
+}
+
+bool halHostValveInIsOpen()
+{
+  return valve_in_open;
+}
+bool halHostValveOutIsOpen()
+{
+  return valve_out_open;
+}
+uint32_t halHostGetValveOutOpenings()
+{
+  return valve_out_openings;
+}
+
+//---------- sensors -------------
+
+void halHostSetPressure(float cmH2O)
+{
+  sensorPressure = cmH2O;
+}
+
+void halHostSetFlow(float flow)
+{
+  sensorFlow = flow;
+}
+
+float halHostGetPressure()
+{
+  return sensorPressure;
+}
+
+float halHostGetFlow()
+{
+  return sensorFlow;
+}
+
+uint16_t halGetAnalogPressure()
+{
+    return 0;
+}
+
+uint16_t halGetAnalogFlow()
+{
+    return 0;
+}
+
+//-------- storage ----------
+// kept in RAM so every run starts from defaults and runs never share a file
+
+bool halSaveDataBlock(uint8_t * data, int size)
+{
+  if (size > STORAGE_SIZE) {
+      LOG("halSaveDataBlock: block too big.");
+      return false;
+  }
+  memcpy(storage, data, (size_t) size);
+  storage_valid = true;
+  return true;
+}
+
+bool halRestoreDataBlock(uint8_t * data, int size)
+{
+  if (size > STORAGE_SIZE) {
+      LOG("halRestoreDataBlock: block too big.");
+      return false;
+  }
+  memcpy(data, storage, (size_t) size);
+  return storage_valid;
+}
+
+bool halSaveBlackBox(int offset, const uint8_t * data, int size)
+{
+  if (offset < 0 || offset + size > BBOX_STORAGE_SIZE) {
+      LOG("halSaveBlackBox: out of the area.");
+      return false;
+  }
+  memcpy(bbox_storage + offset, data, (size_t) size);
+  return true;
+}
+
+bool halRestoreBlackBox(int offset, uint8_t * data, int size)
+{
+  if (offset < 0 || offset + size > BBOX_STORAGE_SIZE) {
+      LOG("halRestoreBlackBox: out of the area.");
+      return false;
+  }
+  memcpy(data, bbox_storage + offset, (size_t) size);
+  return true;
+}
+
+//-------- motor ----------
+void halMotorStep(bool) {}
+void halMotorDir(bool) {}
+bool halMotorEOC() { return false; }
+
+// Timer1 model: halHostMotorCompareMatch() plays one compare match of the ISR in hal.cpp
+static const uint16_t * motorRamp;
+static uint8_t          motorRampLen;
+static uint16_t         motorCruise;
+static uint16_t         motorSteps;
+static uint16_t         motorPos;
+static bool             motorRunning;
+static uint16_t         motorOcr;
+
+static uint16_t motorInterval(uint16_t n)
+{
+  uint16_t k = motorSteps - 1 - n; // steps left: decelerate on the mirrored ramp
+  if (n < k) k = n;
+  return (k < motorRampLen) ? motorRamp[k] : motorCruise;
+}
+
+void halMotorStop()
+{
+  motorRunning = false;
+}
+
+void halMotorRun(uint16_t steps, const uint16_t * ramp, uint8_t rampLen, uint16_t cruise)
+{
+  halMotorStop();
+  motorPos = 0;
+  if (steps == 0) return;
+
+  motorRamp = ramp;
+  motorRampLen = rampLen;
+  motorCruise = cruise;
+  motorSteps = steps;
+  motorOcr = halMotorCompare(motorInterval(0));
+  motorRunning = true;
+}
+
+bool halMotorIsRunning()
+{
+  return motorRunning;
+}
+
+uint16_t halMotorGetPosition()
+{
+  return motorPos;
+}
+
+bool halHostMotorCompareMatch(uint16_t * ocr)
+{
+  if (motorRunning == false) return false;
+  *ocr = motorOcr;                 // the interval that ends with this step
+  if (++motorPos >= motorSteps) motorRunning = false;
+  else motorOcr = halMotorCompare(motorInterval(motorPos));
+  return true;
+}
+
+#ifdef LOOP_PROFILE
+// real (wall clock) time: on the host the profiler measures CPU cost, not virtual time
+uint32_t halProfileMicros()
+{
+  static const auto t0 = std::chrono::steady_clock::now();
+  return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - t0).count();
+}
+#endif
+
+void halLoop()
+{
+  halBlinkLED();
+
+  PROF_BEGIN(PROF_PRESS);
+  pressLoop();
+  PROF_END(PROF_PRESS);
+}
+
+void halWriteSerial(char * s)
+{
+  fputs(s, stdout);
+}
+
+//-------- telemetry: emulates the UART ring, drained at the wire rate in virtual time ----------
+void halTelemetryInit(uint32_t baud)
+{
+  telemetry_baud = baud;
+  tx_level = 0;
+  tx_bytes = 0;
+  tx_drain_us = virtualMicros;
+}
+
+bool halTelemetryWrite(const uint8_t * data, uint8_t len)
+{
+  uint64_t sent = (virtualMicros - tx_drain_us) * (telemetry_baud / 10) / 1000000; // 10 bits per byte
+  if (sent) {
+    tx_level = (sent >= tx_level) ? 0 : tx_level - (uint32_t) sent;
+    tx_drain_us = virtualMicros;
+  }
+  if (tx_level == 0) tx_drain_us = virtualMicros;
+
+  if (tx_level + len > TELEMETRY_TX_RING_SIZE - 1)
+    return false;
+  tx_level += len;
+  tx_bytes += len;
+  if (telemetry_file) fwrite(data, 1, len, telemetry_file);
+  return true;
+}
+
+void halHostSetTelemetryFile(FILE * f)
+{
+  telemetry_file = f;
+}
+
+uint64_t halHostGetTelemetryBytes()
+{
+  return tx_bytes;
+}
@@ -0,0 +1,64 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file hal_host.h
+ * @brief Harness side of the headless host HAL.
+ *
+ * The firmware never reads a real clock in the host build: halStartTimerRef()
+ * and friends return a virtual time that only moves when the harness calls
+ * halHostAdvanceTime(). Sensors are likewise injected by the harness.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "hal.h"
+
+//--------- virtual clock ---------
+void     halHostAdvanceTime(uint32_t micros);
+uint64_t halHostGetMicros();
+
+//--------- injected sensors ---------
+void  halHostSetPressure(float cmH2O);   // gauge pressure returned by getCmH2OGauge()
+void  halHostSetFlow(float flow);        // flow returned by getFlowRate() in L/min
+float halHostGetPressure();
+float halHostGetFlow();
+
+//--------- actuators as seen by the harness ---------
+bool halHostValveInIsOpen();
+bool halHostValveOutIsOpen();
+uint32_t halHostGetValveOutOpenings(); // closed -> open transitions since boot
+bool halHostBeepIsOn();
+hal_tone_t halHostGetTone();           // burst pattern playing, HAL_TONE_OFF if silent
+
+const char * halHostGetLcdRow(int row); // not NULL terminated, LCD_NUM_COLS chars
+
+uint64_t halHostGetTelemetryBytes();    // bytes accepted by the telemetry port
+void     halHostSetTelemetryFile(FILE * f); // copy of every accepted byte, NULL to stop
+
+//--------- stepper ---------
+// one Timer1 compare match: issues a step and gives the OCR1A value that timed it.
+// false once the move is over
+bool halHostMotorCompareMatch(uint16_t * ocr);
+
+#endif // HAL_HOST_H
@@ -0,0 +1,570 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/*
+ * VentHost: headless soak runner.
+ *
+ * Runs ventSetup()/ventLoop() against hal_host.cpp. Every pass of the loop
+ * advances the virtual clock by a fixed step, so simulated time is decoupled
+ * from wall-clock time and hours of ventilation take seconds. The lung model
+ * (VentSim/lung_model.cpp) is stepped with the same dt and closes the loop
+ * through the injected pressure/flow sensors.
+ *
+ * With -r the lung is replaced by a sensor trace (ArduinoVent/trace.h): each
+ * record is injected when the virtual clock reaches its timestamp and the run
+ * ends with the trace, so a capture replays deterministically and as fast as
+ * the host allows. -T records such a trace from the run.
+ *
+ * -w gives the plant valves actuation delays; -K runs the valve calibration
+ * (ArduinoVent/valvecal.h) on the lung model before ventilation starts.
+ *
+ * -A stops the spontaneous efforts (-e) part way, to see the apnea monitor
+ * (ArduinoVent/apnea.h) declare it and the backup breaths that follow.
+ *
+ * -B ends the run with a black box dump (ArduinoVent/blackbox.h), as the
+ * device prints it on request; -D turns such a capture into a timeline.
+ *
+ * usage: VentHost [-m minutes] [-b bpm] [-d duty_idx] [-p pause_ms] [-M mode] [-P insp_press] [-t rise_ms] [-V volume_ml]
+ *                 [-g trig_press] [-f trig_flow] [-i hold_ms] [-H high_press] [-k horizon_ms] [-K] [-s step_us] [-C compliance] [-R resistance] [-L leak_r] [-e rate] [-a amplitude] [-A apnea_s] [-w delays]
+ *                 [-T trace_out] [-r trace_in] [-B] [-D capture] [-v] [-l]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "vent.h"
+#include "hal.h"
+#include "hal_host.h"
+#include "properties.h"
+#include "breather.h"
+#include "log.h"
+#include "lung_model.h"
+#include "profiler.h"
+#include "serialWriter.h"
+#include "trace.h"
+#include "trace_file.h"
+#include "trigger.h"
+#include "hplimit.h"
+#include "valvecal.h"
+#include "metrics.h"
+#include "apnea.h"
+#include "leak.h"
+#include "event.h"
+#include "blackbox.h"
+#include "blackbox_file.h"
+
+#define DEFAULT_MINUTES     60
+#define DEFAULT_STEP_US     1000    // one ventLoop() pass per simulated millisecond
+#define VALVE_CAL_MAX_US    60000000ULL // calibration runs a few seconds, give up after a minute
+
+typedef struct host_opts_st {
+    uint32_t minutes;
+    int      bpm;
+    int      duty;
+    int      pause;
+    int      mode;
+    int      insp_pressure;
+    int      rise;
+    int      volume;
+    int      trig_pressure;
+    int      trig_flow;
+    int      insp_hold;
+    uint32_t apnea_at;
+    int      high_pressure;
+    int      horizon;
+    bool     valve_cal;
+    uint32_t step_us;
+    bool     verbose;
+    bool     show_lcd;
+    const char * trace_out;
+    const char * replay;
+    bool     bbox_dump;
+    const char * bbox_decode;
+    lung_params_t lung;
+} host_opts_t;
+
+static void usage(const char * prg)
+{
+    lung_params_t o_def;
+    lungGetDefaults(&o_def);
+    fprintf(stderr, "usage: %s [-m minutes] [-b bpm] [-d duty_idx] [-p pause_ms] [-M mode] [-P insp_press] [-t rise_ms] [-V volume_ml]\n"
+                    "          [-g trig_press] [-f trig_flow] [-i hold_ms] [-H high_press] [-k horizon_ms] [-K] [-s step_us] [-C compliance] [-R resistance] [-L leak_r] [-e rate] [-a amplitude] [-A apnea_s] [-w delays]\n"
+                    "          [-T trace_out] [-r trace_in] [-B] [-D capture] [-v] [-l]\n", prg);
+    fprintf(stderr, "  -m  simulated minutes to run (default %d)\n", DEFAULT_MINUTES);
+    fprintf(stderr, "  -b  BPM setting (default: stored/default props)\n");
+    fprintf(stderr, "  -d  duty cycle index 0..%d\n", PROT_DUTY_CYCLE_SIZE - 1);
+    fprintf(stderr, "  -p  pause in milliseconds\n");
+    fprintf(stderr, "  -M  ventilation mode 0..%d (0 timed, 1 pressure control, 2 volume control)\n", PROP_MODE_SIZE - 1);
+    fprintf(stderr, "  -P  pressure control target in cmH2O\n");
+    fprintf(stderr, "  -t  pressure control rise time in milliseconds\n");
+    fprintf(stderr, "  -V  volume control target in mL\n");
+    fprintf(stderr, "  -g  assist: pressure trigger, cmH2O below PEEP (0 = off)\n");
+    fprintf(stderr, "  -f  assist: flow trigger, L/min (0 = off)\n");
+    fprintf(stderr, "  -i  inspiratory hold in milliseconds, on top of the 200 ms wait to exhale\n");
+    fprintf(stderr, "  -H  high pressure limit in cmH2O\n");
+    fprintf(stderr, "  -k  high pressure prediction horizon in milliseconds (default: calibrated inlet closing latency, or %d)\n", VALVE_CLOSE_LATENCY);
+    fprintf(stderr, "  -K  calibrate the valve latencies before ventilating\n");
+    fprintf(stderr, "  -s  virtual time advanced per loop pass in microseconds (default %d)\n", DEFAULT_STEP_US);
+    fprintf(stderr, "  -C  lung compliance in mL/cmH2O (default %.0f)\n", o_def.compliance);
+    fprintf(stderr, "  -R  airway resistance in cmH2O/(L/s) (default %.0f)\n", o_def.resistance);
+    fprintf(stderr, "  -L  leak resistance in cmH2O/(L/s), 0 = no leak\n");
+    fprintf(stderr, "  -e  spontaneous effort rate in breaths/min, 0 = passive\n");
+    fprintf(stderr, "  -a  spontaneous effort amplitude in cmH2O\n");
+    fprintf(stderr, "  -A  spontaneous efforts stop after this many simulated seconds (apnea)\n");
+    fprintf(stderr, "  -w  plant valve delays in ms: in_open,in_close,out_open,out_close (default 0)\n");
+    fprintf(stderr, "  -T  record the sensor trace to a file\n");
+    fprintf(stderr, "  -r  replay a sensor trace instead of the lung model (-m is ignored)\n");
+    fprintf(stderr, "  -B  dump the black box at the end, as the device does on 'b'\n");
+    fprintf(stderr, "  -D  decode the black box dumps of a serial capture into a timeline, then exit\n");
+    fprintf(stderr, "  -v  keep firmware logs\n");
+    fprintf(stderr, "  -l  print the LCD at the end\n");
+}
+
+static bool parseArgs(int argc, char * argv[], host_opts_t * o)
+{
+    int i;
+    o->minutes = DEFAULT_MINUTES;
+    o->bpm = -1;
+    o->duty = -1;
+    o->pause = -1;
+    o->mode = -1;
+    o->insp_pressure = -1;
+    o->rise = -1;
+    o->volume = -1;
+    o->trig_pressure = -1;
+    o->trig_flow = -1;
+    o->insp_hold = -1;
+    o->apnea_at = 0;
+    o->high_pressure = -1;
+    o->horizon = -1;
+    o->valve_cal = false;
+    o->step_us = DEFAULT_STEP_US;
+    o->verbose = false;
+    o->show_lcd = false;
+    o->trace_out = 0;
+    o->replay = 0;
+    o->bbox_dump = false;
+    o->bbox_decode = 0;
+    lungGetDefaults(&o->lung);
+
+    for (i=1; i<argc; i++) {
+        const char * a = argv[i];
+        const char * v = (i + 1 < argc) ? argv[i + 1] : 0;
+        if      (strcmp(a, "-v") == 0) o->verbose = true;
+        else if (strcmp(a, "-l") == 0) o->show_lcd = true;
+        else if (strcmp(a, "-K") == 0) o->valve_cal = true;
+        else if (strcmp(a, "-B") == 0) o->bbox_dump = true;
+        else if (v == 0) return false;
+        else if (strcmp(a, "-m") == 0) { o->minutes = (uint32_t) atol(v); i++; }
+        else if (strcmp(a, "-b") == 0) { o->bpm     = atoi(v); i++; }
+        else if (strcmp(a, "-d") == 0) { o->duty    = atoi(v); i++; }
+        else if (strcmp(a, "-p") == 0) { o->pause   = atoi(v); i++; }
+        else if (strcmp(a, "-M") == 0) { o->mode    = atoi(v); i++; }
+        else if (strcmp(a, "-P") == 0) { o->insp_pressure = atoi(v); i++; }
+        else if (strcmp(a, "-t") == 0) { o->rise    = atoi(v); i++; }
+        else if (strcmp(a, "-V") == 0) { o->volume  = atoi(v); i++; }
+        else if (strcmp(a, "-g") == 0) { o->trig_pressure = atoi(v); i++; }
+        else if (strcmp(a, "-f") == 0) { o->trig_flow     = atoi(v); i++; }
+        else if (strcmp(a, "-i") == 0) { o->insp_hold     = atoi(v); i++; }
+        else if (strcmp(a, "-H") == 0) { o->high_pressure = atoi(v); i++; }
+        else if (strcmp(a, "-k") == 0) { o->horizon       = atoi(v); i++; }
+        else if (strcmp(a, "-s") == 0) { o->step_us = (uint32_t) atol(v); i++; }
+        else if (strcmp(a, "-C") == 0) { o->lung.compliance      = (float) atof(v); i++; }
+        else if (strcmp(a, "-R") == 0) { o->lung.resistance      = (float) atof(v); i++; }
+        else if (strcmp(a, "-L") == 0) { o->lung.r_leak          = (float) atof(v); i++; }
+        else if (strcmp(a, "-e") == 0) { o->lung.spont_rate      = (float) atof(v); i++; }
+        else if (strcmp(a, "-a") == 0) { o->lung.spont_amplitude = (float) atof(v); i++; }
+        else if (strcmp(a, "-A") == 0) { o->apnea_at = (uint32_t) atol(v); i++; }
+        else if (strcmp(a, "-w") == 0) {
+            if (sscanf(v, "%f,%f,%f,%f", &o->lung.in_open_delay, &o->lung.in_close_delay,
+                       &o->lung.out_open_delay, &o->lung.out_close_delay) != 4) return false;
+            i++;
+        }
+        else if (strcmp(a, "-T") == 0) { o->trace_out = v; i++; }
+        else if (strcmp(a, "-r") == 0) { o->replay    = v; i++; }
+        else if (strcmp(a, "-D") == 0) { o->bbox_decode = v; i++; }
+        else return false;
+    }
+    if (o->step_us == 0) return false;
+    if (o->mode >= PROP_MODE_SIZE) return false;
+    if (o->lung.compliance <= 0.0f || o->lung.resistance <= 0.0f) return false;
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    host_opts_t opts;
+    if (parseArgs(argc, argv, &opts) == false) {
+        usage(argv[0]);
+        return 1;
+    }
+    logSetQuiet(!opts.verbose);
+
+    if (opts.bbox_decode) {
+        if (bboxFileDecode(opts.bbox_decode, stdout) == false) {
+            fprintf(stderr, "%s: no black box dump\n", opts.bbox_decode);
+            return 1;
+        }
+        return 0;
+    }
+
+    trace_file_t tf;
+    trace_record_t rec;
+    bool replay = opts.replay != 0;
+    bool more = false;
+    uint64_t next_rec_us = 0;
+    uint32_t valve_mismatch = 0;
+    if (replay) {
+        if (traceFileOpen(&tf, opts.replay) == false) {
+            fprintf(stderr, "%s: not a sensor trace\n", opts.replay);
+            return 1;
+        }
+        more = traceFileNext(&tf, &rec);
+        // the pressure task samples every samplePeriod from boot: line the first record up with it
+        next_rec_us = (uint64_t) tf.hdr.samplePeriod * 1000 + (uint64_t) rec.dt * 1000;
+    }
+
+    lungInit(&opts.lung);
+    halInit(0);
+    ventSetup();
+
+    if (opts.bpm > 0)    propSetBpm((uint8_t) opts.bpm);
+    if (opts.duty >= 0)  propSetDutyCycle((uint8_t) opts.duty);
+    if (opts.pause >= 0) propSetPause(opts.pause);
+    if (opts.mode >= 0)  propSetMode(opts.mode);
+    if (opts.insp_pressure >= 0) propSetInspPressure(opts.insp_pressure);
+    if (opts.rise >= 0)  propSetRiseTime(opts.rise);
+    if (opts.volume > 0) propSetVolumeTarget(opts.volume);
+    if (opts.trig_pressure >= 0) propSetTrigPressure(opts.trig_pressure);
+    if (opts.trig_flow >= 0)     propSetTrigFlow(opts.trig_flow);
+    if (opts.insp_hold >= 0)     propSetInspHold(opts.insp_hold);
+    if (opts.high_pressure > 0)  propSetHighPressure(opts.high_pressure);
+    if (opts.horizon >= 0)       hplSetHorizon((uint16_t) opts.horizon);
+
+    float dt = (float) opts.step_us / 1000000.0f;
+    if (opts.valve_cal && !replay) {
+        // the lung model is the test lung
+        breatherRequestValveCalibration();
+        do {
+            halHostSetPressure(lungGetPressure());
+            halHostSetFlow(lungGetFlow());
+            ventLoop();
+            halHostAdvanceTime(opts.step_us);
+            lungStep(dt, halHostValveInIsOpen(), halHostValveOutIsOpen());
+        } while (valveCalGetStatus() < VCAL_DONE && halHostGetMicros() < VALVE_CAL_MAX_US);
+    }
+    propSetVent(1);
+
+    FILE * trace_out = 0;
+    if (opts.trace_out) {
+        trace_out = fopen(opts.trace_out, "wb");
+        if (trace_out == 0) {
+            fprintf(stderr, "%s: cannot create\n", opts.trace_out);
+            return 1;
+        }
+        halHostSetTelemetryFile(trace_out);
+        traceStart();
+    }
+
+    uint64_t end_us = halHostGetMicros() + (uint64_t) opts.minutes * 60 * 1000000;
+    uint64_t passes = 0;
+    uint32_t breaths = 0;
+    uint64_t first_breath_us = 0, last_breath_us = 0;
+    B_STATE_t last_state = breatherGetState();
+    float pip = 0.0f, pip_sum = 0.0f, vt_max = 0.0f, vt_sum = 0.0f;
+    float eep_sum = 0.0f, eep_min = 1000.0f, eep_max = -1000.0f;
+    uint32_t valve_out_first = 0;
+    std::vector<float> insp;        // airway pressure of every pass of the current inspiration
+    double plateau_sum = 0.0;
+    float v_start = 0.0f, vdel_sum = 0.0f;
+    int ovs, ovs_min = 0x7fff, ovs_max = -0x7fff;
+    long ovs_sum = 0;
+    uint32_t ovs_n = 0;
+    uint64_t effort_us = 0;         // onset of the last spontaneous effort seen in expiration
+    uint64_t cross_us = 0;
+    bool effort = false;
+    uint16_t trig_count = 0;
+    uint32_t assisted = 0, effort_n = 0, cross_n = 0;
+    double effort_delay_sum = 0.0, cross_delay_sum = 0.0, cross_delay_max = 0.0;
+    uint32_t trig_latency_sum = 0;
+    uint32_t pip_over = 0;
+    float pip_over_max = 0.0f;
+    bool plant_in = false, plant_out = false;   // valve states after the plant delays
+    uint64_t in_on_us = 0, in_off_us = 0;
+    double in_open_sum = 0.0, hold_sum = 0.0;
+    uint32_t in_open_n = 0, hold_n = 0;
+    uint64_t apnea_us = 0, declared_us = 0, backup_first_us = 0, backup_last_us = 0;
+    uint32_t backup_n = 0;
+    double leak_ml = 0.0, leak_first = 0.0, leak_last = 0.0; // plant leak, mL since start
+    double vt_comp_sum = 0.0;
+    uint16_t apnea_count = apneaGetCount();
+
+    auto wall_start = std::chrono::steady_clock::now();
+
+    while (replay ? more : halHostGetMicros() < end_us) {
+        if (replay) {
+            while (more && halHostGetMicros() >= next_rec_us) {
+                // valves are sampled before the record's values are consumed, same as when recording
+                if (halGetValveState() != rec.valves) valve_mismatch++;
+                halHostSetPressure(rec.pressure * tf.hdr.pressScale);
+                halHostSetFlow(rec.flow * tf.hdr.flowScale);
+                more = traceFileNext(&tf, &rec);
+                if (more) next_rec_us += (uint64_t) rec.dt * 1000;
+            }
+        }
+        else {
+            halHostSetPressure(lungGetPressure());
+            halHostSetFlow(lungGetFlow());
+        }
+
+        ventLoop();
+        passes++;
+
+        B_STATE_t st = breatherGetState();
+        if (apneaGetCount() != apnea_count) {
+            apnea_count = apneaGetCount();
+            if (declared_us == 0) declared_us = halHostGetMicros();
+        }
+        if (st == B_ST_IN && last_state != B_ST_IN && apneaIsActive()) {
+            if (backup_n == 0) backup_first_us = halHostGetMicros();
+            backup_last_us = halHostGetMicros();
+            backup_n++;
+        }
+        if (st == B_ST_IN) {
+            insp.push_back(replay ? halHostGetPressure() : lungGetPressure());
+        }
+        else if (last_state == B_ST_IN && breaths > 1) {
+            // plateau: mean airway pressure over the second half of the inspiration
+            size_t k;
+            double sum = 0.0;
+            for (k = insp.size() / 2; k < insp.size(); k++) sum += insp[k];
+            plateau_sum += sum / (insp.size() - insp.size() / 2);
+        }
+        if (st == B_ST_OUT && last_state != B_ST_OUT && breaths > 1 && propGetMode() == PROP_MODE_VC) {
+            ovs = breatherGetVolumeOvershoot();
+            ovs_sum += ovs;
+            ovs_n++;
+            if (ovs < ovs_min) ovs_min = ovs;
+            if (ovs > ovs_max) ovs_max = ovs;
+        }
+        if (st == B_ST_IN && last_state != B_ST_IN) {
+            if (triggerGetCount() != trig_count) {
+                trig_count = triggerGetCount();
+                assisted++;
+                trig_latency_sum += triggerGetLatency();
+                if (effort_us > last_breath_us) {
+                    // patient side: includes the effort building up to the sensitivity
+                    effort_delay_sum += (double) (halHostGetMicros() - effort_us) / 1000.0;
+                    effort_n++;
+                }
+                if (cross_us > last_breath_us) {
+                    // plant pressure crossed the threshold: sampling + detection + valve command
+                    double d = (double) (halHostGetMicros() - cross_us) / 1000.0;
+                    cross_delay_sum += d;
+                    if (d > cross_delay_max) cross_delay_max = d;
+                    cross_n++;
+                }
+            }
+            insp.clear();
+            last_breath_us = halHostGetMicros();
+            leak_last = leak_ml;
+            if (breaths == 0) {
+                first_breath_us = last_breath_us;
+                leak_first = leak_ml;
+            }
+            else {
+                // end expiratory pressure: alveolar, the airway reads lower if the exhale valve is still open
+                float eep = replay ? halHostGetPressure() : lungGetVolume() / opts.lung.compliance;
+                pip_sum += pip;
+                if (pip > propGetHighPressure()) {
+                    pip_over++;
+                    if (pip - propGetHighPressure() > pip_over_max) pip_over_max = pip - propGetHighPressure();
+                }
+                vt_sum += vt_max;
+                vdel_sum += vt_max - v_start;
+                vt_comp_sum += leakGetTidalVolume();
+                eep_sum += eep;
+                if (eep < eep_min) eep_min = eep;
+                if (eep > eep_max) eep_max = eep;
+            }
+            if (breaths == 0) valve_out_first = halHostGetValveOutOpenings();
+            breaths++;
+            pip = 0.0f;
+            vt_max = 0.0f;
+            v_start = replay ? 0.0f : lungGetVolume();
+        }
+        last_state = st;
+
+        halHostAdvanceTime(opts.step_us);
+        if (replay) {
+            if (halHostGetPressure() > pip) pip = halHostGetPressure();
+            continue;
+        }
+        if (opts.apnea_at && apnea_us == 0 && halHostGetMicros() >= (uint64_t) opts.apnea_at * 1000000) {
+            apnea_us = halHostGetMicros();
+            lungSetEffort(0.0f, 0.0f); // the patient stops breathing
+        }
+        lungStep(dt, halHostValveInIsOpen(), halHostValveOutIsOpen());
+        if (opts.lung.r_leak > 0.0f && lungGetPressure() > 0.0f)
+            leak_ml += lungGetPressure() / opts.lung.r_leak * dt * 1000.0;
+        // onset of the effort, and the first time the plant crossed the pressure trigger
+        if (st == B_ST_OUT || st == B_ST_PAUSE) {
+            if (lungGetMusclePressure() > 0.0f && !effort) effort_us = halHostGetMicros();
+            if (cross_us <= last_breath_us && !halHostValveOutIsOpen() &&
+                lungGetPressure() < propGetDesiredPeep() - propGetTrigPressure())
+                cross_us = halHostGetMicros();
+        }
+        effort = lungGetMusclePressure() > 0.0f;
+        // what the patient gets: inlet flow time, and the hold until the exhale valve opens
+        if (lungValveInIsOpen() && !plant_in) in_on_us = halHostGetMicros();
+        if (!lungValveInIsOpen() && plant_in && breaths > 1) {
+            in_open_sum += (double) (halHostGetMicros() - in_on_us) / 1000.0;
+            in_open_n++;
+            in_off_us = halHostGetMicros();
+        }
+        if (lungValveOutIsOpen() && !plant_out && in_off_us) {
+            hold_sum += (double) (halHostGetMicros() - in_off_us) / 1000.0;
+            hold_n++;
+            in_off_us = 0;
+        }
+        plant_in = lungValveInIsOpen();
+        plant_out = lungValveOutIsOpen();
+        if (lungGetPressure() > pip) pip = lungGetPressure();
+        if (lungGetVolume() > vt_max) vt_max = lungGetVolume();
+    }
+
+    auto wall_end = std::chrono::steady_clock::now();
+    double wall_s = std::chrono::duration<double>(wall_end - wall_start).count();
+    double sim_s = (double) halHostGetMicros() / 1000000.0;
+
+    printf("simulated time   : %.1f s\n", sim_s);
+    printf("wall time        : %.3f s\n", wall_s);
+    printf("speed-up         : %.0fx\n", wall_s > 0 ? sim_s / wall_s : 0.0);
+    printf("loop passes      : %llu\n", (unsigned long long) passes);
+    printf("breaths          : %u\n", breaths);
+    printf("telemetry        : %llu bytes, %u frames dropped\n",
+           (unsigned long long) halHostGetTelemetryBytes(), serialGetDroppedFrames());
+    printf("events           : deepest ring %u alarm, %u key; %u alarm, %u key events dropped\n",
+           evtGetMaxDepth(EVT_PRIO_ALARM), evtGetMaxDepth(EVT_PRIO_UI),
+           evtGetDropped(EVT_PRIO_ALARM), evtGetDropped(EVT_PRIO_UI));
+    if (halHostGetTone() != HAL_TONE_OFF)
+        printf("alarm sound      : %s priority burst\n", halHostGetTone() == HAL_TONE_HIGH ? "high" :
+               halHostGetTone() == HAL_TONE_MEDIUM ? "medium" : "low");
+    if (trace_out) {
+        traceStop();
+        halHostSetTelemetryFile(0);
+        fclose(trace_out);
+        printf("trace            : %s, %u records dropped\n", opts.trace_out, traceGetDropped());
+    }
+    if (opts.valve_cal && !replay) {
+        if (valveCalGetStatus() == VCAL_DONE)
+            printf("valve calibration: in %d/%d, out %d/%d ms open/close (plant %.0f/%.0f, %.0f/%.0f)\n",
+                   propGetInOpenLatency(), propGetInCloseLatency(), propGetOutOpenLatency(), propGetOutCloseLatency(),
+                   opts.lung.in_open_delay, opts.lung.in_close_delay, opts.lung.out_open_delay, opts.lung.out_close_delay);
+        else
+            printf("valve calibration: FAILED\n");
+    }
+    if (replay) {
+        printf("replayed records : %u (%.0f records/s)\n", tf.records, wall_s > 0 ? tf.records / wall_s : 0.0);
+        printf("valve mismatches : %u\n", valve_mismatch);
+        traceFileClose(&tf);
+    }
+    if (breaths > 1) {
+        double period_ms = (double) (last_breath_us - first_breath_us) / 1000.0 / (breaths - 1);
+        printf("avg breath period: %.1f ms (%.2f BPM, set %d)\n", period_ms, 60000.0 / period_ms, propGetBpm());
+        printf("avg PIP (%s)  : %.1f cmH2O\n", replay ? "trace" : "plant", pip_sum / (breaths - 1));
+        printf("avg plateau      : %.1f cmH2O (second half of inspiration)\n", plateau_sum / (breaths - 1));
+        if (!replay)
+            printf("avg Vt (plant)   : %.0f mL, %.0f mL delivered per breath\n",
+                   vt_sum / (breaths - 1), vdel_sum / (breaths - 1));
+        if (in_open_n && propGetMode() == PROP_MODE_TIMED) {
+            int in_out_t = 60000 / propGetBpm() - (propGetDutyCycle() + 200);
+            printf("inlet open (plant): avg %.1f ms (set %d), then %.1f ms to the exhale valve opening\n",
+                   in_open_sum / in_open_n, (in_out_t / 2) / (propGetDutyCycle() + 1),
+                   hold_n ? hold_sum / hold_n : 0.0);
+        }
+        if (ovs_n)
+            printf("VC overshoot     : avg %.1f, min %d, max %d mL (target %d, firmware integrator)\n",
+                   (double) ovs_sum / ovs_n, ovs_min, ovs_max, propGetVolumeTarget());
+        printf("PEEP (%s)     : avg %.2f, min %.2f, max %.2f cmH2O (set %d)\n", replay ? "trace" : "plant",
+               eep_sum / (breaths - 1), eep_min, eep_max, propGetDesiredPeep());
+        if (hplGetTrips(HPL_PREDICTED) || hplGetTrips(HPL_LATE)) {
+            printf("high pressure    : %u predicted, %u late trips; %u breaths over %d cmH2O (%s), worst +%.2f\n",
+                   hplGetTrips(HPL_PREDICTED), hplGetTrips(HPL_LATE), pip_over, propGetHighPressure(),
+                   replay ? "trace" : "plant", pip_over_max);
+        }
+        if (assisted) {
+            printf("assisted breaths : %u of %u, trigger to valve avg %.1f ms, max %u ms (limit %d)\n",
+                   assisted, breaths, (double) trig_latency_sum / assisted, triggerGetMaxLatency(), TRIG_MAX_LATENCY);
+            if (cross_n)
+                printf("plant to valve   : avg %.1f ms, max %.1f ms (airway below the trigger -> inlet valve)\n",
+                       cross_delay_sum / cross_n, cross_delay_max);
+            if (effort_n)
+                printf("effort to valve  : avg %.1f ms (effort onset -> inlet valve)\n", effort_delay_sum / effort_n);
+        }
+        printf("exhale valve     : %.1f openings per breath\n",
+               (double) (halHostGetValveOutOpenings() - valve_out_first) / (breaths - 1));
+        if (apnea_us) {
+            if (declared_us)
+                printf("apnea            : declared %.1f s after the efforts stopped (interval %d s), first backup breath %.0f ms later\n",
+                       (double) (declared_us - apnea_us) / 1000000.0, propGetApneaTime(),
+                       backup_n ? (double) (backup_first_us - declared_us) / 1000.0 : -1.0);
+            else
+                printf("apnea            : not declared (interval %d s)\n", propGetApneaTime());
+            if (backup_n > 1)
+                printf("backup breaths   : %u, avg period %.1f ms (backup %d BPM, set %d)\n", backup_n,
+                       (double) (backup_last_us - backup_first_us) / 1000.0 / (backup_n - 1), propGetBackupBpm(), propGetBpm());
+        }
+        if (!replay && opts.lung.r_leak > 0.0f)
+            printf("leak             : %.0f mL per breath (%u %%, %.1f L/min), plant %.0f mL; Vt compensated %.0f mL (plant %.0f)\n",
+                   leakGetVolume(), leakGetPercent(), leakGetFlow(), (leak_last - leak_first) / (breaths - 1),
+                   vt_comp_sum / (breaths - 1), vdel_sum / (breaths - 1));
+        // firmware's own numbers for the last breath, MET_NONE (-1) when not measured
+        printf("metrics (last)   : PIP %.1f, plateau %.1f, PEEP %.2f cmH2O, Vt %.0f mL, MV %.2f L/min, I:E 1:%.1f\n",
+               metGetPip(), metGetPlateau(), metGetPeep(), metGetTidalVolume(), metGetMinuteVolume(), metGetIE());
+        if (!replay)
+            printf("mechanics (last) : Cstat %.1f mL/cmH2O (plant %.0f), Raw %.1f cmH2O/(L/s) (plant %.0f)\n",
+                   metGetCompliance(), opts.lung.compliance, metGetResistance(), opts.lung.resistance);
+        else
+            printf("mechanics (last) : Cstat %.1f mL/cmH2O, Raw %.1f cmH2O/(L/s)\n",
+                   metGetCompliance(), metGetResistance());
+    }
+
+#ifdef LOOP_PROFILE
+    profReport();
+#endif
+
+    if (opts.bbox_dump) bboxDump(false);
+
+    if (opts.show_lcd) {
+        int r;
+        char row[LCD_NUM_COLS + 1];
+        for (r=0; r<LCD_NUM_ROWS; r++) {
+            memcpy(row, halHostGetLcdRow(r), LCD_NUM_COLS);
+            row[LCD_NUM_COLS] = 0;
+            printf("|%s|\n", row);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+/*
+ * MotorRamp: stepper pulse train check.
+ *
+ * Runs the stepper profile (ArduinoVent/motor.cpp) against the Timer1 model of
+ * hal_host.cpp, one inspiration and one exhalation per stroke time, and checks
+ * every OCR1A value the ISR would load:
+ *   - the interval is within the profile's range, so nothing wrapped in 16 bits
+ *   - STEP stays high HAL_MOTOR_PULSE_US and low as long again at least
+ * Then it feeds halMotorRun() intervals beyond the timer range directly.
+ * The exit status is the number of failed checks.
+ *
+ * usage: MotorRamp
+ */
+
+#include <stdio.h>
+#include "hal.h"
+#include "hal_host.h"
+#include "motor.h"
+
+#define DRV8825_PULSE_NS    1900    // minimum STEP high and low time
+#define MIN_STEP_US         1200    // MIN_STEP_PERIOD, motor.cpp
+#define MAX_STEP_US         32000   // MAX_STEP_PERIOD, motor.cpp
+
+static int failures;
+
+static void check(bool ok, const char * what, unsigned value)
+{
+    if (ok) return;
+    printf("FAIL: %s (%u)\n", what, value);
+    failures++;
+}
+
+// plays a move to its end, returns its length in microseconds
+static uint32_t playMove(uint16_t * steps)
+{
+    uint16_t ocr;
+    uint32_t us, total = 0;
+
+    *steps = 0;
+    while (halHostMotorCompareMatch(&ocr)) {
+        us = ((uint32_t) ocr + 1) / HAL_MOTOR_TICKS_PER_US;
+        check(us >= MIN_STEP_US && us <= MAX_STEP_US, "step interval out of the profile range", us);
+        check(us * 1000 >= (HAL_MOTOR_PULSE_US * 1000UL) + DRV8825_PULSE_NS, "STEP low too short", us);
+        total += us;
+        (*steps)++;
+    }
+    motorLoop();
+    return total;
+}
+
+static void stroke(int ms)
+{
+    uint16_t in, out;
+    uint32_t tin, tout;
+
+    motorStartInspiration(ms);
+    tin = playMove(&in);
+    motorStartExhalation(ms);
+    tout = playMove(&out);
+    check(in == out && in == motorGetStroke(), "exhalation steps differ from the stroke", out);
+    printf("stroke %5d ms: in %3u steps %6.0f ms, out %3u steps %6.0f ms\n", ms, in, tin / 1000.0, out, tout / 1000.0);
+}
+
+static void clamp(uint16_t us, uint16_t expected)
+{
+    uint16_t ocr = 0;
+
+    halMotorRun(1, NULL, 0, us);
+    halHostMotorCompareMatch(&ocr);
+    printf("interval %5u us: OCR1A %5u\n", us, ocr);
+    check(ocr == expected, "interval not clamped", ocr);
+}
+
+int main()
+{
+    static const int times[] = { 500, 1000, 2000, 3000, 5000, 20000 };
+    unsigned i;
+
+    check(HAL_MOTOR_PULSE_US * 1000 >= DRV8825_PULSE_NS, "STEP pulse under the driver minimum", HAL_MOTOR_PULSE_US);
+    motorInit();
+    for (i=0; i<sizeof(times) / sizeof(times[0]); i++) stroke(times[i]);
+
+    clamp(0, HAL_MOTOR_MIN_INTERVAL_US * HAL_MOTOR_TICKS_PER_US - 1);
+    clamp(MAX_STEP_US, MAX_STEP_US * HAL_MOTOR_TICKS_PER_US - 1);
+    clamp(40000, 0xffff);   // 79999 ticks: wrapped to a 7 ms interval before the clamp
+    clamp(0xffff, 0xffff);
+
+    printf("%d failures\n", failures);
+    return failures;
+}
@@ -0,0 +1,96 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+// Host replacements for bmp280_int.cpp and toyotaMafSensor.cpp.
+// Sensor values come from whatever the harness injected through hal_host.h
+
+#include "config.h"
+#include "bmp280_int.h"
+#include "toyotaMafSensor.h"
+#include "hal_host.h"
+#include <stdint.h>
+
+#define AMBIENT_PA      101325.0f
+#define CMH2O_TO_PA     98.0665f
+
+void  bpm280Init()
+{
+
+}
+
+float bpm280GetPressure() // absolute pressure in Pa, ex:  101982.90
+{
+    return AMBIENT_PA + halHostGetPressure() * CMH2O_TO_PA;
+}
+
+void  bmp280Loop()
+{
+
+}
+
+void  bmp280SetReference()
+{
+
+}
+
+float getCmH2OGauge()
+{
+    return halHostGetPressure();
+}
+
+// a conversion completes every BMP280_READ_PERIOD of virtual time; its value is whatever is injected
+uint16_t bmp280GetSampleSeq()
+{
+    return (uint16_t) (halHostGetMicros() / 1000 / BMP280_READ_PERIOD);
+}
+
+uint32_t bmp280GetSampleTime()
+{
+    return (uint32_t) (halHostGetMicros() / 1000 / BMP280_READ_PERIOD * BMP280_READ_PERIOD);
+}
+
+float getFlowRate()
+{
+    return halHostGetFlow();
+}
+
+// the ADC scan engine converts the flow channel every other 1024 us tick (flow + joystick),
+// into a 4 deep ring: a reader that falls further behind loses the oldest conversions
+#define FLOW_CONV_US    2048
+#define FLOW_RING_SIZE  4
+
+static uint64_t flowNext = FLOW_CONV_US;
+
+uint8_t mafReadFlow(flow_sample_t * samples, uint8_t max)
+{
+    uint64_t now = halHostGetMicros();
+    uint8_t n = 0;
+
+    if (flowNext + FLOW_RING_SIZE * FLOW_CONV_US <= now)
+        flowNext = now - (now % FLOW_CONV_US) - (FLOW_RING_SIZE - 1) * FLOW_CONV_US;
+    while (flowNext <= now && n < max) {
+        samples[n].flow = halHostGetFlow();
+        samples[n].stamp = (uint32_t) flowNext;
+        flowNext += FLOW_CONV_US;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,309 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+/*
+ * VentSweep: breath timing accuracy map.
+ *
+ * Runs the firmware (breather FSM, pressure task, scheduler...) against the
+ * lung model for every point of a settings grid and reports commanded vs
+ * achieved timing, PIP and tidal volume. The default grid is the UI range:
+ * BPM 10..30 step 5, the 4 duty cycles, pause 0..2000 step 50.
+ *
+ * The firmware keeps its state in file-static globals, so instances cannot
+ * share an address space: every grid point runs in its own forked process
+ * (fresh state, fresh virtual clock) and up to -j of them run at once. Results
+ * come back through a shared anonymous mapping.
+ *
+ * usage: VentSweep [-b min:max:step] [-d min:max] [-p min:max:step] [-n breaths]
+ *                  [-s step_us] [-C compliance] [-R resistance] [-j jobs] [-c]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <chrono>
+
+#include "vent.h"
+#include "hal.h"
+#include "hal_host.h"
+#include "properties.h"
+#include "breather.h"
+#include "log.h"
+#include "lung_model.h"
+
+#define DEFAULT_STEP_US     1000
+#define DEFAULT_BREATHS     10      // measured breaths per point
+#define SETTLE_BREATHS      2       // first breaths are not measured (initial calibration, PEEP build up)
+#define MAX_SIM_MINUTES     10      // per point, in case a setting never breathes
+
+typedef struct range_st {
+    int min;
+    int max;
+    int step;
+} range_t;
+
+typedef struct sweep_opts_st {
+    range_t  bpm;
+    range_t  duty;
+    range_t  pause;
+    int      breaths;
+    uint32_t step_us;
+    int      jobs;
+    bool     csv;
+    lung_params_t lung;
+} sweep_opts_t;
+
+typedef struct sweep_point_st {
+    int bpm;
+    int duty;
+    int pause;
+} sweep_point_t;
+
+typedef struct sweep_result_st {
+    bool     done;
+    int      breaths;       // measured
+    double   period_ms;     // average start to start
+    double   in_ms;         // average time in B_ST_IN
+    double   pip;           // cmH2O, plant
+    double   vt;            // mL, plant
+} sweep_result_t;
+
+static void usage(const char * prg)
+{
+    fprintf(stderr, "usage: %s [-b min:max:step] [-d min:max] [-p min:max:step] [-n breaths]\n"
+                    "          [-s step_us] [-C compliance] [-R resistance] [-j jobs] [-c]\n", prg);
+    fprintf(stderr, "  -b  BPM range (default 10:30:5)\n");
+    fprintf(stderr, "  -d  duty cycle index range 0..%d (default all)\n", PROT_DUTY_CYCLE_SIZE - 1);
+    fprintf(stderr, "  -p  pause range in milliseconds (default 0:2000:50)\n");
+    fprintf(stderr, "  -n  measured breaths per point (default %d)\n", DEFAULT_BREATHS);
+    fprintf(stderr, "  -s  virtual time advanced per loop pass in microseconds (default %d)\n", DEFAULT_STEP_US);
+    fprintf(stderr, "  -C  lung compliance in mL/cmH2O\n");
+    fprintf(stderr, "  -R  airway resistance in cmH2O/(L/s)\n");
+    fprintf(stderr, "  -j  parallel jobs (default: online CPUs)\n");
+    fprintf(stderr, "  -c  CSV output\n");
+}
+
+static bool parseRange(const char * v, range_t * r)
+{
+    int n = sscanf(v, "%d:%d:%d", &r->min, &r->max, &r->step);
+    if (n == 1) r->max = r->min;
+    if (n < 3) r->step = 1;
+    return n >= 1 && r->step > 0 && r->max >= r->min;
+}
+
+static bool parseArgs(int argc, char * argv[], sweep_opts_t * o)
+{
+    int i;
+    o->bpm.min = 10;   o->bpm.max = 30;   o->bpm.step = 5;
+    o->duty.min = 0;   o->duty.max = PROT_DUTY_CYCLE_SIZE - 1; o->duty.step = 1;
+    o->pause.min = 0;  o->pause.max = 2000; o->pause.step = 50;
+    o->breaths = DEFAULT_BREATHS;
+    o->step_us = DEFAULT_STEP_US;
+    o->jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    o->csv = false;
+    lungGetDefaults(&o->lung);
+
+    for (i=1; i<argc; i++) {
+        const char * a = argv[i];
+        const char * v = (i + 1 < argc) ? argv[i + 1] : 0;
+        if      (strcmp(a, "-c") == 0) o->csv = true;
+        else if (v == 0) return false;
+        else if (strcmp(a, "-b") == 0) { if (!parseRange(v, &o->bpm))   return false; i++; }
+        else if (strcmp(a, "-d") == 0) { if (!parseRange(v, &o->duty))  return false; i++; }
+        else if (strcmp(a, "-p") == 0) { if (!parseRange(v, &o->pause)) return false; i++; }
+        else if (strcmp(a, "-n") == 0) { o->breaths = atoi(v); i++; }
+        else if (strcmp(a, "-s") == 0) { o->step_us = (uint32_t) atol(v); i++; }
+        else if (strcmp(a, "-j") == 0) { o->jobs    = atoi(v); i++; }
+        else if (strcmp(a, "-C") == 0) { o->lung.compliance = (float) atof(v); i++; }
+        else if (strcmp(a, "-R") == 0) { o->lung.resistance = (float) atof(v); i++; }
+        else return false;
+    }
+    if (o->duty.max >= PROT_DUTY_CYCLE_SIZE || o->duty.min < 0) return false;
+    if (o->bpm.min <= 0 || o->breaths <= 0 || o->step_us == 0) return false;
+    if (o->lung.compliance <= 0.0f || o->lung.resistance <= 0.0f) return false;
+    if (o->jobs < 1) o->jobs = 1;
+    return true;
+}
+
+//------ one grid point, runs in a child process ------
+static void runPoint(const sweep_opts_t * o, const sweep_point_t * pt, sweep_result_t * r)
+{
+    logSetQuiet(true);
+    lungInit(&o->lung);
+    halInit(0);
+    ventSetup();
+
+    propSetBpm((uint8_t) pt->bpm);
+    propSetDutyCycle((uint8_t) pt->duty);
+    propSetPause(pt->pause);
+    propSetVent(1);
+
+    uint64_t end_us = (uint64_t) MAX_SIM_MINUTES * 60 * 1000000;
+    float dt = (float) o->step_us / 1000000.0f;
+    B_STATE_t last_state = breatherGetState();
+    int starts = 0;
+    uint64_t first_us = 0, start_us = 0;
+    uint64_t in_sum_us = 0;
+    float pip = 0.0f, pip_sum = 0.0f, vt_max = 0.0f, vt_sum = 0.0f;
+
+    memset(r, 0, sizeof(*r));
+    while (halHostGetMicros() < end_us && starts <= SETTLE_BREATHS + o->breaths) {
+        halHostSetPressure(lungGetPressure());
+        halHostSetFlow(lungGetFlow());
+        ventLoop();
+
+        B_STATE_t st = breatherGetState();
+        uint64_t now = halHostGetMicros();
+        if (st == B_ST_IN && last_state != B_ST_IN) {
+            // a breath is complete: account for it if it was a measured one
+            if (starts > SETTLE_BREATHS) {
+                pip_sum += pip;
+                vt_sum += vt_max;
+            }
+            if (starts == SETTLE_BREATHS) first_us = now;
+            starts++;
+            start_us = now;
+            pip = 0.0f;
+            vt_max = 0.0f;
+        }
+        else if (st != B_ST_IN && last_state == B_ST_IN && starts > SETTLE_BREATHS) {
+            in_sum_us += now - start_us;
+        }
+        last_state = st;
+
+        halHostAdvanceTime(o->step_us);
+        lungStep(dt, halHostValveInIsOpen(), halHostValveOutIsOpen());
+        if (lungGetPressure() > pip) pip = lungGetPressure();
+        if (lungGetVolume() > vt_max) vt_max = lungGetVolume();
+    }
+
+    r->breaths = starts - SETTLE_BREATHS - 1;
+    if (r->breaths > 0) {
+        r->period_ms = (double) (start_us - first_us) / 1000.0 / r->breaths;
+        r->in_ms = (double) in_sum_us / 1000.0 / r->breaths;
+        r->pip = pip_sum / r->breaths;
+        r->vt = vt_sum / r->breaths;
+    }
+    r->done = true;
+}
+
+//------ report ------
+static void printResult(const sweep_opts_t * o, const sweep_point_t * pt, const sweep_result_t * r)
+{
+    // commanded values as the operator reads them: 60000/BPM and the 1:n label
+    double set_period = 60000.0 / pt->bpm;
+    double set_in = set_period / (2 + pt->duty);
+    double set_ie = 1 + pt->duty;
+
+    if (!r->done || r->breaths <= 0 || r->in_ms <= 0.0) {
+        printf(o->csv ? "%d,%d,%d,%.0f,%.0f,%.1f,,,,,,,,\n" : "%4d  1:%d %5d | %6.0f %6.0f %4.1f | no breaths\n",
+               pt->bpm, pt->duty + 1, pt->pause, set_period, set_in, set_ie);
+        return;
+    }
+
+    double ie = (r->period_ms - r->in_ms) / r->in_ms;
+    double bpm = 60000.0 / r->period_ms;
+    double err = 100.0 * (r->period_ms - set_period) / set_period;
+    printf(o->csv ? "%d,%d,%d,%.0f,%.0f,%.1f,%.1f,%.1f,%.2f,%.2f,%.1f,%.1f,%.0f\n"
+                  : "%4d  1:%d %5d | %6.0f %6.0f %4.1f | %7.1f %7.1f %5.2f %6.2f %+7.1f | %5.1f %5.0f\n",
+           pt->bpm, pt->duty + 1, pt->pause, set_period, set_in, set_ie,
+           r->period_ms, r->in_ms, ie, bpm, err, r->pip, r->vt);
+}
+
+int main(int argc, char * argv[])
+{
+    sweep_opts_t opts;
+    if (parseArgs(argc, argv, &opts) == false) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int n_bpm = (opts.bpm.max - opts.bpm.min) / opts.bpm.step + 1;
+    int n_duty = (opts.duty.max - opts.duty.min) / opts.duty.step + 1;
+    int n_pause = (opts.pause.max - opts.pause.min) / opts.pause.step + 1;
+    int n = n_bpm * n_duty * n_pause;
+    int i;
+
+    sweep_point_t * points = (sweep_point_t *) malloc(n * sizeof(sweep_point_t));
+    sweep_result_t * results = (sweep_result_t *) mmap(0, n * sizeof(sweep_result_t), PROT_READ | PROT_WRITE,
+                                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (points == 0 || results == MAP_FAILED) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(results, 0, n * sizeof(sweep_result_t));
+    for (i=0; i<n; i++) {
+        points[i].bpm = opts.bpm.min + (i / (n_duty * n_pause)) * opts.bpm.step;
+        points[i].duty = opts.duty.min + ((i / n_pause) % n_duty) * opts.duty.step;
+        points[i].pause = opts.pause.min + (i % n_pause) * opts.pause.step;
+    }
+
+    auto wall_start = std::chrono::steady_clock::now();
+
+    // the parent never runs the firmware, so every child starts from a clean image
+    int running = 0, failed = 0;
+    fflush(stdout);
+    for (i=0; i<n || running; ) {
+        if (i < n && running < opts.jobs) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                runPoint(&opts, &points[i], &results[i]);
+                _exit(0);
+            }
+            if (pid < 0) {
+                perror("fork");
+                failed++;
+            }
+            else {
+                running++;
+            }
+            i++;
+            continue;
+        }
+        int status;
+        if (wait(&status) < 0) break;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+        running--;
+    }
+
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    if (opts.csv) {
+        printf("bpm,ie,pause,set_period_ms,set_in_ms,set_ie,period_ms,in_ms,ie,bpm_achieved,period_err_pct,pip,vt\n");
+    }
+    else {
+        printf("%15s | %-18s | %-36s | %s\n", "", "commanded", "achieved", "plant");
+        printf("%4s  %3s %5s |%7s%7s%5s |%8s%8s%6s%7s%8s |%6s%6s\n",
+               "BPM", "I:E", "pause", "period", "T_in", "I:E", "period", "T_in", "I:E", "BPM", "err %", "PIP", "Vt");
+    }
+    for (i=0; i<n; i++) {
+        printResult(&opts, &points[i], &results[i]);
+    }
+    fprintf(stderr, "%d points, %d jobs, %.2f s wall%s\n", n, opts.jobs, wall_s, failed ? ", some points failed" : "");
+
+    munmap(results, n * sizeof(sweep_result_t));
+    free(points);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+
+#include <string.h>
+#include "trace_file.h"
+
+static const char magic[4] = { TRACE_MAGIC_0, TRACE_MAGIC_1, TRACE_MAGIC_2, TRACE_MAGIC_3 };
+
+static bool findMagic(FILE * f)
+{
+    int matched = 0;
+    int c;
+
+    while ((c = fgetc(f)) != EOF) {
+        if (c == magic[matched]) {
+            if (++matched == 4) return true;
+        }
+        else {
+            matched = (c == magic[0]) ? 1 : 0;
+        }
+    }
+    return false;
+}
+
+bool traceFileOpen(trace_file_t * t, const char * path)
+{
+    uint8_t * h = (uint8_t *) &t->hdr;
+    const size_t known = sizeof(trace_header_t);
+
+    memset(t, 0, sizeof(*t));
+    t->f = fopen(path, "rb");
+    if (t->f == NULL) return false;
+
+    // magic, then version and headerSize tell how much follows
+    if (findMagic(t->f) == false ||
+        fread(&h[4], 1, known - 4, t->f) != known - 4 ||
+        t->hdr.version != TRACE_VERSION ||
+        t->hdr.headerSize < known) {
+        traceFileClose(t);
+        return false;
+    }
+    memcpy(t->hdr.magic, magic, sizeof(magic));
+
+    // newer, longer header: skip what this reader does not know
+    if (t->hdr.headerSize > known)
+        fseek(t->f, t->hdr.headerSize - known, SEEK_CUR);
+    return true;
+}
+
+bool traceFileNext(trace_file_t * t, trace_record_t * r)
+{
+    if (t->f == NULL) return false;
+    if (fread(r, 1, sizeof(*r), t->f) != sizeof(*r)) return false;
+    t->records++;
+    return true;
+}
+
+void traceFileClose(trace_file_t * t)
+{
+    if (t->f) fclose(t->f);
+    t->f = NULL;
+}
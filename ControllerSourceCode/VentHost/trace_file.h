@@ -0,0 +1,45 @@
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file trace_file.h
+ * @brief Reader for the sensor trace format (ArduinoVent/trace.h).
+ *
+ * Accepts a raw capture of the telemetry port: anything in front of the header
+ * magic (e.g. the tail of telemetry frames) is skipped.
+ */
+
+#include <stdio.h>
+#include "trace.h"
+
+typedef struct trace_file_st {
+    FILE *          f;
+    trace_header_t  hdr;
+    uint32_t        records;    // records read so far
+} trace_file_t;
+
+bool traceFileOpen(trace_file_t * t, const char * path); // false if missing or no valid header
+bool traceFileNext(trace_file_t * t, trace_record_t * r); // false at end of file
+void traceFileClose(trace_file_t * t);
+
+#endif // TRACE_FILE_H
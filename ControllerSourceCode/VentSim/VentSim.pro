@@ -24,11 +24,25 @@ SOURCES += \
     ../ArduinoVent/event.cpp \
     ../ArduinoVent/log.cpp \
     ../ArduinoVent/pressure.cpp \
+    ../ArduinoVent/pcv.cpp \
+    ../ArduinoVent/trigger.cpp \
+    ../ArduinoVent/hplimit.cpp \
+    ../ArduinoVent/valvecal.cpp \
+    ../ArduinoVent/metrics.cpp \
+    ../ArduinoVent/apnea.cpp \
+    ../ArduinoVent/leak.cpp \
+    ../ArduinoVent/blackbox.cpp \
+    ../ArduinoVent/peep.cpp \
+    ../ArduinoVent/profiler.cpp \
+    ../ArduinoVent/trace.cpp \
     ../ArduinoVent/properties.cpp \
+    ../ArduinoVent/sched.cpp \
+    ../ArduinoVent/serialWriter.cpp \
     ../ArduinoVent/ui_native.cpp \
     ../ArduinoVent/vent.cpp \
     bmp280_int_sim.cpp \
     hal_sim.cpp \
+    lung_model.cpp \
     main.cpp \
     mainwindow.cpp
 
@@ -42,9 +56,23 @@ HEADERS += \
     ../ArduinoVent/languages.h \
     ../ArduinoVent/log.h \
     ../ArduinoVent/pressure.h \
+    ../ArduinoVent/pcv.h \
+    ../ArduinoVent/trigger.h \
+    ../ArduinoVent/hplimit.h \
+    ../ArduinoVent/valvecal.h \
+    ../ArduinoVent/metrics.h \
+    ../ArduinoVent/apnea.h \
+    ../ArduinoVent/leak.h \
+    ../ArduinoVent/blackbox.h \
+    ../ArduinoVent/peep.h \
+    ../ArduinoVent/profiler.h \
+    ../ArduinoVent/trace.h \
     ../ArduinoVent/properties.h \
+    ../ArduinoVent/sched.h \
+    ../ArduinoVent/serialWriter.h \
     ../ArduinoVent/ui_native.h \
     ../ArduinoVent/vent.h \
+    lung_model.h \
     mainwindow.h
 
 FORMS += \
@@ -21,12 +21,18 @@
 */
 #include "config.h"
 #include <stdint.h>
+#include "hal.h"
 
 //--------- special return values for bpm280GetPressure and getCmH2OGauge
 #define BMP_ST__INITIALIZING   -100.0f  // initializing
 #define BMP_ST__NOT_FOUND      -200.0f  // could not get initialized
 #define BMP_ST__READ_ERROR     -300.0f  // was initialized but fail to read at some point
 
+#define AMBIENT_PA      101325.0f
+#define CMH2O_TO_PA     98.0665f
+
+extern float simGetLungPressure(); // hal_sim.cpp
+
 
 void  bpm280Init()
 {
@@ -35,7 +41,12 @@ void  bpm280Init()
 
 float bpm280GetPressure() // absolute pressure in Pa, ex:  101982.90
 {
-    return 101982.90;
+    return AMBIENT_PA + simGetLungPressure() * CMH2O_TO_PA;
+}
+
+void  bmp280Loop()
+{
+
 }
 
 void  bmp280SetReference()
@@ -44,7 +55,18 @@ void  bmp280SetReference()
 }
 float getCmH2OGauge()
 {
-    return 10.0;
+    return simGetLungPressure();
+}
+
+// a conversion completes every BMP280_READ_PERIOD; its value is the simulated lung pressure
+uint16_t bmp280GetSampleSeq()
+{
+    return (uint16_t) (halStartTimerRef() / BMP280_READ_PERIOD);
+}
+
+uint32_t bmp280GetSampleTime()
+{
+    return (uint32_t) (halStartTimerRef() / BMP280_READ_PERIOD * BMP280_READ_PERIOD);
 }
 
 
@@ -25,18 +25,29 @@
 #include "config.h"
 #include "properties.h"
 #include "pressure.h"
+#include "lung_model.h"
+#include "toyotaMafSensor.h"
+#include "blackbox.h"
 
 #include <stdio.h>
 #include <QElapsedTimer>
 #include <QMediaPlayer>
 
 static QElapsedTimer milliTimer;
+#ifdef LOOP_PROFILE
+static QElapsedTimer profTimer;
+#endif
 
 static QMediaPlayer player;
 
 static bool alarm = false;
 static bool alarm_phase;
 
+static bool valve_in_open = false;
+static bool valve_out_open = true;
+static uint64_t tm_lung;
+static uint64_t tm_flow;
+
 //---------- Constants ----------
 
 #define TM_KEY_SAMPLING 5  // 5 ms
@@ -67,9 +78,9 @@ static void beep()
     player.play();
 }
 
-void halBeepAlarmOnOff( bool on)
+void halAlarmTone(hal_tone_t t) // one beep a second whatever the priority
 {
-  if (on == true) {
+  if (t != HAL_TONE_OFF) {
     alarm = true;
     alarm_phase = false;
     tm_alarm = halStartTimerRef();
@@ -95,6 +106,9 @@ void halInit(QPlainTextEdit * ed,
   player.setVolume(80);
 
   milliTimer.start();
+#ifdef LOOP_PROFILE
+  profTimer.start();
+#endif
   lcdObj = ed;
   input_valve_on = _input_valve_on;
   input_valve_off = _input_valve_off;
@@ -104,6 +118,9 @@ void halInit(QPlainTextEdit * ed,
 
   tm_led = halStartTimerRef();
   tm_alarm = halStartTimerRef();
+  tm_lung = halStartTimerRef();
+  bboxInit(0);
+  lungInit(0);
   halLcdClear();
   propInit();
   pressInit();
@@ -114,6 +131,11 @@ uint64_t halStartTimerRef()
     return (uint64_t) milliTimer.elapsed();
 }
 
+void halLatchTimerRef()
+{
+
+}
+
 bool halCheckTimerExpired(uint64_t timerRef, uint64_t time)
 {
     uint64_t now = halStartTimerRef();
@@ -122,6 +144,13 @@ bool halCheckTimerExpired(uint64_t timerRef, uint64_t time)
     return false;
 }
 
+#ifdef LOOP_PROFILE
+uint32_t halProfileMicros()
+{
+    return (uint32_t) (profTimer.nsecsElapsed() / 1000);
+}
+#endif
+
 
 void halSetMonitorLED (MONITOR_LET_T speed)
 {
@@ -254,27 +283,39 @@ void halLcdWrite(int col, int row, const char * txt)
 void halValveInOpen()
 {
   //LOG(">>>>>> Valve IN ON");
+  valve_in_open = true;
   input_valve_off->hide();
   input_valve_on->show();
+  bboxValves(halGetValveState());
 }
 void halValveInClose()
 {
     //LOG(">>>>>> Valve IN OFF");
+    valve_in_open = false;
     input_valve_on->hide();
     input_valve_off->show();
-
+    bboxValves(halGetValveState());
 }
 void halValveOutOpen()
 {
   //LOG("<<<<<<<< Valve OUT ON");
+  valve_out_open = true;
   output_valve_off->hide();
   output_valve_on->show();
+  bboxValves(halGetValveState());
 }
 void halValveOutClose()
 {
   //LOG("<<<<<<<< Valve OUT OFF");
+  valve_out_open = false;
   output_valve_on->hide();
   output_valve_off->show();
+  bboxValves(halGetValveState());
+}
+
+uint8_t halGetValveState()
+{
+  return (valve_in_open ? HAL_VALVE_IN_OPEN : 0) | (valve_out_open ? HAL_VALVE_OUT_OPEN : 0);
 }
 
 extern unsigned int gAnalogPressure;
@@ -333,6 +374,17 @@ bool halRestoreDataBlock(uint8_t * data, int size)
 
 }
 
+// no watchdog in the simulator: nothing to snapshot
+bool halSaveBlackBox(int offset, const uint8_t * data, int size)
+{
+    return false;
+}
+
+bool halRestoreBlackBox(int offset, uint8_t * data, int size)
+{
+    return false;
+}
+
 
 //---------------- process keys ----------
 #define   DEBOUNCING_N    4
@@ -354,11 +406,56 @@ static void processKeys()
 
 }
 
+//---------------- lung plant ----------
+// steps the lung model in 1 ms slices for the wall-clock time elapsed since the last pass
+static void lungLoop()
+{
+  uint64_t now = halStartTimerRef();
+  while (tm_lung < now) {
+    lungStep(0.001f, valve_in_open, valve_out_open);
+    tm_lung++;
+  }
+}
+
+// used by bmp280_int_sim.cpp
+float simGetLungPressure()
+{
+  return lungGetPressure();
+}
+
+// flow sensor (replaces toyotaMafSensor.cpp)
+float getFlowRate()
+{
+  return lungGetFlow();
+}
+
+// one flow conversion per millisecond, the lung step
+uint8_t mafReadFlow(flow_sample_t * samples, uint8_t max)
+{
+  uint64_t now = halStartTimerRef();
+  if (max == 0 || now == tm_flow) return 0;
+  tm_flow = now;
+  samples[0].flow = lungGetFlow();
+  samples[0].stamp = (uint32_t) (now * 1000);
+  return 1;
+}
+
+//---------------- telemetry port ----------
+void halTelemetryInit(uint32_t baud)
+{
+
+}
+
+bool halTelemetryWrite(const uint8_t * data, uint8_t len)
+{
+  return true;
+}
+
 void halLoop()
 {
   halBlinkLED();
   processKeys();
-  propLoop();
+  lungLoop();
   pressLoop();
   alarmToggler();
 
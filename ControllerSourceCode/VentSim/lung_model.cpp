@@ -0,0 +1,184 @@
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+#include "lung_model.h"
+#include <math.h>
+
+#define SPONT_INSP_FRACTION 0.35f   // part of each spontaneous cycle with muscle effort
+#define LUNG_PI             3.14159265f
+
+static lung_params_t lp;
+
+//---- derived conductances (L/s per cmH2O), computed once in lungInit
+static float g_in, g_out, g_aw, g_leak, inv_c;
+
+//---- state
+static float volume;        // litres above FRC
+static float p_aw;          // airway pressure, cmH2O
+static float flow_sensor;   // L/s into the patient interface
+static float p_mus;         // muscle pressure, cmH2O
+static float spont_phase;   // 0..1 position inside the spontaneous cycle
+
+typedef struct valve_st {
+    bool  cmd;
+    bool  open;
+    float delay;            // s left before open follows cmd
+} valve_t;
+static valve_t v_in, v_out;
+
+void lungGetDefaults(lung_params_t * p)
+{
+    p->compliance      = 50.0f;   // normal adult, mL/cmH2O
+    p->resistance      = 10.0f;
+    p->supply_pressure = 30.0f;
+    p->r_in            = 50.0f;
+    p->r_out           = 5.0f;
+    p->peep_valve      = 0.0f;
+    p->r_leak          = 0.0f;
+    p->spont_rate      = 0.0f;
+    p->spont_amplitude = 0.0f;
+    p->in_open_delay   = 0.0f;    // ideal valves
+    p->in_close_delay  = 0.0f;
+    p->out_open_delay  = 0.0f;
+    p->out_close_delay = 0.0f;
+}
+
+static float conductance(float r)
+{
+    return (r > 0.0f) ? 1.0f / r : 0.0f;
+}
+
+void lungInit(const lung_params_t * p)
+{
+    if (p)
+        lp = *p;
+    else
+        lungGetDefaults(&lp);
+
+    g_in   = conductance(lp.r_in);
+    g_out  = conductance(lp.r_out);
+    g_aw   = conductance(lp.resistance);
+    g_leak = conductance(lp.r_leak);
+    inv_c  = 1000.0f / lp.compliance; // cmH2O per litre
+
+    volume = 0.0f;
+    p_aw = 0.0f;
+    flow_sensor = 0.0f;
+    p_mus = 0.0f;
+    spont_phase = 0.0f;
+    v_in.cmd = v_in.open = false;
+    v_in.delay = 0.0f;
+    v_out = v_in;
+}
+
+static void updateValve(valve_t * v, bool cmd, float dt, float open_ms, float close_ms)
+{
+    if (cmd != v->cmd) {
+        v->cmd = cmd;
+        v->delay = (cmd ? open_ms : close_ms) / 1000.0f;
+    }
+    if (v->open == v->cmd) return;
+    v->delay -= dt;
+    if (v->delay <= 0.0f) v->open = v->cmd;
+}
+
+static void updateEffort(float dt)
+{
+    if (lp.spont_rate <= 0.0f) {
+        p_mus = 0.0f;
+        return;
+    }
+    spont_phase += dt * lp.spont_rate / 60.0f;
+    if (spont_phase >= 1.0f) spont_phase -= 1.0f;
+
+    if (spont_phase < SPONT_INSP_FRACTION)
+        p_mus = lp.spont_amplitude * sinf(LUNG_PI * spont_phase / SPONT_INSP_FRACTION);
+    else
+        p_mus = 0.0f;
+}
+
+void lungStep(float dt, bool valve_in_open, bool valve_out_open)
+{
+    float gi, go;
+    float p_alv, a, g, k, b;
+
+    updateValve(&v_in, valve_in_open, dt, lp.in_open_delay, lp.in_close_delay);
+    updateValve(&v_out, valve_out_open, dt, lp.out_open_delay, lp.out_close_delay);
+    gi = v_in.open  ? g_in  : 0.0f;
+    go = v_out.open ? g_out : 0.0f;
+
+    updateEffort(dt);
+    p_alv = volume * inv_c - p_mus;
+
+    //---- airway node: sum of flows is zero
+    a = lp.supply_pressure * gi + lp.peep_valve * go;
+    g = gi + go + g_leak + g_aw;
+    if (go > 0.0f && (a + p_alv * g_aw) / g < lp.peep_valve) {
+        // PEEP valve is a one way valve: it closes below its set pressure
+        a -= lp.peep_valve * go;
+        g -= go;
+    }
+
+    //---- alveolar flow = b - k * p_alv, integrated implicitly
+    k = g_aw * (g - g_aw) / g;
+    b = g_aw * a / g;
+    volume = (volume + dt * (b + k * p_mus)) / (1.0f + dt * k * inv_c);
+
+    p_alv = volume * inv_c - p_mus;
+    p_aw = (a + p_alv * g_aw) / g;
+    flow_sensor = (p_aw - p_alv) * g_aw + p_aw * g_leak; // sensor sits upstream of the leak
+}
+
+float lungGetPressure()
+{
+    return p_aw;
+}
+
+float lungGetFlow()
+{
+    return flow_sensor * 60.0f;
+}
+
+float lungGetVolume()
+{
+    return volume * 1000.0f;
+}
+
+float lungGetMusclePressure()
+{
+    return p_mus;
+}
+
+void lungSetEffort(float rate, float amplitude)
+{
+    lp.spont_rate = rate;
+    lp.spont_amplitude = amplitude;
+}
+
+bool lungValveInIsOpen()
+{
+    return v_in.open;
+}
+
+bool lungValveOutIsOpen()
+{
+    return v_out.open;
+}
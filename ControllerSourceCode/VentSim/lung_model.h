@@ -0,0 +1,78 @@
+#ifndef LUNG_MODEL_H
+#define LUNG_MODEL_H
+
+/*************************************************************
+ * Open Ventilator
+ * Copyright (C) 2020 - Marcelo Varanda
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **************************************************************
+*/
+
+/**
+ * @file lung_model.h
+ * @brief Single compartment lung + patient circuit used to close the loop in VentSim/VentHost.
+ *
+ *   supply --[R_in]--(valve in)--+--[R_aw]-- alveoli (C, -Pmus)
+ *                                |
+ *                                +--[R_leak]-- ambient
+ *                                |
+ *                                +--(valve out)--[R_out]-- PEEP valve --> ambient
+ *
+ * The airway node is massless so its pressure is solved algebraically each step;
+ * the alveolar volume is integrated with implicit Euler, which keeps the model
+ * stable for any step size and costs a handful of multiplies per step.
+ *
+ * Units: cmH2O, litres, seconds. Flow is reported in L/min like the flow sensor.
+ *
+ * Each valve follows its command after an opening or closing delay (solenoid
+ * pull-in / drop-out). A command reversed before it took effect is dropped.
+ */
+
+#include <stdint.h>
+
+typedef struct lung_params_st {
+    float compliance;       // mL/cmH2O
+    float resistance;       // airway, cmH2O/(L/s)
+    float supply_pressure;  // inlet gas source, cmH2O
+    float r_in;             // inlet valve + tubing, cmH2O/(L/s)
+    float r_out;            // exhale valve + tubing, cmH2O/(L/s)
+    float peep_valve;       // mechanical PEEP valve on the exhale branch, cmH2O (0 = none)
+    float r_leak;           // leak to ambient at the patient interface, cmH2O/(L/s) (0 = no leak)
+    float spont_rate;       // spontaneous breathing effort, breaths/min (0 = passive patient)
+    float spont_amplitude;  // peak muscle pressure of each effort, cmH2O
+    float in_open_delay;    // inlet valve command to flow, ms
+    float in_close_delay;
+    float out_open_delay;   // exhale valve
+    float out_close_delay;
+} lung_params_t;
+
+void  lungGetDefaults(lung_params_t * p);
+void  lungInit(const lung_params_t * p);    // NULL loads defaults
+
+/**
+ * @brief advance the model by dt seconds with the given valve states.
+ */
+void  lungStep(float dt, bool valve_in_open, bool valve_out_open);
+
+float lungGetPressure();    // airway (sensor) gauge pressure, cmH2O
+float lungGetFlow();        // flow through the patient flow sensor, L/min (+ into patient)
+float lungGetVolume();      // volume above FRC, mL
+float lungGetMusclePressure(); // current spontaneous effort, cmH2O (>= 0)
+void  lungSetEffort(float rate, float amplitude); // change the spontaneous effort on the fly, 0 = apnea
+bool  lungValveInIsOpen();  // valve states after the actuation delays
+bool  lungValveOutIsOpen();
+
+#endif // LUNG_MODEL_H